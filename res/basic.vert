@@ -1,7 +1,13 @@
 #version 330 core
 layout (location = 0) in vec3 a_pos;
 
-uniform mat4 u_projection_view;
+layout (std140) uniform Camera
+{
+    mat4 u_projection_view;
+    vec4 u_camera_position;
+    vec2 u_viewport;     // pixels
+    float u_focal_scale; // projection[1][1]
+};
 uniform mat4 u_model;
 
 void main() {
@@ -2,16 +2,35 @@
 
 layout (location = 0) in vec3 a_pos;
 layout (location = 1) in vec4 a_boid_pos;
-layout (location = 2) in vec4 a_boid_forward;
+layout (location = 2) in vec4 a_boid_forward; // velocity if u_derive_orientation is set
 layout (location = 3) in vec4 a_boid_up;
 layout (location = 4) in vec4 a_boid_right;
 
-uniform mat4 u_projection_view;
+layout (std140) uniform Camera
+{
+    mat4 u_projection_view;
+    vec4 u_camera_position;
+    vec2 u_viewport;     // pixels
+    float u_focal_scale; // projection[1][1]
+};
+uniform bool u_derive_orientation;
 
 void main()
 {
-    mat4 model_matrix = mat4(vec4(a_boid_right.xyz, 0.), vec4(a_boid_up.xyz, 0.), vec4(a_boid_forward.xyz, 0.), a_boid_pos);
+    vec3 forward = a_boid_forward.xyz;
+    vec3 up = a_boid_up.xyz;
+    vec3 right = a_boid_right.xyz;
+
+    if (u_derive_orientation) {
+        // Basis from the velocity alone, rolled so that right stays horizontal
+        forward = normalize(forward);
+        vec3 world_up = abs(forward.y) > 0.999 ? vec3(1., 0., 0.) : vec3(0., 1., 0.);
+        right = normalize(cross(world_up, forward));
+        up = cross(forward, right);
+    }
+
+    mat4 model_matrix = mat4(vec4(right, 0.), vec4(up, 0.), vec4(forward, 0.), vec4(a_boid_pos.xyz, 1.));
     vec4 pos = vec4(a_pos, 1.);
 
     gl_Position = u_projection_view * model_matrix * pos;
-}
\ No newline at end of file
+}
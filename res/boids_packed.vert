@@ -0,0 +1,26 @@
+#version 330 core
+
+layout (location = 0) in vec3 a_pos;
+layout (location = 1) in vec3 a_boid_pos;
+layout (location = 2) in vec4 a_boid_orientation; // unit quaternion (x, y, z, w), snorm16
+
+layout (std140) uniform Camera
+{
+    mat4 u_projection_view;
+    vec4 u_camera_position;
+    vec2 u_viewport;     // pixels
+    float u_focal_scale; // projection[1][1]
+};
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2. * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    // Renormalized, snorm16 quantization leaves it slightly off unit length
+    vec4 q = normalize(a_boid_orientation);
+
+    gl_Position = u_projection_view * vec4(rotate(q, a_pos) + a_boid_pos, 1.);
+}
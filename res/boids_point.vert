@@ -0,0 +1,16 @@
+#version 330 core
+
+layout (location = 0) in vec4 a_boid_pos;
+
+layout (std140) uniform Camera
+{
+    mat4 u_projection_view;
+    vec4 u_camera_position;
+    vec2 u_viewport;     // pixels
+    float u_focal_scale; // projection[1][1]
+};
+
+void main()
+{
+    gl_Position = u_projection_view * vec4(a_boid_pos.xyz, 1.);
+}
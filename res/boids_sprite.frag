@@ -0,0 +1,20 @@
+#version 330 core
+
+flat in vec2 v_direction;
+
+out vec4 FragColor;
+
+void main()
+{
+    // Sprite coordinates in [-1, 1] with y up, then along and across the projected forward
+    vec2 p = vec2(gl_PointCoord.x, 1. - gl_PointCoord.y) * 2. - 1.;
+    float along = dot(p, v_direction);
+    float across = dot(p, vec2(v_direction.y, -v_direction.x));
+
+    // Dart with the tip at along = 1 and the base at along = -0.7
+    if (along < -0.7 || abs(across) > 0.6 * (1. - along) / 1.7) {
+        discard;
+    }
+
+    FragColor = vec4(1.0f, 0.4f, 0.0f, 1.0f);
+}
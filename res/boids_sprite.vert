@@ -0,0 +1,35 @@
+#version 330 core
+
+layout (location = 1) in vec4 a_boid_pos;
+layout (location = 2) in vec4 a_boid_orientation; // forward, velocity or a unit quaternion (x, y, z, w)
+
+layout (std140) uniform Camera
+{
+    mat4 u_projection_view;
+    vec4 u_camera_position;
+    vec2 u_viewport;     // pixels
+    float u_focal_scale; // projection[1][1]
+};
+
+uniform bool u_quaternion;
+uniform float u_sprite_size; // world space
+
+flat out vec2 v_direction; // forward projected to the screen
+
+void main()
+{
+    vec3 forward = a_boid_orientation.xyz;
+    if (u_quaternion) {
+        vec4 q = normalize(a_boid_orientation);
+        vec3 z = vec3(0., 0., 1.);
+        forward = z + 2. * cross(q.xyz, cross(q.xyz, z) + q.w * z);
+    }
+
+    vec4 clip = u_projection_view * vec4(a_boid_pos.xyz, 1.);
+    vec4 clip_head = u_projection_view * vec4(a_boid_pos.xyz + normalize(forward), 1.);
+    vec2 direction = (clip_head.xy / clip_head.w - clip.xy / clip.w) * u_viewport;
+    v_direction = length(direction) > 1e-6 ? normalize(direction) : vec2(0., 1.);
+
+    gl_Position = clip;
+    gl_PointSize = clamp(u_sprite_size * u_focal_scale * 0.5 * u_viewport.y / clip.w, 2., 64.);
+}
@@ -3,15 +3,24 @@
 #define SQRT2 1.41421356237f
 layout (location = 0) in vec3 a_pos;
 
-uniform vec3 u_pos[MAX_OBSTACLES_COUNT];
-uniform float u_radius[MAX_OBSTACLES_COUNT];
+layout (std140) uniform Obstacles
+{
+    vec4 u_obstacles[MAX_OBSTACLES_COUNT]; // xyz position, w radius
+};
 
-uniform mat4 u_projection_view;
+layout (std140) uniform Camera
+{
+    mat4 u_projection_view;
+    vec4 u_camera_position;
+    vec2 u_viewport;     // pixels
+    float u_focal_scale; // projection[1][1]
+};
 
 void main() {
+    float scale = SQRT2 * u_obstacles[gl_InstanceID].w;
     gl_Position = u_projection_view * mat4(
-    vec4(SQRT2*u_radius[gl_InstanceID], 0.f, 0.f, 0.f),
-    vec4(0.f, SQRT2*u_radius[gl_InstanceID], 0.f, 0.f),
-    vec4(0.f, 0.f, SQRT2*u_radius[gl_InstanceID], 0.f),
-    vec4(u_pos[gl_InstanceID], 1.f)) * vec4(a_pos, 1.f);
+    vec4(scale, 0.f, 0.f, 0.f),
+    vec4(0.f, scale, 0.f, 0.f),
+    vec4(0.f, 0.f, scale, 0.f),
+    vec4(u_obstacles[gl_InstanceID].xyz, 1.f)) * vec4(a_pos, 1.f);
 }
@@ -0,0 +1,126 @@
+#include "async_readback.hpp"
+#include <algorithm>
+
+boids::AsyncReadback::AsyncReadback(CopyEngine &engine, size_t capacity)
+: m_engine(engine), m_capacity(capacity) {
+    for (Slot &slot : m_slots) {
+        slot.data = static_cast<glm::vec4 *>(m_engine.allocate_host(4 * m_capacity * sizeof(glm::vec4)));
+    }
+}
+
+boids::AsyncReadback::~AsyncReadback() {
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        // The device must not write into freed memory
+        if (m_slots[i].state == SlotState::InFlight) {
+            m_engine.wait_fence(i);
+        }
+        m_engine.free_host(m_slots[i].data);
+    }
+}
+
+boids::ReadbackTicket boids::AsyncReadback::request(int count, const DeviceSources &sources) {
+    uint64_t sequence = m_next_sequence++;
+    int index = int(sequence % SLOT_COUNT);
+    Slot &slot = m_slots[index];
+
+    // Copies of the previous use of the slot are ordered before the new ones on the device
+    slot.state = SlotState::InFlight;
+    slot.sequence = sequence;
+    slot.count = int(std::clamp(size_t(std::max(count, 0)), size_t(0), m_capacity));
+
+    size_t size = size_t(slot.count) * sizeof(glm::vec4);
+    m_engine.wait_for_device();
+    m_engine.copy_to_host(slot.data, sources.position, size);
+    m_engine.copy_to_host(slot.data + m_capacity, sources.forward, size);
+    m_engine.copy_to_host(slot.data + 2 * m_capacity, sources.up, size);
+    m_engine.copy_to_host(slot.data + 3 * m_capacity, sources.right, size);
+    m_engine.record_fence(index);
+
+    return ReadbackTicket { sequence, index };
+}
+
+void boids::AsyncReadback::protect_sources() {
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        if (m_slots[i].state == SlotState::InFlight) {
+            m_engine.device_wait_fence(i);
+        }
+    }
+}
+
+bool boids::AsyncReadback::is_valid(const ReadbackTicket &ticket) const {
+    const Slot &slot = m_slots[ticket.slot];
+    return slot.state != SlotState::Empty && slot.sequence == ticket.sequence;
+}
+
+bool boids::AsyncReadback::is_ready(const ReadbackTicket &ticket) {
+    if (!is_valid(ticket)) {
+        return false;
+    }
+
+    Slot &slot = m_slots[ticket.slot];
+    if (slot.state == SlotState::InFlight && m_engine.fence_reached(ticket.slot)) {
+        slot.state = SlotState::Ready;
+    }
+    return slot.state == SlotState::Ready;
+}
+
+bool boids::AsyncReadback::wait(const ReadbackTicket &ticket, ReadbackFrame &frame) {
+    if (!is_valid(ticket)) {
+        return false;
+    }
+
+    Slot &slot = m_slots[ticket.slot];
+    if (slot.state == SlotState::InFlight) {
+        m_engine.wait_fence(ticket.slot);
+        slot.state = SlotState::Ready;
+    }
+    frame = frame_of(slot);
+    m_last_returned = std::max(m_last_returned, slot.sequence);
+    return true;
+}
+
+bool boids::AsyncReadback::poll_latest(ReadbackFrame &frame) {
+    const Slot *latest = nullptr;
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        ReadbackTicket ticket { m_slots[i].sequence, i };
+        if (m_slots[i].sequence > m_last_returned && is_ready(ticket) && (!latest || m_slots[i].sequence > latest->sequence)) {
+            latest = &m_slots[i];
+        }
+    }
+    if (!latest) {
+        return false;
+    }
+
+    frame = frame_of(*latest);
+    m_last_returned = latest->sequence;
+    return true;
+}
+
+bool boids::AsyncReadback::acquire_previous(ReadbackFrame &frame) {
+    uint64_t previous = m_next_sequence - 2;
+    if (m_next_sequence < 3 || previous <= m_last_returned) {
+        return false;
+    }
+    return wait(ReadbackTicket { previous, int(previous % SLOT_COUNT) }, frame);
+}
+
+void boids::AsyncReadback::reset() {
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        if (m_slots[i].state == SlotState::InFlight) {
+            m_engine.wait_fence(i);
+        }
+        m_slots[i].state = SlotState::Empty;
+    }
+    m_last_returned = m_next_sequence - 1;
+}
+
+boids::ReadbackFrame boids::AsyncReadback::frame_of(const Slot &slot) const {
+    return ReadbackFrame {
+        slot.sequence,
+        slot.count,
+        slot.data,
+        slot.data + m_capacity,
+        slot.data + 2 * m_capacity,
+        slot.data + 3 * m_capacity
+    };
+}
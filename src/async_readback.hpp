@@ -0,0 +1,121 @@
+#ifndef BOIDS_SIMULATION_ASYNC_READBACK_HPP
+#define BOIDS_SIMULATION_ASYNC_READBACK_HPP
+#include <glm/glm.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace boids {
+    // Device to host copies behind AsyncReadback, implemented with CUDA streams and events
+    // (cuda_gpu::CudaCopyEngine) or by a mock on machines without a GPU
+    class CopyEngine {
+    public:
+        virtual ~CopyEngine() = default;
+
+        // Page-locked when the backend supports it, so copies can run asynchronously
+        virtual void *allocate_host(size_t size) = 0;
+        virtual void free_host(void *ptr) = 0;
+
+        // Copies queued after this call start once the device work queued so far is done
+        virtual void wait_for_device() = 0;
+
+        // Queues a copy and returns immediately
+        virtual void copy_to_host(void *dst, const void *src, size_t size) = 0;
+
+        // Fence `slot` is reached once every copy queued before this call completed
+        virtual void record_fence(int slot) = 0;
+        virtual bool fence_reached(int slot) = 0;
+        virtual void wait_fence(int slot) = 0;
+
+        // Device work queued after this call starts once fence `slot` is reached, without blocking the host
+        virtual void device_wait_fence(int slot) = 0;
+    };
+
+    // Boids of one step in host memory, valid until its slot is requested again
+    struct ReadbackFrame {
+        uint64_t sequence;
+        int count;
+        const glm::vec4 *position;
+        const glm::vec4 *forward;
+        const glm::vec4 *up;
+        const glm::vec4 *right;
+    };
+
+    // Handle of a requested frame, to poll or wait for it like a future
+    struct ReadbackTicket {
+        uint64_t sequence;
+        int slot;
+    };
+
+    // Double-buffered readback of boid state. Step N is copied into one slot while the host reads step N - 1
+    // from the other, so the host never waits for the copy of the step it has just queued.
+    class AsyncReadback {
+    public:
+        constexpr static const int SLOT_COUNT = 2;
+
+        struct DeviceSources {
+            const glm::vec4 *position;
+            const glm::vec4 *forward;
+            const glm::vec4 *up;
+            const glm::vec4 *right;
+        };
+
+        AsyncReadback(CopyEngine &engine, size_t capacity);
+        ~AsyncReadback();
+
+        AsyncReadback(const AsyncReadback &) = delete;
+        AsyncReadback &operator=(const AsyncReadback &) = delete;
+
+        // Queues copies of the first `count` boids into the next slot, after the device work queued so far.
+        // The frame held there before is dropped.
+        ReadbackTicket request(int count, const DeviceSources &sources);
+
+        // Makes device work queued from now on wait for the copies in flight, call it before the device
+        // overwrites their sources
+        void protect_sources();
+
+        // False once the slot of the ticket was requested again
+        bool is_valid(const ReadbackTicket &ticket) const;
+
+        // Does not block
+        bool is_ready(const ReadbackTicket &ticket);
+
+        // Blocks until the copies of the ticket completed, false if the ticket is no longer valid
+        bool wait(const ReadbackTicket &ticket, ReadbackFrame &frame);
+
+        // Newest completed frame not returned before, without blocking
+        bool poll_latest(ReadbackFrame &frame);
+
+        // Frame of the request before the last one, waiting for it if needed. One frame behind the device,
+        // the host reads it while the last request is still copying.
+        bool acquire_previous(ReadbackFrame &frame);
+
+        // Drops every pending frame, e.g. after the simulation restarted
+        void reset();
+
+    private:
+        enum class SlotState {
+            Empty,
+            InFlight,
+            Ready
+        };
+
+        struct Slot {
+            SlotState state = SlotState::Empty;
+            uint64_t sequence = 0;
+            int count = 0;
+            glm::vec4 *data = nullptr; // position, forward, up and right, `capacity` each
+        };
+
+        ReadbackFrame frame_of(const Slot &slot) const;
+
+    private:
+        CopyEngine &m_engine;
+        size_t m_capacity;
+        std::array<Slot, SLOT_COUNT> m_slots;
+        uint64_t m_next_sequence = 1;
+        uint64_t m_last_returned = 0;
+    };
+}
+
+#endif //BOIDS_SIMULATION_ASYNC_READBACK_HPP
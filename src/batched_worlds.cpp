@@ -0,0 +1,359 @@
+#include "batched_worlds.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "neighbor_heap.hpp"
+#include "view_cone.hpp"
+
+namespace {
+    // Same push as SdfView::avoidance over a baked aquarium, from the exact distance to the nearest wall
+    glm::vec3 wall_avoidance(glm::vec3 position, glm::vec3 aquarium_size) {
+        const float wall = 4.f;
+        const float wall_acc = 15.f;
+
+        glm::vec3 d = aquarium_size / 2.f - glm::abs(position);
+        glm::vec3 inward = -glm::sign(position);
+        float dist;
+        glm::vec3 gradient(0.f);
+        if (d.x >= 0.f && d.y >= 0.f && d.z >= 0.f) {
+            int axis = d.x < d.y ? (d.x < d.z ? 0 : 2) : (d.y < d.z ? 1 : 2);
+            dist = d[axis];
+            gradient[axis] = inward[axis];
+        } else {
+            glm::vec3 outside = glm::min(d, glm::vec3(0.f));
+            dist = -glm::length(outside);
+            gradient = -outside * inward;
+        }
+
+        if (dist > wall || glm::dot(gradient, gradient) < 1e-12f) {
+            return glm::vec3(0.f);
+        }
+        return (wall - dist) / wall * wall_acc * glm::normalize(gradient);
+    }
+}
+
+boids::cpu::WorldId boids::cpu::BatchedWorlds::add_world(const SimulationParameters &params) {
+    WorldId world = WorldId(m_params.size());
+    uint32_t start = m_world_start.back();
+    uint32_t count = uint32_t(std::clamp(params.boids_count, 0, int(SimulationParameters::MAX_BOID_COUNT)));
+
+    m_params.push_back(params);
+    m_params.back().boids_count = int(count);
+    m_world_start.push_back(start + count);
+    set_params(world, m_params.back());
+
+    size_t boid_count = start + count;
+    m_world_id.resize(boid_count, world);
+    m_position.resize(boid_count);
+    m_velocity.resize(boid_count);
+
+    reset_world(world);
+    m_layout_dirty = true;
+    return world;
+}
+
+void boids::cpu::BatchedWorlds::clear() {
+    m_params.clear();
+    m_grids.clear();
+    m_world_start.assign(1, 0);
+    m_world_id.clear();
+    m_position.clear();
+    m_velocity.clear();
+    m_layout_dirty = true;
+}
+
+void boids::cpu::BatchedWorlds::set_params(WorldId world, const SimulationParameters &params) {
+    SimulationParameters &stored = m_params[world];
+    int boids_count = stored.boids_count;
+    stored = params;
+    stored.boids_count = boids_count;
+
+    if (stored.interaction_mode != InteractionMode::Metric || stored.boundary_mode == BoundaryMode::Open) {
+        std::cerr << "[Batch]: World " << world << " runs with metric interaction and walls" << std::endl;
+        stored.interaction_mode = InteractionMode::Metric;
+        stored.boundary_mode = stored.boundary_mode == BoundaryMode::Open ? BoundaryMode::Walls : stored.boundary_mode;
+    }
+    m_layout_dirty = true;
+}
+
+void boids::cpu::BatchedWorlds::reset_world(WorldId world) {
+    glm::vec3 half_size = m_params[world].aquarium_size / 2.f;
+    for (uint32_t b_id = world_start(world); b_id < world_end(world); ++b_id) {
+        m_position[b_id] = glm::vec4(rand_vec(-half_size.x, half_size.x, -half_size.y, half_size.y, -half_size.z, half_size.z), 1.f);
+        m_velocity[b_id] = 0.05f * glm::normalize(rand_vec(1., -1., 1., -1., 1., -1.));
+    }
+}
+
+void boids::cpu::BatchedWorlds::layout_grids() {
+    m_grids.resize(m_params.size());
+    uint32_t first_cell = 0;
+    for (WorldId world = 0; world < m_params.size(); ++world) {
+        const SimulationParameters &params = m_params[world];
+        WorldGrid &grid = m_grids[world];
+
+        // Same cell size as SpatialGrid, bounded per world so thousands of worlds keep a small table
+        float volume = params.aquarium_size.x * params.aquarium_size.y * params.aquarium_size.z;
+        float cell_size = params.distance / float(std::max(params.grid_subdivision, 1));
+        if (params.neighbor_cap() > 0 && params.boids_count > 0) {
+            // Cells of about max_neighbors boids, as in SpatialGrid
+            cell_size = std::min(cell_size, std::cbrt(volume * float(params.neighbor_cap()) / float(params.boids_count)));
+        }
+        cell_size = std::max(cell_size, std::cbrt(volume / float(MAX_WORLD_CELL_COUNT)) * 1.01f);
+
+        grid.origin = -params.aquarium_size / 2.f;
+        if (params.periodic()) {
+            grid.grid_size = glm::max(glm::ivec3(glm::floor(params.aquarium_size / cell_size)), glm::ivec3(1));
+            grid.cell_size = params.aquarium_size / glm::vec3(grid.grid_size);
+        } else {
+            grid.grid_size = glm::max(glm::ivec3(glm::ceil(params.aquarium_size / cell_size)), glm::ivec3(1));
+            grid.cell_size = glm::vec3(cell_size);
+        }
+        grid.search_range = glm::ivec3(glm::ceil(params.distance / grid.cell_size));
+        grid.first_cell = first_cell;
+        first_cell += uint32_t(grid.grid_size.x * grid.grid_size.y * grid.grid_size.z);
+    }
+
+    m_cell_start.resize(size_t(first_cell) + 1);
+    m_layout_dirty = false;
+}
+
+glm::ivec3 boids::cpu::BatchedWorlds::cell_coords(const WorldGrid &grid, bool periodic, glm::vec3 position) const {
+    glm::ivec3 coords = glm::ivec3(glm::floor((position - grid.origin) / grid.cell_size));
+    if (periodic) {
+        return ((coords % grid.grid_size) + grid.grid_size) % grid.grid_size;
+    }
+    return glm::clamp(coords, glm::ivec3(0), grid.grid_size - 1);
+}
+
+void boids::cpu::BatchedWorlds::build_grid(Execution execution) {
+    if (m_layout_dirty) {
+        layout_grids();
+    }
+
+    size_t boid_count = m_world_id.size();
+    m_cell_id.resize(boid_count);
+    m_sorted_ids.resize(boid_count);
+    m_sorted_position.resize(boid_count);
+    m_sorted_velocity.resize(boid_count);
+
+    // Cells of a world hold only its boids and follow the cells of the previous world, so every world
+    // sorts its own range of boids into its own range of cells
+    IndexRange<WorldId> worlds = indices(WorldId(m_params.size()));
+    boids::for_each(execution, worlds.begin(), worlds.end(), [&](WorldId world) {
+        const WorldGrid &grid = m_grids[world];
+        bool periodic = m_params[world].periodic();
+        uint32_t start = world_start(world);
+        uint32_t end = world_end(world);
+        uint32_t cell_count = uint32_t(grid.grid_size.x * grid.grid_size.y * grid.grid_size.z);
+        uint32_t *cell_start = m_cell_start.data() + grid.first_cell;
+
+        std::fill(cell_start, cell_start + cell_count, 0u);
+        for (uint32_t b_id = start; b_id < end; ++b_id) {
+            glm::ivec3 coords = cell_coords(grid, periodic, glm::vec3(m_position[b_id]));
+            uint32_t cell = uint32_t(coords.x + coords.y * grid.grid_size.x + coords.z * grid.grid_size.x * grid.grid_size.y);
+            m_cell_id[b_id] = cell;
+            ++cell_start[cell];
+        }
+
+        uint32_t offset = start;
+        for (uint32_t cell = 0; cell < cell_count; ++cell) {
+            uint32_t count = cell_start[cell];
+            cell_start[cell] = offset;
+            offset += count;
+        }
+
+        // Scatter, cell_start temporarily serves as the write cursor
+        for (uint32_t b_id = start; b_id < end; ++b_id) {
+            uint32_t slot = cell_start[m_cell_id[b_id]]++;
+            m_sorted_ids[slot] = b_id;
+            m_sorted_position[slot] = m_position[b_id];
+            m_sorted_velocity[slot] = m_velocity[b_id];
+        }
+        for (uint32_t cell = cell_count; cell-- > 1;) {
+            cell_start[cell] = cell_start[cell - 1];
+        }
+        cell_start[0] = start;
+    });
+    m_cell_start.back() = uint32_t(boid_count);
+}
+
+glm::vec3 boids::cpu::BatchedWorlds::flocking_acceleration(uint32_t slot) const {
+    WorldId world = m_world_id[m_sorted_ids[slot]];
+    const SimulationParameters &params = m_params[world];
+    const WorldGrid &grid = m_grids[world];
+    bool periodic = params.periodic();
+
+    glm::vec3 separation(0.);
+    glm::vec3 avg_vel(0.);
+    glm::vec3 avg_pos(0.);
+    uint32_t neighbors_count = 0;
+
+    glm::vec3 pos = glm::vec3(m_sorted_position[slot]);
+    float distance2_max = params.distance * params.distance;
+    bool limited_view = params.limited_view();
+    float cos_half_view_angle = params.cos_half_view_angle();
+    glm::vec3 forward = glm::normalize(m_sorted_velocity[slot]);
+
+    // With the periodic boundary the window is cut to one period per axis, so no cell is visited twice,
+    // and the nearest image is taken per boid
+    glm::ivec3 center = cell_coords(grid, periodic, pos);
+    glm::ivec3 start = center - grid.search_range;
+    glm::ivec3 end = center + grid.search_range;
+    if (periodic) {
+        end = glm::min(end, start + grid.grid_size - 1);
+    } else {
+        start = glm::max(start, glm::ivec3(0));
+        end = glm::min(end, grid.grid_size - 1);
+    }
+
+    if (params.neighbor_cap() > 0) {
+        return capped_flocking_acceleration(slot, center, start, end);
+    }
+
+    for (int z = start.z; z <= end.z; ++z) {
+        for (int y = start.y; y <= end.y; ++y) {
+            for (int x = start.x; x <= end.x; ++x) {
+                glm::ivec3 coords(x, y, z);
+                if (periodic) {
+                    coords = ((coords % grid.grid_size) + grid.grid_size) % grid.grid_size;
+                }
+                uint32_t cell = grid.first_cell + uint32_t(coords.x + coords.y * grid.grid_size.x + coords.z * grid.grid_size.x * grid.grid_size.y);
+
+                for (uint32_t k = m_cell_start[cell]; k < m_cell_start[cell + 1]; ++k) {
+                    if (k == slot) {
+                        continue;
+                    }
+
+                    glm::vec3 diff = params.minimum_image(pos - glm::vec3(m_sorted_position[k]));
+                    float distance2 = glm::dot(diff, diff);
+                    if (distance2 > distance2_max || distance2 == 0.f) {
+                        continue;
+                    }
+
+                    if (limited_view && !in_view_cone(forward, -diff, distance2, cos_half_view_angle)) {
+                        continue;
+                    }
+
+                    separation += glm::normalize(diff) / distance2;
+                    avg_vel += m_sorted_velocity[k];
+                    avg_pos += pos - diff;
+                    ++neighbors_count;
+                }
+            }
+        }
+    }
+
+    if (neighbors_count == 0) {
+        return glm::vec3(0.f);
+    }
+
+    avg_vel /= float(neighbors_count);
+    avg_pos /= float(neighbors_count);
+
+    return params.separation * separation +
+           params.alignment * (avg_vel - m_sorted_velocity[slot]) +
+           params.cohesion * (avg_pos - pos);
+}
+
+glm::vec3 boids::cpu::BatchedWorlds::capped_flocking_acceleration(uint32_t slot, glm::ivec3 center, glm::ivec3 start, glm::ivec3 end) const {
+    WorldId world = m_world_id[m_sorted_ids[slot]];
+    const SimulationParameters &params = m_params[world];
+    const WorldGrid &grid = m_grids[world];
+    bool periodic = params.periodic();
+
+    BoidNeighbor nearest[SimulationParameters::MAX_CAPPED_NEIGHBORS];
+    NeighborHeap capped(nearest, params.neighbor_cap());
+
+    glm::vec3 pos = glm::vec3(m_sorted_position[slot]);
+    float distance2_max = params.distance * params.distance;
+    bool limited_view = params.limited_view();
+    float cos_half_view_angle = params.cos_half_view_angle();
+    glm::vec3 forward = glm::normalize(m_sorted_velocity[slot]);
+    float min_cell_size = std::min(grid.cell_size.x, std::min(grid.cell_size.y, grid.cell_size.z));
+
+    int last_shell = max_shell(center, start, end);
+    for (int shell = 0; shell <= last_shell && !shell_beyond(shell, min_cell_size, distance2_max, capped); ++shell) {
+        for_each_shell_cell(center, shell, start, end, [&](glm::ivec3 coords) {
+            if (periodic) {
+                coords = ((coords % grid.grid_size) + grid.grid_size) % grid.grid_size;
+            }
+            uint32_t cell = grid.first_cell + uint32_t(coords.x + coords.y * grid.grid_size.x + coords.z * grid.grid_size.x * grid.grid_size.y);
+
+            // Candidates are identified by their sorted slot
+            for (uint32_t k = m_cell_start[cell]; k < m_cell_start[cell + 1]; ++k) {
+                if (k == slot) {
+                    continue;
+                }
+
+                glm::vec3 diff = params.minimum_image(pos - glm::vec3(m_sorted_position[k]));
+                float distance2 = glm::dot(diff, diff);
+                if (distance2 > distance2_max || distance2 == 0.f) {
+                    continue;
+                }
+                if (limited_view && !in_view_cone(forward, -diff, distance2, cos_half_view_angle)) {
+                    continue;
+                }
+                capped.offer(distance2, k);
+            }
+        });
+    }
+
+    if (capped.count() == 0) {
+        return glm::vec3(0.f);
+    }
+
+    glm::vec3 separation(0.);
+    glm::vec3 avg_vel(0.);
+    glm::vec3 avg_pos(0.);
+    for (int i = 0; i < capped.count(); ++i) {
+        uint32_t k = capped[i].id;
+        glm::vec3 diff = params.minimum_image(pos - glm::vec3(m_sorted_position[k]));
+
+        separation += glm::normalize(diff) / capped[i].distance2;
+        avg_vel += m_sorted_velocity[k];
+        avg_pos += pos - diff;
+    }
+
+    avg_vel /= float(capped.count());
+    avg_pos /= float(capped.count());
+
+    return params.separation * separation +
+           params.alignment * (avg_vel - m_sorted_velocity[slot]) +
+           params.cohesion * (avg_pos - pos);
+}
+
+void boids::cpu::BatchedWorlds::step(float dt, Execution execution) {
+    if (m_world_id.empty()) {
+        return;
+    }
+
+    build_grid(execution);
+    m_next_position.resize(m_position.size());
+    m_next_velocity.resize(m_velocity.size());
+
+    // One pass over all worlds in sorted order, nearby slots share their cells
+    IndexRange<uint32_t> slots = indices(uint32_t(m_world_id.size()));
+    boids::for_each(execution, slots.begin(), slots.end(), [&](uint32_t slot) {
+        BoidId b_id = m_sorted_ids[slot];
+        const SimulationParameters &params = m_params[m_world_id[b_id]];
+        glm::vec3 position = glm::vec3(m_sorted_position[slot]);
+
+        glm::vec3 acceleration = flocking_acceleration(slot) + params.noise * rand_unit_vec();
+        if (params.walls()) {
+            acceleration += wall_avoidance(position, params.aquarium_size);
+        }
+
+        glm::vec3 velocity = m_sorted_velocity[slot] + acceleration * dt;
+        if (glm::length(velocity) > params.max_speed) {
+            velocity = glm::normalize(velocity) * params.max_speed;
+        } else if (glm::length(velocity) < params.min_speed) {
+            velocity = glm::normalize(velocity) * params.min_speed;
+        }
+
+        m_next_velocity[b_id] = velocity;
+        m_next_position[b_id] = glm::vec4(params.wrap_position(position + velocity * dt), m_sorted_position[slot].w);
+    });
+
+    std::swap(m_position, m_next_position);
+    std::swap(m_velocity, m_next_velocity);
+}
@@ -0,0 +1,90 @@
+#ifndef BOIDS_SIMULATION_BATCHED_WORLDS_HPP
+#define BOIDS_SIMULATION_BATCHED_WORLDS_HPP
+#include <glm/glm.hpp>
+#include <vector>
+#include "boids.hpp"
+#include "execution.hpp"
+
+namespace boids::cpu {
+    using WorldId = uint32_t;
+
+    // Many small independent flocks packed into one SoA store, boids of a world are contiguous and tagged
+    // with their world id. A step bins all worlds into one grid whose cells never span two worlds, then
+    // runs a single per-boid pass over the whole store, so neighbour search stays inside each world.
+    //
+    // Worlds have no obstacles, their aquarium walls are evaluated analytically instead of baking a field
+    // per world. Topological interaction, cell aggregates and the open boundary are not batched, such
+    // worlds run with metric interaction and walls.
+    class BatchedWorlds {
+    public:
+        constexpr static const size_t MAX_WORLD_CELL_COUNT = 1 << 16;
+
+        BatchedWorlds() = default;
+
+        // Appends a world of params.boids_count boids at random positions
+        WorldId add_world(const SimulationParameters &params);
+        void clear();
+
+        size_t world_count() const { return m_params.size(); }
+        size_t boid_count() const { return m_world_id.size(); }
+
+        const SimulationParameters &params(WorldId world) const { return m_params[world]; }
+
+        // Everything but boids_count can change between steps
+        void set_params(WorldId world, const SimulationParameters &params);
+
+        // Random positions and velocities for the boids of one world
+        void reset_world(WorldId world);
+
+        // Boids of the world are [world_start(world), world_end(world)) in the arrays below
+        uint32_t world_start(WorldId world) const { return m_world_start[world]; }
+        uint32_t world_end(WorldId world) const { return m_world_start[world + 1]; }
+
+        const std::vector<WorldId> &world_id() const { return m_world_id; }
+        const std::vector<glm::vec4> &position() const { return m_position; }
+        const std::vector<glm::vec3> &velocity() const { return m_velocity; }
+
+        // Advances every world by dt
+        void step(float dt, Execution execution = Execution::Parallel);
+
+    private:
+        // Grid of one world, its cells are m_cell_start[first_cell .. first_cell + cell_count]
+        struct WorldGrid {
+            glm::vec3 origin;
+            glm::vec3 cell_size;
+            glm::ivec3 grid_size;
+            glm::ivec3 search_range;
+            uint32_t first_cell;
+        };
+
+        void layout_grids();
+        void build_grid(Execution execution);
+        glm::ivec3 cell_coords(const WorldGrid &grid, bool periodic, glm::vec3 position) const;
+        // Acceleration of the boid in sorted slot `slot`
+        glm::vec3 flocking_acceleration(uint32_t slot) const;
+        // Approximate mode, the nearest max_neighbors boids found by searching the window [start, end] in shells
+        glm::vec3 capped_flocking_acceleration(uint32_t slot, glm::ivec3 center, glm::ivec3 start, glm::ivec3 end) const;
+
+    private:
+        std::vector<SimulationParameters> m_params;
+        std::vector<WorldGrid> m_grids;
+        std::vector<uint32_t> m_world_start { 0 };
+
+        std::vector<WorldId> m_world_id;
+        std::vector<glm::vec4> m_position;
+        std::vector<glm::vec3> m_velocity;
+        std::vector<glm::vec4> m_next_position;
+        std::vector<glm::vec3> m_next_velocity;
+
+        // Boids sorted by cell, with their position and velocity copied in the same order,
+        // so the neighbour scans read contiguous memory
+        std::vector<uint32_t> m_cell_id;
+        std::vector<uint32_t> m_cell_start;
+        std::vector<BoidId> m_sorted_ids;
+        std::vector<glm::vec4> m_sorted_position;
+        std::vector<glm::vec3> m_sorted_velocity;
+        bool m_layout_dirty = true;
+    };
+}
+
+#endif //BOIDS_SIMULATION_BATCHED_WORLDS_HPP
@@ -1,20 +1,29 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
 #include <random>
+#include <glm/gtc/quaternion.hpp>
 #include "boids.hpp"
-#include "gl_debug.h"
-#include "boids_cpu.hpp"
-#include "cuda_runtime.h"
-#include "cuda_gl_interop.h"
 
 boids::SimulationParameters::SimulationParameters()
-        : distance(5.f),
+        : boids_count(10000),
+          distance(5.f),
           separation(1.f),
           alignment(1.f),
           cohesion(1.f),
-          aquarium_size(glm::vec3(40.f, 40.f, 40.f)),
-          min_speed(1.5f),
           max_speed(4.f),
+          min_speed(1.5f),
           noise(0.f),
-          boids_count(10000)
+          max_neighbors(0),
+          grid_subdivision(2),
+          use_cell_aggregates(false),
+          interaction_mode(InteractionMode::Metric),
+          topological_neighbors(7),
+          view_angle(360.f),
+          boundary_mode(BoundaryMode::Walls),
+          aquarium_size(glm::vec3(40.f, 40.f, 40.f)),
+          shader_orientation(false)
 { }
 
 boids::SimulationParameters::SimulationParameters(float distance, float separation, float alignment, float cohesion)
@@ -25,86 +34,37 @@ boids::SimulationParameters::SimulationParameters(float distance, float separati
     this->cohesion = cohesion;
 }
 
-boids::BoidsRenderer::BoidsRenderer()
-: m_mesh(common::Mesh()) {
-    // Let a boid face the direction based on forward vector in lh
-    float vertices[] = {
-            0.3f,  0.f, -0.3f,
-            -0.3f, 0.f, -0.3f,
-            0.f, 0.f, 0.6f,
-            0.f, 0.3f, -0.3f
-    };
-
-    unsigned int indices[] = {
-            0, 1, 2,
-            0, 3, 2,
-            1, 2, 3,
-            0, 1, 3
-    };
-
-    m_mesh.set(vertices, sizeof(vertices), indices, sizeof(indices), 12);
-
-    m_mesh.bind();
-    GLCall( glGenBuffers(1, &m_pos_vbo_id) );
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_pos_vbo_id) );
-    GLCall( glEnableVertexAttribArray(1) );
-    GLCall( glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
-    GLCall( glVertexAttribDivisor(1, 1) );
-
-    GLCall( glGenBuffers(1, &m_forward_vbo_id) );
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_forward_vbo_id) );
-    GLCall( glEnableVertexAttribArray(2) );
-    GLCall( glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
-    GLCall( glVertexAttribDivisor(2, 1) );
-
-    GLCall( glGenBuffers(1, &m_up_vbo_id) );
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_up_vbo_id) );
-    GLCall( glEnableVertexAttribArray(3) );
-    GLCall( glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
-    GLCall( glVertexAttribDivisor(3, 1) );
-
-    GLCall( glGenBuffers(1, &m_right_vbo_id) );
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_right_vbo_id) );
-    GLCall( glEnableVertexAttribArray(4) );
-    GLCall( glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
-    GLCall( glVertexAttribDivisor(4, 1) );
-
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, 0) );
-    GLCall( glBindVertexArray(0) );
-}
-
-void boids::BoidsRenderer::set_vbos(const SimulationParameters& params, const std::vector<glm::vec4> &position, const boids::BoidsOrientation &orientation) {
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_pos_vbo_id) );
-    GLCall( glBufferData(GL_ARRAY_BUFFER, params.boids_count * sizeof(glm::vec4), position.data(), GL_DYNAMIC_DRAW));
-
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_forward_vbo_id) );
-    GLCall( glBufferData(GL_ARRAY_BUFFER, params.boids_count * sizeof(glm::vec4), orientation.forward.data(), GL_DYNAMIC_DRAW));
-
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_up_vbo_id) );
-    GLCall( glBufferData(GL_ARRAY_BUFFER, params.boids_count * sizeof(glm::vec4), orientation.up.data(), GL_DYNAMIC_DRAW));
-
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_right_vbo_id) );
-    GLCall( glBufferData(GL_ARRAY_BUFFER, params.boids_count * sizeof(glm::vec4), orientation.right.data(), GL_DYNAMIC_DRAW));
-}
-
-void boids::BoidsRenderer::cuda_register_vbos(cudaGraphicsResource** positions, cudaGraphicsResource** forward, cudaGraphicsResource** up, cudaGraphicsResource** right) const {
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_pos_vbo_id) );
-    cudaGraphicsGLRegisterBuffer(positions, m_pos_vbo_id, cudaGraphicsMapFlagsWriteDiscard);
-
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_forward_vbo_id) );
-    cudaGraphicsGLRegisterBuffer(forward, m_forward_vbo_id, cudaGraphicsMapFlagsWriteDiscard);
-
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_up_vbo_id) );
-    cudaGraphicsGLRegisterBuffer(up, m_up_vbo_id, cudaGraphicsMapFlagsWriteDiscard);
-
-    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_right_vbo_id) );
-    cudaGraphicsGLRegisterBuffer(right, m_right_vbo_id, cudaGraphicsMapFlagsWriteDiscard);
-}
-
-void boids::BoidsRenderer::draw(const common::ShaderProgram &shader_program, int count) const {
-    shader_program.bind();
-    m_mesh.bind();
-    GLCall( glDrawElementsInstanced(GL_TRIANGLES, m_mesh.get_count(), GL_UNSIGNED_INT, nullptr, count) );
+bool boids::SimulationParameters::operator==(const SimulationParameters &other) const {
+    return boids_count == other.boids_count
+            && distance == other.distance
+            && separation == other.separation
+            && alignment == other.alignment
+            && cohesion == other.cohesion
+            && max_speed == other.max_speed
+            && min_speed == other.min_speed
+            && noise == other.noise
+            && max_neighbors == other.max_neighbors
+            && grid_subdivision == other.grid_subdivision
+            && use_cell_aggregates == other.use_cell_aggregates
+            && interaction_mode == other.interaction_mode
+            && topological_neighbors == other.topological_neighbors
+            && view_angle == other.view_angle
+            && boundary_mode == other.boundary_mode
+            && aquarium_size == other.aquarium_size
+            && shader_orientation == other.shader_orientation;
+}
+
+boids::PackedBoidInstance boids::PackedBoidInstance::pack(glm::vec4 position, glm::vec4 forward, glm::vec4 up, glm::vec4 right) {
+    // Columns of the rotation are the basis vectors, as in the model matrix of boids.vert
+    glm::quat q = glm::quat_cast(glm::mat3(glm::vec3(right), glm::vec3(up), glm::vec3(forward)));
+
+    PackedBoidInstance instance{};
+    instance.position = glm::vec3(position);
+    float components[] = { q.x, q.y, q.z, q.w };
+    for (int i = 0; i < 4; ++i) {
+        instance.orientation[i] = static_cast<int16_t>(std::round(glm::clamp(components[i], -1.f, 1.f) * 32767.f));
+    }
+    return instance;
 }
 
 boids::Boids::Boids(const boids::SimulationParameters &sim_params) {
@@ -147,6 +107,35 @@ void boids::Boids::reset(const SimulationParameters& sim_params) {
 }
 
 
+namespace {
+    std::atomic<uint32_t> random_seed { 0 };
+    std::atomic<uint32_t> random_seed_generation { 0 };
+    std::atomic<uint32_t> next_thread_ordinal { 0 };
+
+    // One generator per thread, so the parallel CPU solvers can draw noise concurrently
+    std::mt19937 &thread_generator() {
+        thread_local std::mt19937 gen(std::random_device{}());
+        thread_local uint32_t seed_generation = 0;
+        thread_local uint32_t thread_ordinal = next_thread_ordinal++;
+
+        uint32_t current_generation = random_seed_generation.load(std::memory_order_acquire);
+        if (seed_generation != current_generation) {
+            seed_generation = current_generation;
+            gen.seed(random_seed.load(std::memory_order_relaxed) + 0x9E3779B9u * thread_ordinal);
+        }
+        return gen;
+    }
+}
+
+void boids::seed_random(uint32_t seed) {
+    random_seed.store(seed, std::memory_order_relaxed);
+    random_seed_generation.fetch_add(1, std::memory_order_release);
+}
+
+void boids::seed_thread_random(uint32_t seed) {
+    thread_generator().seed(seed);
+}
+
 glm::vec3 boids::rand_vec(float min_x, float max_x, float min_y, float max_y, float min_z, float max_z) {
     if (max_x < min_x) {
         std::swap(min_x, max_x);
@@ -158,8 +147,7 @@ glm::vec3 boids::rand_vec(float min_x, float max_x, float min_y, float max_y, fl
         std::swap(min_z, max_z);
     }
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 &gen = thread_generator();
     std::uniform_real_distribution<float> dist_x(min_x, max_x);
     std::uniform_real_distribution<float> dist_y(min_y, max_y);
     std::uniform_real_distribution<float> dist_z(min_z, max_z);
@@ -176,7 +164,7 @@ glm::vec3 boids::rand_unit_vec() {
 }
 
 boids::Obstacles::Obstacles()
-: m_radius(), m_pos(), m_box() {
+: m_radius(), m_pos() {
     m_radius.reserve(SimulationParameters::MAX_OBSTACLES_COUNT);
     m_pos.reserve(SimulationParameters::MAX_OBSTACLES_COUNT);
 }
@@ -201,15 +189,6 @@ glm::vec3 &boids::Obstacles::pos(size_t elem) {
     return m_pos[elem];
 }
 
-void boids::Obstacles::draw(common::ShaderProgram &program) {
-    program.bind();
-    for (int i = 0; i < m_radius.size(); ++i) {
-        program.set_uniform_3f(("u_pos[" + std::to_string(i) + "]").c_str(), m_pos[i]);
-        program.set_uniform_1f(("u_radius[" + std::to_string(i) + "]").c_str(), m_radius[i]);
-    }
-    m_box.draw_instanced(program, m_radius.size());
-}
-
 const float &boids::Obstacles::radius(size_t elem) const {
     return m_radius[elem];
 }
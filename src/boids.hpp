@@ -1,23 +1,35 @@
 #ifndef BOIDS_SIMULATION_BOIDS_HPP
 #define BOIDS_SIMULATION_BOIDS_HPP
 
-#include <GL/glew.h>
-#include "shader_program.hpp"
 #include <glm/glm.hpp>
+#include <cstdint>
 #include <vector>
-#include "primitives.h"
-#include <cuda_runtime.h>
-#include <cuda_gl_interop.h>
+#include "host_device.hpp"
 
 
 namespace boids {
     using BoidId = uint32_t;
 
+    enum class InteractionMode : int {
+        Metric,     // every boid within `distance`
+        Topological // fixed number of nearest boids, regardless of distance
+    };
+
+    enum class BoundaryMode : int {
+        Walls,   // soft repulsive walls baked into the environment SDF
+        Periodic, // boids leaving the aquarium reenter on the opposite side
+        Open      // no bounds, the aquarium only sets where boids start
+    };
+
     class SimulationParameters {
     public:
         SimulationParameters();
         SimulationParameters(float distance, float separation, float alignment, float cohesion);
 
+        // Field by field, so padding is ignored and +0 equals -0
+        bool operator==(const SimulationParameters &other) const;
+        bool operator!=(const SimulationParameters &other) const { return !(*this == other); }
+
     public:
         constexpr static const size_t MAX_BOID_COUNT = 50000;
 
@@ -37,6 +49,10 @@ namespace boids {
         constexpr static const float MAX_OBSTACLE_RADIUS = 10.f;
         constexpr static const float MIN_OBSTACLE_RADIUS = 1.f;
 
+        constexpr static const int MAX_TOPOLOGICAL_NEIGHBORS = 32;
+        // Bounds the per boid nearest-neighbour heap of the approximate mode
+        constexpr static const int MAX_CAPPED_NEIGHBORS = 128;
+
     public:
         int boids_count;
 
@@ -50,7 +66,55 @@ namespace boids {
 
         float noise;
 
+        // Approximate mode: only the nearest max_neighbors neighbours contribute to a boid, 0 means exact
+        int max_neighbors;
+
+        // max_neighbors clamped to MAX_CAPPED_NEIGHBORS, 0 in exact mode
+        BOIDS_HOST_DEVICE int neighbor_cap() const {
+            return max_neighbors <= 0 ? 0 : (max_neighbors < MAX_CAPPED_NEIGHBORS ? max_neighbors : MAX_CAPPED_NEIGHBORS);
+        }
+
+        // CPU grid: cells per view radius, and whether cells fully inside the view sphere use their sums
+        int grid_subdivision;
+        bool use_cell_aggregates;
+
+        // CPU grid: topological mode interacts with the `topological_neighbors` nearest boids
+        InteractionMode interaction_mode;
+        int topological_neighbors;
+
+        // Field of view in degrees, boids do not perceive neighbours in the blind angle behind them
+        float view_angle;
+
+        BOIDS_HOST_DEVICE bool limited_view() const { return view_angle < 360.f; }
+        BOIDS_HOST_DEVICE float cos_half_view_angle() const { return glm::cos(glm::radians(view_angle) * 0.5f); }
+
+        // CPU solvers: periodic boundary wraps positions and measures distances to the nearest periodic image,
+        // open world has no walls and hashes the grid cells
+        BoundaryMode boundary_mode;
+
+        BOIDS_HOST_DEVICE bool walls() const { return boundary_mode == BoundaryMode::Walls; }
+        BOIDS_HOST_DEVICE bool periodic() const { return boundary_mode == BoundaryMode::Periodic; }
+
+        // Shortest periodic image of an offset between two boids
+        BOIDS_HOST_DEVICE glm::vec3 minimum_image(glm::vec3 offset) const {
+            if (!periodic()) {
+                return offset;
+            }
+            return offset - aquarium_size * glm::round(offset / aquarium_size);
+        }
+
+        // Maps a position back into [-aquarium_size / 2, aquarium_size / 2)
+        BOIDS_HOST_DEVICE glm::vec3 wrap_position(glm::vec3 position) const {
+            if (!periodic()) {
+                return position;
+            }
+            return position - aquarium_size * glm::floor(position / aquarium_size + 0.5f);
+        }
+
         glm::vec3 aquarium_size;
+
+        // Skips the orientation phase of the solvers, boids.vert builds the basis from the velocity
+        bool shader_orientation;
     };
 
     struct BoidsOrientation {
@@ -78,19 +142,18 @@ namespace boids {
         BoidsOrientation orientation;
     };
 
-    class BoidsRenderer {
-    public:
-        // Initializes boids data
-        BoidsRenderer();
+    // Compact instance attributes, 20 bytes per boid instead of four vec4s
+    struct PackedBoidInstance {
+        glm::vec3 position;
+        int16_t orientation[4]; // unit quaternion (x, y, z, w) as snorm16
 
-        void draw(const common::ShaderProgram &shader_program, int count) const;
-        void set_vbos(const SimulationParameters &params, const std::vector<glm::vec4> &position, const BoidsOrientation &orientation);
-        void cuda_register_vbos(cudaGraphicsResource** positions, cudaGraphicsResource** forward, cudaGraphicsResource** up, cudaGraphicsResource** right) const;
-        
-    private:
-        common::Mesh m_mesh;
+        static PackedBoidInstance pack(glm::vec4 position, glm::vec4 forward, glm::vec4 up, glm::vec4 right);
+    };
 
-        GLuint m_pos_vbo_id, m_forward_vbo_id, m_up_vbo_id, m_right_vbo_id;
+    // Instance attributes when the orientation is derived in boids.vert
+    struct VelocityBoidInstance {
+        glm::vec3 position;
+        glm::vec3 velocity;
     };
 
     class Obstacles {
@@ -112,14 +175,19 @@ namespace boids {
 
         size_t count() const { return m_radius.size(); }
 
-        void draw(common::ShaderProgram& program);
     private:
         std::vector<float> m_radius;
         std::vector<glm::vec3> m_pos;
-
-        common::Box m_box;
     };
 
+
+    // Reseeds the generators of rand_vec, the thread calling it next draws a reproducible sequence.
+    // CPU noise drawn by the parallel solvers still depends on how boids are spread over the threads.
+    void seed_random(uint32_t seed);
+
+    // Reseeds only the generator of the calling thread, until the next seed_random. A simulation kept on one
+    // thread (Execution::Sequential) then draws the same initial state and noise on any thread.
+    void seed_thread_random(uint32_t seed);
     glm::vec3 rand_vec(float min_x, float max_x, float min_y, float max_y, float min_z, float max_z);
     glm::vec3 rand_unit_vec();
 }
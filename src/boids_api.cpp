@@ -0,0 +1,233 @@
+#include "boids_api.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include "world.hpp"
+
+struct boids_world {
+    boids_world(const boids::SimulationParameters &params, uint32_t flags)
+    : world(params, (flags & BOIDS_WORLD_NAIVE) == 0),
+      execution((flags & BOIDS_WORLD_SEQUENTIAL) ? boids::Execution::Sequential : boids::Execution::Parallel) {}
+
+    boids::cpu::World world;
+    boids::Execution execution;
+};
+
+namespace {
+    boids_params to_c(const boids::SimulationParameters &params) {
+        boids_params result{};
+        result.struct_size = sizeof(boids_params);
+        result.boids_count = params.boids_count;
+        result.distance = params.distance;
+        result.separation = params.separation;
+        result.alignment = params.alignment;
+        result.cohesion = params.cohesion;
+        result.max_speed = params.max_speed;
+        result.min_speed = params.min_speed;
+        result.noise = params.noise;
+        result.max_neighbors = params.max_neighbors;
+        result.grid_subdivision = params.grid_subdivision;
+        result.use_cell_aggregates = params.use_cell_aggregates ? 1 : 0;
+        result.interaction_mode = int32_t(params.interaction_mode);
+        result.topological_neighbors = params.topological_neighbors;
+        result.view_angle = params.view_angle;
+        result.boundary_mode = int32_t(params.boundary_mode);
+        result.aquarium_size[0] = params.aquarium_size.x;
+        result.aquarium_size[1] = params.aquarium_size.y;
+        result.aquarium_size[2] = params.aquarium_size.z;
+        return result;
+    }
+
+    // Older hosts pass a shorter struct, the fields they do not know keep their defaults
+    bool from_c(const boids_params *c_params, boids::SimulationParameters &params) {
+        if (!c_params || c_params->struct_size < offsetof(boids_params, boids_count)) {
+            return false;
+        }
+        boids_params full = to_c(boids::SimulationParameters());
+        std::memcpy(&full, c_params, std::min<size_t>(c_params->struct_size, sizeof(boids_params)));
+
+        bool valid = full.boids_count >= 0 && size_t(full.boids_count) <= boids::SimulationParameters::MAX_BOID_COUNT &&
+                     full.distance >= boids::SimulationParameters::MIN_DISTANCE &&
+                     full.min_speed >= 0.f && full.max_speed >= full.min_speed &&
+                     full.interaction_mode >= 0 && full.interaction_mode <= 1 &&
+                     full.boundary_mode >= 0 && full.boundary_mode <= 2 &&
+                     full.aquarium_size[0] > 0.f && full.aquarium_size[1] > 0.f && full.aquarium_size[2] > 0.f;
+        if (!valid) {
+            return false;
+        }
+
+        params.boids_count = full.boids_count;
+        params.distance = full.distance;
+        params.separation = full.separation;
+        params.alignment = full.alignment;
+        params.cohesion = full.cohesion;
+        params.max_speed = full.max_speed;
+        params.min_speed = full.min_speed;
+        params.noise = full.noise;
+        params.max_neighbors = std::clamp(full.max_neighbors, 0, boids::SimulationParameters::MAX_CAPPED_NEIGHBORS);
+        params.grid_subdivision = std::max(full.grid_subdivision, 1);
+        params.use_cell_aggregates = full.use_cell_aggregates != 0;
+        params.interaction_mode = boids::InteractionMode(full.interaction_mode);
+        params.topological_neighbors = std::clamp(full.topological_neighbors, 1, boids::SimulationParameters::MAX_TOPOLOGICAL_NEIGHBORS);
+        params.view_angle = std::clamp(full.view_angle, 0.f, 360.f);
+        params.boundary_mode = boids::BoundaryMode(full.boundary_mode);
+        params.aquarium_size = glm::vec3(full.aquarium_size[0], full.aquarium_size[1], full.aquarium_size[2]);
+        return true;
+    }
+}
+
+uint32_t boids_api_version(void) {
+    return BOIDS_API_VERSION;
+}
+
+int32_t boids_max_boid_count(void) {
+    return int32_t(boids::SimulationParameters::MAX_BOID_COUNT);
+}
+
+int32_t boids_max_obstacle_count(void) {
+    return int32_t(boids::SimulationParameters::MAX_OBSTACLES_COUNT);
+}
+
+void boids_params_default(boids_params *params) {
+    if (params) {
+        *params = to_c(boids::SimulationParameters());
+    }
+}
+
+boids_world *boids_world_create(const boids_params *params, uint32_t seed, uint32_t flags) {
+    boids::SimulationParameters sim_params;
+    if (!from_c(params, sim_params)) {
+        return nullptr;
+    }
+
+    // Exceptions must not cross the C boundary
+    try {
+        boids::seed_thread_random(seed);
+        return new boids_world(sim_params, flags);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void boids_world_destroy(boids_world *world) {
+    delete world;
+}
+
+boids_status boids_world_set_params(boids_world *world, const boids_params *params) {
+    boids::SimulationParameters sim_params;
+    if (!world || !from_c(params, sim_params)) {
+        return BOIDS_ERROR_INVALID_ARGUMENT;
+    }
+
+    try {
+        world->world.set_params(sim_params);
+    } catch (const std::bad_alloc &) {
+        return BOIDS_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return BOIDS_ERROR_INTERNAL;
+    }
+    return BOIDS_OK;
+}
+
+boids_status boids_world_get_params(const boids_world *world, boids_params *params) {
+    if (!world || !params) {
+        return BOIDS_ERROR_INVALID_ARGUMENT;
+    }
+    *params = to_c(world->world.params());
+    return BOIDS_OK;
+}
+
+boids_status boids_world_reset(boids_world *world, uint32_t seed) {
+    if (!world) {
+        return BOIDS_ERROR_INVALID_ARGUMENT;
+    }
+
+    try {
+        boids::seed_thread_random(seed);
+        world->world.reset();
+    } catch (const std::bad_alloc &) {
+        return BOIDS_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return BOIDS_ERROR_INTERNAL;
+    }
+    return BOIDS_OK;
+}
+
+boids_status boids_world_step(boids_world *world, float dt, int32_t steps) {
+    if (!world || !(dt >= 0.f) || steps < 0) {
+        return BOIDS_ERROR_INVALID_ARGUMENT;
+    }
+
+    try {
+        world->world.step(dt, steps, world->execution);
+    } catch (const std::bad_alloc &) {
+        return BOIDS_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return BOIDS_ERROR_INTERNAL;
+    }
+    return BOIDS_OK;
+}
+
+uint64_t boids_world_step_count(const boids_world *world) {
+    return world ? world->world.step_count() : 0;
+}
+
+const float *boids_world_get_positions(const boids_world *world, size_t *stride, size_t *count) {
+    if (!world) {
+        return nullptr;
+    }
+    if (stride) {
+        *stride = sizeof(glm::vec4);
+    }
+    if (count) {
+        *count = size_t(world->world.params().boids_count);
+    }
+    return &world->world.boids().position[0].x;
+}
+
+const float *boids_world_get_velocities(const boids_world *world, size_t *stride, size_t *count) {
+    if (!world) {
+        return nullptr;
+    }
+    if (stride) {
+        *stride = sizeof(glm::vec3);
+    }
+    if (count) {
+        *count = size_t(world->world.params().boids_count);
+    }
+    return &world->world.boids().velocity[0].x;
+}
+
+boids_status boids_world_add_obstacle(boids_world *world, const float position[3], float radius, uint32_t *index) {
+    if (!world || !position || !(radius > 0.f)) {
+        return BOIDS_ERROR_INVALID_ARGUMENT;
+    }
+
+    boids::Obstacles &obstacles = world->world.obstacles();
+    if (obstacles.count() >= boids::SimulationParameters::MAX_OBSTACLES_COUNT) {
+        return BOIDS_ERROR_CAPACITY;
+    }
+    try {
+        obstacles.push(glm::vec3(position[0], position[1], position[2]), radius);
+    } catch (const std::bad_alloc &) {
+        return BOIDS_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return BOIDS_ERROR_INTERNAL;
+    }
+    if (index) {
+        *index = uint32_t(obstacles.count() - 1);
+    }
+    return BOIDS_OK;
+}
+
+boids_status boids_world_remove_obstacle(boids_world *world, uint32_t index) {
+    if (!world || index >= world->world.obstacles().count()) {
+        return BOIDS_ERROR_INVALID_ARGUMENT;
+    }
+    world->world.obstacles().remove(index);
+    return BOIDS_OK;
+}
+
+uint32_t boids_world_obstacle_count(const boids_world *world) {
+    return world ? uint32_t(world->world.obstacles().count()) : 0;
+}
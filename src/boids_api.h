@@ -0,0 +1,117 @@
+#ifndef BOIDS_SIMULATION_BOIDS_API_H
+#define BOIDS_SIMULATION_BOIDS_API_H
+
+/*
+ * C interface of the headless CPU simulation (libboids), for hosts embedding it without GL.
+ * Functions of one world must not be called concurrently, different worlds are independent.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(BOIDS_API_EXPORTS)
+#define BOIDS_API __declspec(dllexport)
+#else
+#define BOIDS_API __declspec(dllimport)
+#endif
+#else
+#define BOIDS_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOIDS_API_VERSION 1
+
+typedef struct boids_world boids_world;
+
+typedef enum boids_status {
+    BOIDS_OK = 0,
+    BOIDS_ERROR_INVALID_ARGUMENT = -1,
+    BOIDS_ERROR_CAPACITY = -2,
+    BOIDS_ERROR_OUT_OF_MEMORY = -3,
+    /* Any other failure inside the simulation, the world is left in a valid but unspecified state */
+    BOIDS_ERROR_INTERNAL = -4
+} boids_status;
+
+typedef enum boids_interaction_mode {
+    BOIDS_INTERACTION_METRIC = 0,
+    BOIDS_INTERACTION_TOPOLOGICAL = 1
+} boids_interaction_mode;
+
+typedef enum boids_boundary_mode {
+    BOIDS_BOUNDARY_WALLS = 0,
+    BOIDS_BOUNDARY_PERIODIC = 1,
+    BOIDS_BOUNDARY_OPEN = 2
+} boids_boundary_mode;
+
+/* World creation flags */
+enum {
+    /* Steps run entirely on the calling thread, for hosts spreading worlds over their own workers */
+    BOIDS_WORLD_SEQUENTIAL = 1u << 0,
+    /* Every boid checks every other one instead of using the spatial grid */
+    BOIDS_WORLD_NAIVE = 1u << 1
+};
+
+/*
+ * Fields are only ever appended. Hosts set struct_size to sizeof(boids_params) as they compiled it,
+ * fields a host does not know about keep their defaults.
+ */
+typedef struct boids_params {
+    uint32_t struct_size;
+    int32_t boids_count;
+    float distance;
+    float separation;
+    float alignment;
+    float cohesion;
+    float max_speed;
+    float min_speed;
+    float noise;
+    int32_t max_neighbors;
+    int32_t grid_subdivision;
+    int32_t use_cell_aggregates;
+    int32_t interaction_mode;      /* boids_interaction_mode */
+    int32_t topological_neighbors;
+    float view_angle;              /* degrees */
+    int32_t boundary_mode;         /* boids_boundary_mode */
+    float aquarium_size[3];
+} boids_params;
+
+BOIDS_API uint32_t boids_api_version(void);
+BOIDS_API int32_t boids_max_boid_count(void);
+BOIDS_API int32_t boids_max_obstacle_count(void);
+
+/* Fills the parameters of the interactive application, including struct_size */
+BOIDS_API void boids_params_default(boids_params *params);
+
+/* Random initial state drawn from `seed`, returns NULL on invalid parameters or any failure */
+BOIDS_API boids_world *boids_world_create(const boids_params *params, uint32_t seed, uint32_t flags);
+BOIDS_API void boids_world_destroy(boids_world *world);
+
+/* Takes effect from the next step, boids keep their state */
+BOIDS_API boids_status boids_world_set_params(boids_world *world, const boids_params *params);
+BOIDS_API boids_status boids_world_get_params(const boids_world *world, boids_params *params);
+
+BOIDS_API boids_status boids_world_reset(boids_world *world, uint32_t seed);
+BOIDS_API boids_status boids_world_step(boids_world *world, float dt, int32_t steps);
+BOIDS_API uint64_t boids_world_step_count(const boids_world *world);
+
+/*
+ * xyz of boid i is at (const char *)result + i * stride, for i < count. The memory belongs to the world
+ * and stays valid until the next step, reset or set_params of the world.
+ */
+BOIDS_API const float *boids_world_get_positions(const boids_world *world, size_t *stride, size_t *count);
+BOIDS_API const float *boids_world_get_velocities(const boids_world *world, size_t *stride, size_t *count);
+
+BOIDS_API boids_status boids_world_add_obstacle(boids_world *world, const float position[3], float radius, uint32_t *index);
+/* Later obstacles move down by one index */
+BOIDS_API boids_status boids_world_remove_obstacle(boids_world *world, uint32_t index);
+BOIDS_API uint32_t boids_world_obstacle_count(const boids_world *world);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOIDS_SIMULATION_BOIDS_API_H */
@@ -1,113 +1,451 @@
 #include "boids_cpu.hpp"
+#include "neighbor_heap.hpp"
+#include "view_cone.hpp"
 #include <vector>
-#include <execution>
+#include <algorithm>
+#include <cmath>
 #include <glm/glm.hpp>
 
-void boids::cpu::update_simulation_naive(
-            const SimulationParameters &sim_params,
-            const Obstacles& obstacles,
-            std::vector<glm::vec4> &position,
-            std::vector<glm::vec3> &velocity,
-            std::vector<glm::vec3> &acceleration,
-            BoidsOrientation &orientation,
-            float dt
-) {
-    for (BoidId b_id = 0; b_id < sim_params.boids_count; ++b_id) {
+namespace {
+    // Topological mode: separation, alignment and cohesion with the k nearest boids
+    glm::vec3 topological_flocking_acceleration(
+            const boids::SimulationParameters &sim_params,
+            const boids::cpu::SpatialGrid &grid,
+            const std::vector<glm::vec4> &position,
+            const std::vector<glm::vec3> &velocity,
+            boids::BoidId b_id
+    ) {
+        boids::BoidNeighbor neighbors[boids::SimulationParameters::MAX_TOPOLOGICAL_NEIGHBORS];
+        int k = std::clamp(sim_params.topological_neighbors, 1, boids::SimulationParameters::MAX_TOPOLOGICAL_NEIGHBORS);
+        int neighbors_count = grid.find_k_nearest(position, b_id, k, neighbors);
+        if (neighbors_count == 0) {
+            return glm::vec3(0.f);
+        }
+
         glm::vec3 separation(0.);
         glm::vec3 avg_vel(0.);
         glm::vec3 avg_pos(0.);
-        uint32_t neighbors_count = 0;
+        glm::vec3 pos = glm::vec3(position[b_id]);
 
-        for (BoidId other_id = 0; other_id < sim_params.boids_count; ++other_id) {
-            if (other_id == b_id) {
-                continue;
-            }
-
-            auto distance2 = glm::dot(position[b_id] - position[other_id], position[b_id] - position[other_id]);
-            if (distance2 > sim_params.distance * sim_params.distance) {
-                continue;
-            }
+        for (int i = 0; i < neighbors_count; ++i) {
+            boids::BoidId other_id = neighbors[i].id;
+            glm::vec3 diff = -grid.offset(pos, glm::vec3(position[other_id]));
 
-            separation += glm::vec3(glm::normalize(position[b_id] - position[other_id]) / distance2);
+            separation += glm::normalize(diff) / neighbors[i].distance2;
             avg_vel += velocity[other_id];
-            avg_pos += glm::vec3(position[other_id]);
-
-            ++neighbors_count;
+            avg_pos += pos - diff;
         }
 
-        if (neighbors_count > 0) {
-            avg_vel /= float(neighbors_count);
+        avg_vel /= float(neighbors_count);
+        avg_pos /= float(neighbors_count);
 
-            avg_pos /= float(neighbors_count);
+        return sim_params.separation * separation +
+               sim_params.alignment * (avg_vel - velocity[b_id]) +
+               sim_params.cohesion * (avg_pos - pos);
+    }
+
+    // Approximate metric mode: the max_neighbors nearest boids in view. Shells of cells are visited nearest first
+    // and the search stops once a whole shell lies beyond the farthest kept candidate, so with cells sized for
+    // about max_neighbors boids (see SpatialGrid::build) the cost per boid follows the cap, not the view radius.
+    glm::vec3 capped_flocking_acceleration(
+            const boids::SimulationParameters &sim_params,
+            const boids::cpu::SpatialGrid &grid,
+            const std::vector<glm::vec4> &position,
+            const std::vector<glm::vec3> &velocity,
+            boids::BoidId b_id
+    ) {
+        boids::BoidNeighbor nearest[boids::SimulationParameters::MAX_CAPPED_NEIGHBORS];
+        boids::NeighborHeap capped(nearest, sim_params.neighbor_cap());
+
+        glm::vec3 pos = glm::vec3(position[b_id]);
+        float distance2_max = sim_params.distance * sim_params.distance;
+        bool limited_view = sim_params.limited_view();
+        float cos_half_view_angle = sim_params.cos_half_view_angle();
+        glm::vec3 forward = glm::normalize(velocity[b_id]);
+
+        glm::vec3 cell_size = grid.cell_size();
+        float min_cell_size = std::min(cell_size.x, std::min(cell_size.y, cell_size.z));
+        glm::ivec3 center = grid.get_cell_coords(pos);
+        glm::ivec3 start, end;
+        grid.search_window(center, grid.search_range(), start, end);
 
-            // Final acceleration of the current boid
-            acceleration[b_id] =
-                    sim_params.separation * separation +
-                    sim_params.alignment * (avg_vel - velocity[b_id]) +
-                    sim_params.cohesion * (avg_pos - glm::vec3(position[b_id]));
+        int last_shell = boids::max_shell(center, start, end);
+        for (int shell = 0; shell <= last_shell && !boids::shell_beyond(shell, min_cell_size, distance2_max, capped); ++shell) {
+            boids::for_each_shell_cell(center, shell, start, end, [&](glm::ivec3 coords) {
+                float cell_distance2 = grid.cell_distance2(pos, coords);
+                if (cell_distance2 > distance2_max || cell_distance2 >= capped.bound()) {
+                    return;
+                }
+
+                boids::cpu::CellId cell = grid.flatten_coords(grid.wrap_coords(coords));
+                for (uint32_t k = grid.cell_start(cell); k < grid.cell_end(cell); ++k) {
+                    boids::BoidId other_id = grid.sorted_ids()[k];
+                    if (other_id == b_id) {
+                        continue;
+                    }
+
+                    glm::vec3 diff = -grid.offset(pos, glm::vec3(position[other_id]));
+                    float distance2 = glm::dot(diff, diff);
+                    if (distance2 > distance2_max) {
+                        continue;
+                    }
+                    if (limited_view && !boids::in_view_cone(forward, -diff, distance2, cos_half_view_angle)) {
+                        continue;
+                    }
+                    capped.offer(distance2, other_id);
+                }
+            });
         }
-        acceleration[b_id] += sim_params.noise * rand_unit_vec();
-    }
 
-    float wall = 4.f;
-    float wall_acc = 15.f;
-    for (BoidId i = 0; i < sim_params.boids_count; ++i) {
-        if (position[i].x > sim_params.aquarium_size.x / 2.f - wall) {
-            auto intensity = std::abs((sim_params.aquarium_size.x / 2.f - wall - position[i].x) / wall);
-            acceleration[i] += intensity * glm::vec3(-wall_acc, 0.f, 0.f);
-        } else if (position[i].x < -sim_params.aquarium_size.x / 2.f + wall) {
-            auto intensity = std::abs((-sim_params.aquarium_size.x / 2.f + wall - position[i].x) / wall);
-            acceleration[i] += intensity * glm::vec3(wall_acc, 0.f, 0.f);
+        if (capped.count() == 0) {
+            return glm::vec3(0.f);
         }
 
-        if (position[i].y > sim_params.aquarium_size.y / 2.f - wall) {
-            auto intensity = std::abs((sim_params.aquarium_size.y / 2.f - wall - position[i].y) / wall);
-            acceleration[i] += intensity * glm::vec3(0.f, -wall_acc, 0.f);
-        } else if (position[i].y < -sim_params.aquarium_size.y / 2.f + wall) {
-            auto intensity = std::abs((-sim_params.aquarium_size.y / 2.f + wall - position[i].y) / wall);
-            acceleration[i] += intensity * glm::vec3(0.f, wall_acc, 0.f);
+        glm::vec3 separation(0.);
+        glm::vec3 avg_vel(0.);
+        glm::vec3 avg_pos(0.);
+        for (int i = 0; i < capped.count(); ++i) {
+            boids::BoidId other_id = capped[i].id;
+            glm::vec3 diff = -grid.offset(pos, glm::vec3(position[other_id]));
+
+            separation += glm::normalize(diff) / capped[i].distance2;
+            avg_vel += velocity[other_id];
+            avg_pos += pos - diff;
         }
 
-        if (position[i].z > sim_params.aquarium_size.z / 2.f - wall) {
-            auto intensity = std::abs((sim_params.aquarium_size.z / 2.f - wall - position[i].z) / wall);
-            acceleration[i] += intensity * glm::vec3(0.f, 0.f, -wall_acc);
-        } else if (position[i].z < -sim_params.aquarium_size.z / 2.f + wall) {
-            auto intensity = std::abs((-sim_params.aquarium_size.z / 2.f + wall - position[i].z) / wall);
-            acceleration[i] += intensity * glm::vec3(0.f, 0.f, wall_acc);
+        avg_vel /= float(capped.count());
+        avg_pos /= float(capped.count());
+
+        return sim_params.separation * separation +
+               sim_params.alignment * (avg_vel - velocity[b_id]) +
+               sim_params.cohesion * (avg_pos - pos);
+    }
+
+    // Applies walls and obstacles to the flocking acceleration in `next.acceleration`, then moves
+    // the boid and updates its orientation unless boids.vert derives it. Reads only `prev`, so boids can be processed in any order.
+    void integrate_boid(
+            const boids::SimulationParameters &sim_params,
+            const boids::Obstacles& obstacles,
+            const boids::SdfView& environment,
+            const boids::Boids &prev,
+            boids::Boids &next,
+            boids::BoidId i,
+            float dt
+    ) {
+        glm::vec3 position = glm::vec3(prev.position[i]);
+        glm::vec3 acceleration = next.acceleration[i];
+
+        if (sim_params.walls()) {
+            acceleration += environment.avoidance(position);
         }
 
-        for (int j = 0; j < obstacles.count(); ++j) {
-            float dist = glm::distance(obstacles.pos(j), glm::vec3(position[i]));
+        for (size_t j = 0; j < obstacles.count(); ++j) {
+            float dist = glm::distance(obstacles.pos(j), position);
 
             if (dist > 1.4f * obstacles.radius(j)) {
                 continue;
             }
 
-            glm::vec3 e = obstacles.pos(j) - glm::vec3(position[i]);
-            glm::vec3 d = glm::normalize(velocity[i]);
+            glm::vec3 e = obstacles.pos(j) - position;
+            glm::vec3 d = glm::normalize(prev.velocity[i]);
             float de_dot = glm::dot(d, e);
             if (de_dot < 0.f) {
                 continue;
             }
-            glm::vec3 p = glm::vec3(position[i]) + d * de_dot;
-            acceleration[i] += glm::normalize(p - obstacles.pos(j)) * 12.f;
+            glm::vec3 p = position + d * de_dot;
+            acceleration += glm::normalize(p - obstacles.pos(j)) * 12.f;
+        }
+
+        glm::vec3 velocity = prev.velocity[i] + acceleration * dt;
+
+        if (glm::length(velocity) > sim_params.max_speed) {
+            velocity = glm::normalize(velocity) * sim_params.max_speed;
+        } else if (glm::length(velocity) < sim_params.min_speed){
+            velocity = glm::normalize(velocity) * sim_params.min_speed;
+        }
+
+        next.acceleration[i] = acceleration;
+        next.velocity[i] = velocity;
+        next.position[i] = glm::vec4(sim_params.wrap_position(position + velocity * dt), prev.position[i].w);
+
+        if (sim_params.shader_orientation) {
+            return;
+        }
+
+        // Update basis vectors (orientation)
+        next.orientation.forward[i] = glm::vec4(glm::normalize(velocity), 0.f);
+        next.orientation.right[i] = glm::vec4(glm::normalize(glm::cross(glm::vec3(prev.orientation.up[i]), glm::vec3(next.orientation.forward[i]))), 0.f);
+        next.orientation.up[i] = glm::vec4(glm::normalize(glm::cross(glm::vec3(next.orientation.forward[i]) , glm::vec3(next.orientation.right[i]))), 0.f);
+    }
+}
+
+glm::vec3 boids::cpu::flocking_acceleration(
+            const SimulationParameters &sim_params,
+            const std::vector<glm::vec4> &position,
+            const std::vector<glm::vec3> &velocity,
+            BoidId b_id
+) {
+    glm::vec3 separation(0.);
+    glm::vec3 avg_vel(0.);
+    glm::vec3 avg_pos(0.);
+    uint32_t neighbors_count = 0;
+
+    // Velocity points the same way as orientation.forward of the previous step
+    bool limited_view = sim_params.limited_view();
+    float cos_half_view_angle = sim_params.cos_half_view_angle();
+    glm::vec3 forward = glm::normalize(velocity[b_id]);
+
+    // Approximate mode gathers the nearest candidates first and sums them once the scan is done
+    int neighbor_cap = sim_params.neighbor_cap();
+    BoidNeighbor nearest[SimulationParameters::MAX_CAPPED_NEIGHBORS];
+    NeighborHeap capped(nearest, neighbor_cap);
+
+    uint32_t boids_count = uint32_t(sim_params.boids_count);
+    for (BoidId other_id = 0; other_id < boids_count; ++other_id) {
+        if (other_id == b_id) {
+            continue;
         }
 
-        velocity[i] += acceleration[i] * dt;
+        glm::vec3 diff = sim_params.minimum_image(glm::vec3(position[b_id] - position[other_id]));
+        auto distance2 = glm::dot(diff, diff);
+        if (distance2 > sim_params.distance * sim_params.distance) {
+            continue;
+        }
+
+        if (limited_view && !in_view_cone(forward, -diff, distance2, cos_half_view_angle)) {
+            continue;
+        }
+
+        if (neighbor_cap > 0) {
+            capped.offer(distance2, other_id);
+            continue;
+        }
+
+        separation += glm::normalize(diff) / distance2;
+        avg_vel += velocity[other_id];
+        avg_pos += glm::vec3(position[b_id]) - diff;
+        ++neighbors_count;
+    }
+
+    for (int i = 0; i < capped.count(); ++i) {
+        BoidId other_id = capped[i].id;
+        glm::vec3 diff = sim_params.minimum_image(glm::vec3(position[b_id] - position[other_id]));
+
+        separation += glm::normalize(diff) / capped[i].distance2;
+        avg_vel += velocity[other_id];
+        avg_pos += glm::vec3(position[b_id]) - diff;
+        ++neighbors_count;
+    }
+
+    if (neighbors_count == 0) {
+        return glm::vec3(0.f);
+    }
+
+    avg_vel /= float(neighbors_count);
+    avg_pos /= float(neighbors_count);
+
+    return sim_params.separation * separation +
+           sim_params.alignment * (avg_vel - velocity[b_id]) +
+           sim_params.cohesion * (avg_pos - glm::vec3(position[b_id]));
+}
+
+glm::vec3 boids::cpu::flocking_acceleration(
+            const SimulationParameters &sim_params,
+            const SpatialGrid &grid,
+            const std::vector<glm::vec4> &position,
+            const std::vector<glm::vec3> &velocity,
+            BoidId b_id
+) {
+    if (sim_params.interaction_mode == InteractionMode::Topological) {
+        return topological_flocking_acceleration(sim_params, grid, position, velocity, b_id);
+    }
+    if (sim_params.neighbor_cap() > 0) {
+        return capped_flocking_acceleration(sim_params, grid, position, velocity, b_id);
+    }
+
+    glm::vec3 separation(0.);
+    glm::vec3 avg_vel(0.);
+    glm::vec3 avg_pos(0.);
+    uint32_t neighbors_count = 0;
+
+    glm::vec3 pos = glm::vec3(position[b_id]);
+    float distance2_max = sim_params.distance * sim_params.distance;
+
+    bool limited_view = sim_params.limited_view();
+    float cos_half_view_angle = sim_params.cos_half_view_angle();
+    glm::vec3 forward = glm::normalize(velocity[b_id]);
+    float cell_radius = 0.5f * glm::length(grid.cell_size());
+
+    glm::ivec3 cell_coords = grid.get_cell_coords(pos);
+    glm::ivec3 start, end;
+    grid.search_window(cell_coords, grid.search_range(), start, end);
+
+    // Periodic grid too small for the view radius: a cell may hold boids of several of its images,
+    // so the nearest image is taken per boid and the per cell shortcuts are disabled
+    bool per_boid_images = grid.window_wraps(grid.search_range());
+
+    for (int z = start.z; z <= end.z; ++z) {
+        for (int y = start.y; y <= end.y; ++y) {
+            for (int x = start.x; x <= end.x; ++x) {
+                // Coordinates outside the grid address a periodic image of a cell, its boids are shifted accordingly
+                glm::ivec3 curr_cell_coords(x, y, z);
+                glm::vec3 image_offset = grid.image_offset(curr_cell_coords);
+                glm::vec3 cell_min = grid.cell_min(curr_cell_coords);
+                glm::vec3 cell_max = cell_min + grid.cell_size();
+
+                // Skip cells that do not touch the view sphere
+                if (grid.cell_distance2(pos, curr_cell_coords) > distance2_max) {
+                    continue;
+                }
+
+                // Prune cells lying entirely in the blind angle before scanning them
+                ConeOverlap cone_overlap = ConeOverlap::Inside;
+                if (limited_view && per_boid_images) {
+                    cone_overlap = ConeOverlap::Partial;
+                } else if (limited_view) {
+                    glm::vec3 to_center = cell_min + 0.5f * grid.cell_size() - pos;
+                    cone_overlap = sphere_in_view_cone(forward, to_center, cell_radius, cos_half_view_angle);
+                    if (cone_overlap == ConeOverlap::Outside) {
+                        continue;
+                    }
+                }
+
+                CellId curr_flat_id = grid.flatten_coords(grid.wrap_coords(curr_cell_coords));
+
+                // Cells lying fully inside the view sphere (and cone) contribute through their sums only
+                glm::vec3 farthest = glm::max(glm::abs(cell_min - pos), glm::abs(cell_max - pos));
+                if (sim_params.use_cell_aggregates && !per_boid_images && cone_overlap == ConeOverlap::Inside && curr_cell_coords != cell_coords && glm::dot(farthest, farthest) <= distance2_max) {
+                    const CellAggregate &aggregate = grid.aggregate(curr_flat_id);
+                    if (aggregate.count == 0) {
+                        continue;
+                    }
+
+                    glm::vec3 image_position_sum = aggregate.position_sum + float(aggregate.count) * image_offset;
+                    glm::vec3 diff = pos - image_position_sum / float(aggregate.count);
+                    float distance2 = glm::dot(diff, diff);
+                    if (distance2 > 0.f) {
+                        separation += float(aggregate.count) * glm::normalize(diff) / distance2;
+                    }
+                    avg_vel += aggregate.velocity_sum;
+                    avg_pos += image_position_sum;
+                    neighbors_count += aggregate.count;
+                    continue;
+                }
+
+                for (uint32_t k = grid.cell_start(curr_flat_id); k < grid.cell_end(curr_flat_id); ++k) {
+                    BoidId other_id = grid.sorted_ids()[k];
+                    if (other_id == b_id) {
+                        continue;
+                    }
+
+                    glm::vec3 diff = per_boid_images
+                            ? -grid.offset(pos, glm::vec3(position[other_id]))
+                            : pos - (glm::vec3(position[other_id]) + image_offset);
+                    float distance2 = glm::dot(diff, diff);
+                    if (distance2 > distance2_max) {
+                        continue;
+                    }
+
+                    if (cone_overlap == ConeOverlap::Partial && !in_view_cone(forward, -diff, distance2, cos_half_view_angle)) {
+                        continue;
+                    }
 
-        if (glm::length(velocity[i]) > sim_params.max_speed) {
-            velocity[i] = glm::normalize(velocity[i]) * sim_params.max_speed;
-        } else if (glm::length(velocity[i]) < sim_params.min_speed){
-            velocity[i] = glm::normalize(velocity[i]) * sim_params.min_speed;
+                    separation += glm::normalize(diff) / distance2;
+                    avg_vel += velocity[other_id];
+                    avg_pos += pos - diff;
+
+                    ++neighbors_count;
+                }
+            }
         }
+    }
 
-        position[i] += glm::vec4(velocity[i] * dt, 0.f);
+    if (neighbors_count == 0) {
+        return glm::vec3(0.f);
     }
 
-    // Update basis vectors (orientation)
-    for (BoidId i = 0; i < sim_params.boids_count; ++i) {
-        orientation.forward[i] = glm::vec4(glm::normalize(velocity[i]), 0.f);
-        orientation.right[i] = glm::vec4(glm::normalize(glm::cross(glm::vec3(orientation.up[i]), glm::vec3(orientation.forward[i]))), 0.f);
-        orientation.up[i] = glm::vec4(glm::normalize(glm::cross(glm::vec3(orientation.forward[i]) , glm::vec3(orientation.right[i]))), 0.f);
+    avg_vel /= float(neighbors_count);
+    avg_pos /= float(neighbors_count);
+
+    return sim_params.separation * separation +
+           sim_params.alignment * (avg_vel - velocity[b_id]) +
+           sim_params.cohesion * (avg_pos - pos);
+}
+
+boids::cpu::ApproximationError boids::cpu::measure_approximation_error(
+            const SimulationParameters &sim_params,
+            const std::vector<glm::vec4> &position,
+            const std::vector<glm::vec3> &velocity,
+            const SpatialGrid *grid,
+            int samples
+) {
+    ApproximationError error { 0.f, 0.f, 0 };
+    if (sim_params.boids_count == 0 || samples <= 0) {
+        return error;
     }
-}
\ No newline at end of file
+
+    SimulationParameters exact_params = sim_params;
+    exact_params.max_neighbors = 0;
+
+    uint32_t boids_count = uint32_t(sim_params.boids_count);
+    uint32_t stride = std::max(boids_count / uint32_t(samples), 1u);
+    for (BoidId b_id = 0; b_id < boids_count; b_id += stride) {
+        glm::vec3 exact = flocking_acceleration(exact_params, position, velocity, b_id);
+        glm::vec3 approx = grid
+                ? flocking_acceleration(sim_params, *grid, position, velocity, b_id)
+                : flocking_acceleration(sim_params, position, velocity, b_id);
+
+        float relative = glm::length(approx - exact) / std::max(glm::length(exact), 1e-6f);
+        error.mean_relative += relative;
+        error.max_relative = std::max(error.max_relative, relative);
+        ++error.samples;
+    }
+    error.mean_relative /= float(error.samples);
+
+    return error;
+}
+
+void boids::cpu::update_simulation_naive(
+            const SimulationParameters &sim_params,
+            const Obstacles& obstacles,
+            const SdfView& environment,
+            SimulationState &state,
+            float dt,
+            Execution execution
+) {
+    const Boids &prev = state.front();
+    Boids &next = state.back();
+
+    IndexRange<BoidId> ids = indices(BoidId(sim_params.boids_count));
+    boids::for_each(execution, ids.begin(), ids.end(), [&](BoidId b_id) {
+        next.acceleration[b_id] = flocking_acceleration(sim_params, prev.position, prev.velocity, b_id);
+        next.acceleration[b_id] += sim_params.noise * rand_unit_vec();
+        integrate_boid(sim_params, obstacles, environment, prev, next, b_id, dt);
+    });
+
+    state.swap();
+}
+
+void boids::cpu::update_simulation_with_grid(
+            const SimulationParameters &sim_params,
+            const Obstacles& obstacles,
+            const SdfView& environment,
+            SpatialGrid &grid,
+            SimulationState &state,
+            float dt,
+            Execution execution
+) {
+    const Boids &prev = state.front();
+    Boids &next = state.back();
+
+    grid.build(sim_params, prev.position, prev.velocity);
+
+    IndexRange<BoidId> ids = indices(BoidId(sim_params.boids_count));
+    boids::for_each(execution, ids.begin(), ids.end(), [&](BoidId b_id) {
+        next.acceleration[b_id] = flocking_acceleration(sim_params, grid, prev.position, prev.velocity, b_id);
+        next.acceleration[b_id] += sim_params.noise * rand_unit_vec();
+        integrate_boid(sim_params, obstacles, environment, prev, next, b_id, dt);
+    });
+
+    state.swap();
+}
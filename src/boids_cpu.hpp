@@ -1,16 +1,63 @@
 #ifndef BOIDS_SIMULATION_BOIDS_CPU_HPP
 #define BOIDS_SIMULATION_BOIDS_CPU_HPP
 #include "boids.hpp"
+#include "execution.hpp"
+#include "sdf.hpp"
+#include "simulation_state.hpp"
+#include "spatial_grid.hpp"
 
 namespace boids::cpu {
+    struct ApproximationError {
+        float mean_relative;
+        float max_relative;
+        int samples;
+    };
+
+    // Separation, alignment and cohesion of a single boid, honours sim_params.max_neighbors
+    glm::vec3 flocking_acceleration(
+            const SimulationParameters &sim_params,
+            const std::vector<glm::vec4> &position,
+            const std::vector<glm::vec3> &velocity,
+            BoidId b_id
+    );
+
+    // Same as above, but visits only the cells around the boid and uses cell aggregates when enabled
+    glm::vec3 flocking_acceleration(
+            const SimulationParameters &sim_params,
+            const SpatialGrid &grid,
+            const std::vector<glm::vec4> &position,
+            const std::vector<glm::vec3> &velocity,
+            BoidId b_id
+    );
+
+    // Compares the approximate neighbour search (capped, or the grid one if `grid` is given)
+    // against the exact one on a sample of boids
+    ApproximationError measure_approximation_error(
+            const SimulationParameters &sim_params,
+            const std::vector<glm::vec4> &position,
+            const std::vector<glm::vec3> &velocity,
+            const SpatialGrid *grid,
+            int samples
+    );
+
+    // Both steps read the front buffer of `state`, write the back buffer (in parallel by default) and swap them
     void update_simulation_naive(
             const SimulationParameters &sim_params,
             const Obstacles& obstacles,
-            std::vector<glm::vec4> &position,
-            std::vector<glm::vec3> &velocity,
-            std::vector<glm::vec3> &acceleration,
-            BoidsOrientation &orientation,
-            float dt
+            const SdfView& environment,
+            SimulationState &state,
+            float dt,
+            Execution execution = Execution::Parallel
+    );
+
+    void update_simulation_with_grid(
+            const SimulationParameters &sim_params,
+            const Obstacles& obstacles,
+            const SdfView& environment,
+            SpatialGrid &grid,
+            SimulationState &state,
+            float dt,
+            Execution execution = Execution::Parallel
     );
 }
 
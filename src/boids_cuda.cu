@@ -1,8 +1,11 @@
 #include "boids_cuda.hpp"
+#include "neighbor_heap.hpp"
+#include "view_cone.hpp"
 #include "cuda_runtime.h"
 
 #include <thrust/sort.h>
 #include <thrust/execution_policy.h>
+#include <cstring>
 #include <iostream>
 #include <curand_kernel.h>
 #include <cuda_gl_interop.h>
@@ -28,10 +31,18 @@ __device__ CellId flatten_coords(const SimulationParameters *sim_params, CellCoo
 }
 
 __device__ CellCoords get_cell_cords(const SimulationParameters *sim_params, const glm::vec4& position) {
+    // Boids pushed outside the aquarium are kept in the border cells, so their cell ids stay inside cell_start
+    glm::vec3 grid_size = glm::ceil(sim_params->aquarium_size / sim_params->distance);
+    glm::vec3 coords = glm::clamp(
+            glm::floor((glm::vec3(position) + sim_params->aquarium_size / 2.f) / sim_params->distance),
+            glm::vec3(0.f),
+            grid_size - 1.f
+    );
+
     return CellCoords {
-            static_cast<CellCoord>((position.x + sim_params->aquarium_size.x / 2.f) / sim_params->distance),
-            static_cast<CellCoord>((position.y + sim_params->aquarium_size.y / 2.f) / sim_params->distance),
-            static_cast<CellCoord>((position.z + sim_params->aquarium_size.z / 2.f) / sim_params->distance)
+            static_cast<CellCoord>(coords.x),
+            static_cast<CellCoord>(coords.y),
+            static_cast<CellCoord>(coords.z)
     };
 }
 
@@ -45,13 +56,101 @@ __device__ CellId get_flat_cell_id(
     );
 }
 
+// Approximate mode: sums the nearest candidates kept during the scan
+__device__ void add_capped_neighbors(
+        const NeighborHeap &capped,
+        const glm::vec4 &self_position,
+        const glm::vec4 *position_old,
+        const glm::vec3 *velocity_old,
+        glm::vec3 &separation,
+        glm::vec3 &avg_vel,
+        glm::vec3 &avg_pos,
+        uint32_t &neighbors_count
+) {
+    for (int i = 0; i < capped.count(); ++i) {
+        BoidId other_id = capped[i].id;
+        separation += glm::vec3(glm::normalize(self_position - position_old[other_id]) / capped[i].distance2);
+        avg_vel += velocity_old[other_id];
+        avg_pos += glm::vec3(position_old[other_id]);
+        ++neighbors_count;
+    }
+}
+
+// Lower bound of the squared distance from `position` to any boid of the cell. Border cells also hold the boids
+// pushed outside the aquarium, so they extend to infinity on their outer side.
+__device__ float cell_distance2(const SimulationParameters *params, glm::ivec3 grid_size, glm::vec3 position, glm::ivec3 coords) {
+    glm::vec3 cell_min = glm::vec3(coords) * params->distance - params->aquarium_size / 2.f;
+    glm::vec3 below = glm::max(cell_min - position, glm::vec3(0.f));
+    glm::vec3 above = glm::max(position - (cell_min + params->distance), glm::vec3(0.f));
+    glm::vec3 outside = glm::mix(below, glm::vec3(0.f), glm::equal(coords, glm::ivec3(0))) +
+                        glm::mix(above, glm::vec3(0.f), glm::equal(coords, grid_size - 1));
+    return glm::dot(outside, outside);
+}
+
+// Approximate mode: offers the boids in view to `capped`, the own cell first, then the neighbouring cells that
+// can still hold a nearer candidate. Cells span the view radius, so the shell around the own cell covers it.
+__device__ void gather_capped_neighbors(
+        const SimulationParameters *params,
+        const BoidId *boid_id,
+        const int *cell_start,
+        const int *cell_end,
+        const glm::vec4 *position_old,
+        BoidId b_id,
+        glm::vec4 self_position,
+        glm::vec3 forward,
+        NeighborHeap &capped
+) {
+    bool limited_view = params->limited_view();
+    float cos_half_view_angle = params->cos_half_view_angle();
+    float distance2_max = params->distance * params->distance;
+
+    CellCoords cell_coords = get_cell_cords(params, self_position);
+    glm::ivec3 center(cell_coords.x, cell_coords.y, cell_coords.z);
+    glm::ivec3 grid_size = glm::ivec3(glm::ceil(params->aquarium_size / params->distance));
+    glm::ivec3 start = glm::max(center - 1, glm::ivec3(0));
+    glm::ivec3 end = glm::min(center + 1, grid_size - 1);
+
+    for (int shell = 0; shell <= 1; ++shell) {
+        for_each_shell_cell(center, shell, start, end, [&](glm::ivec3 coords) {
+            float distance2_cell = cell_distance2(params, grid_size, glm::vec3(self_position), coords);
+            if (distance2_cell > distance2_max || distance2_cell >= capped.bound()) {
+                return;
+            }
+
+            CellId cell = flatten_coords(params, CellCoord(coords.x), CellCoord(coords.y), CellCoord(coords.z));
+            for (int k = cell_start[cell]; k < cell_end[cell]; ++k) {
+                BoidId other_id = boid_id[k];
+                if (other_id == b_id) {
+                    continue;
+                }
+
+                float distance2 = glm::dot(self_position - position_old[other_id], self_position - position_old[other_id]);
+                if (distance2 > distance2_max) {
+                    continue;
+                }
+                if (limited_view && !in_view_cone(forward, glm::vec3(position_old[other_id] - self_position), distance2, cos_half_view_angle)) {
+                    continue;
+                }
+                capped.offer(distance2, other_id);
+            }
+        });
+    }
+}
+
 __device__ void update_orientation(
+        const SimulationParameters *params,
         glm::vec4 *forward,
         glm::vec4 *up,
         glm::vec4 *right,
         glm::vec3 *velocity,
         BoidId b_id
 ) {
+    // boids.vert derives the basis, the forward VBO only carries the velocity
+    if (params->shader_orientation) {
+        forward[b_id] = glm::vec4(velocity[b_id], 0.f);
+        return;
+    }
+
     // Update orientation
     forward[b_id] = glm::vec4(glm::normalize(velocity[b_id]), 0.f);
     right[b_id] = glm::vec4(glm::normalize(
@@ -69,6 +168,7 @@ __device__ void update_pos_vel(
         const glm::vec3* obstacle_position,
         const float* obstacle_radius,
         const int obstacle_count,
+        const SdfView environment,
         const BoidId b_id,
         glm::vec4 *position,
         glm::vec4 *position_old,
@@ -80,33 +180,8 @@ __device__ void update_pos_vel(
         glm::vec4 *right,
         float dt
 ) {
-    float wall = 4.f;
-    float wall_acc = 15.f;
-
     // Update walls
-    if (position_old[b_id].x > params->aquarium_size.x / 2.f - wall) {
-        auto intensity = std::abs((params->aquarium_size.x / 2.f - wall - position_old[b_id].x) / wall);
-        acceleration += intensity * glm::vec3(-wall_acc, 0.f, 0.f);
-    } else if (position_old[b_id].x < -params->aquarium_size.x / 2.f + wall) {
-        auto intensity = std::abs((-params->aquarium_size.x / 2.f + wall - position_old[b_id].x) / wall);
-        acceleration += intensity * glm::vec3(wall_acc, 0.f, 0.f);
-    }
-
-    if (position_old[b_id].y > params->aquarium_size.y / 2.f - wall) {
-        auto intensity = std::abs((params->aquarium_size.y / 2.f - wall - position_old[b_id].y) / wall);
-        acceleration += intensity * glm::vec3(0.f, -wall_acc, 0.f);
-    } else if (position_old[b_id].y < -params->aquarium_size.y / 2.f + wall) {
-        auto intensity = std::abs((-params->aquarium_size.y / 2.f + wall - position_old[b_id].y) / wall);
-        acceleration += intensity * glm::vec3(0.f, wall_acc, 0.f);
-    }
-
-    if (position_old[b_id].z > params->aquarium_size.z / 2.f - wall) {
-        auto intensity = std::abs((params->aquarium_size.z / 2.f - wall - position_old[b_id].z) / wall);
-        acceleration += intensity * glm::vec3(0.f, 0.f, -wall_acc);
-    } else if (position_old[b_id].z < -params->aquarium_size.z / 2.f + wall) {
-        auto intensity = std::abs((-params->aquarium_size.z / 2.f + wall - position_old[b_id].z) / wall);
-        acceleration += intensity * glm::vec3(0.f, 0.f, wall_acc);
-    }
+    acceleration += environment.avoidance(glm::vec3(position_old[b_id]));
 
     // Update obstacles
     for (int i = 0; i < obstacle_count; ++i) {
@@ -137,7 +212,7 @@ __device__ void update_pos_vel(
     position[b_id] = position_old[b_id] + glm::vec4(velocity[b_id] * dt, 0.f);
 
     // Update orientation
-    update_orientation(forward, up, right, velocity, b_id);
+    update_orientation(params, forward, up, right, velocity, b_id);
 }
 
 __device__ void update_pos_vel_shared(
@@ -145,6 +220,7 @@ __device__ void update_pos_vel_shared(
         const glm::vec3* obstacle_position,
         const float* obstacle_radius,
         const int obstacle_count,
+        const SdfView environment,
         const BoidId b_id,
         const int tid,
         glm::vec4 *position,
@@ -157,33 +233,8 @@ __device__ void update_pos_vel_shared(
         glm::vec4 *right,
         float dt
 ) {
-    float wall = 4.f;
-    float wall_acc = 15.f;
-
     // Update walls
-    if (position_old[tid].x > params->aquarium_size.x / 2.f - wall) {
-        auto intensity = std::abs((params->aquarium_size.x / 2.f - wall - position_old[tid].x) / wall);
-        acceleration += intensity * glm::vec3(-wall_acc, 0.f, 0.f);
-    } else if (position_old[tid].x < -params->aquarium_size.x / 2.f + wall) {
-        auto intensity = std::abs((-params->aquarium_size.x / 2.f + wall - position_old[tid].x) / wall);
-        acceleration += intensity * glm::vec3(wall_acc, 0.f, 0.f);
-    }
-
-    if (position_old[tid].y > params->aquarium_size.y / 2.f - wall) {
-        auto intensity = std::abs((params->aquarium_size.y / 2.f - wall - position_old[tid].y) / wall);
-        acceleration += intensity * glm::vec3(0.f, -wall_acc, 0.f);
-    } else if (position_old[tid].y < -params->aquarium_size.y / 2.f + wall) {
-        auto intensity = std::abs((-params->aquarium_size.y / 2.f + wall - position_old[tid].y) / wall);
-        acceleration += intensity * glm::vec3(0.f, wall_acc, 0.f);
-    }
-
-    if (position_old[tid].z > params->aquarium_size.z / 2.f - wall) {
-        auto intensity = std::abs((params->aquarium_size.z / 2.f - wall - position_old[tid].z) / wall);
-        acceleration += intensity * glm::vec3(0.f, 0.f, -wall_acc);
-    } else if (position_old[tid].z < -params->aquarium_size.z / 2.f + wall) {
-        auto intensity = std::abs((-params->aquarium_size.z / 2.f + wall - position_old[tid].z) / wall);
-        acceleration += intensity * glm::vec3(0.f, 0.f, wall_acc);
-    }
+    acceleration += environment.avoidance(glm::vec3(position_old[tid]));
 
     // Update obstacles
     for (int i = 0; i < obstacle_count; ++i) {
@@ -214,7 +265,7 @@ __device__ void update_pos_vel_shared(
     position[b_id] = position_old[tid] + glm::vec4(velocity[b_id] * dt, 0.f);
 
     // Update orientation
-    update_orientation(forward, up, right, velocity, b_id);
+    update_orientation(params, forward, up, right, velocity, b_id);
 }
 
 __global__ void setup_curand(size_t max_boid_count) {
@@ -270,11 +321,14 @@ __global__ void ker_clear_starts(CellId *cell_id, int *cell_start, int *cell_end
     cell_end[cell_id[k]] = 0;
 }
 
+// Capped instances keep the nearest max_neighbors candidates in a heap, the exact ones carry no heap
+template<bool Capped>
 __global__ void ker_update_simulation_naive(
         const SimulationParameters *params,
         const glm::vec3* obstacle_position,
         const float* obstacle_radius,
         const int obstacle_count,
+        const SdfView environment,
         glm::vec4 *position,
         glm::vec4 *position_old,
         glm::vec3 *velocity,
@@ -294,6 +348,14 @@ __global__ void ker_update_simulation_naive(
     glm::vec3 avg_pos(0.);
     uint32_t neighbors_count = 0;
 
+    bool limited_view = params->limited_view();
+    float cos_half_view_angle = params->cos_half_view_angle();
+    glm::vec3 forward = glm::normalize(velocity_old[b_id]);
+
+    // Approximate mode keeps the nearest candidates and sums them after the scan
+    BoidNeighbor nearest[Capped ? SimulationParameters::MAX_CAPPED_NEIGHBORS : 1];
+    NeighborHeap capped(nearest, Capped ? params->neighbor_cap() : 0);
+
     for (BoidId other_id = 0; other_id < params->boids_count; ++other_id) {
         if (other_id == b_id) {
             continue;
@@ -304,12 +366,24 @@ __global__ void ker_update_simulation_naive(
             continue;
         }
 
+        if (limited_view && !in_view_cone(forward, glm::vec3(position_old[other_id] - position_old[b_id]), distance2, cos_half_view_angle)) {
+            continue;
+        }
+
+        if (Capped) {
+            capped.offer(distance2, other_id);
+            continue;
+        }
+
         separation += glm::vec3(glm::normalize(position_old[b_id] - position_old[other_id]) / distance2);
         avg_vel += velocity_old[other_id];
         avg_pos += glm::vec3(position_old[other_id]);
 
         ++neighbors_count;
     }
+    if (Capped) {
+        add_capped_neighbors(capped, position_old[b_id], position_old, velocity_old, separation, avg_vel, avg_pos, neighbors_count);
+    }
 
     if (neighbors_count > 0) {
         avg_vel /= float(neighbors_count);
@@ -336,6 +410,7 @@ __global__ void ker_update_simulation_naive(
             obstacle_position,
             obstacle_radius,
             obstacle_count,
+            environment,
             b_id,
             position,
             position_old,
@@ -349,11 +424,13 @@ __global__ void ker_update_simulation_naive(
     );
 }
 
+template<bool Capped>
 __global__ void ker_update_simulation_with_sort0(
         const SimulationParameters *params,
         const glm::vec3* obstacle_position,
         const float* obstacle_radius,
         const int obstacle_count,
+        const SdfView environment,
         const BoidId *boid_id,
         const int *cell_start,
         const int *cell_end,
@@ -384,86 +461,114 @@ __global__ void ker_update_simulation_with_sort0(
     glm::vec3 avg_pos(0.);
     uint32_t neighbors_count = 0;
 
-    CellCoords cell_coords = get_cell_cords(params, position_old[b_id]);
-
-    CellCoord grid_size_x = std::ceil(params->aquarium_size.x / params->distance);
-    CellCoord grid_size_y = std::ceil(params->aquarium_size.y / params->distance);
-    CellCoord grid_size_z = std::ceil(params->aquarium_size.z / params->distance);
+    bool limited_view = params->limited_view();
+    float cos_half_view_angle = params->cos_half_view_angle();
+    glm::vec3 forward = glm::normalize(s_velocity_old[tid]);
+    float cell_radius = 0.5f * sqrtf(3.f) * params->distance;
 
-    auto x_start = static_cast<CellCoord>(max(int(cell_coords.x) - 1, 0));
-    auto x_end = static_cast<CellCoord>(min(cell_coords.x + 1, grid_size_x - 1));
+    if (Capped) {
+        BoidNeighbor nearest[SimulationParameters::MAX_CAPPED_NEIGHBORS];
+        NeighborHeap capped(nearest, params->neighbor_cap());
+        gather_capped_neighbors(params, boid_id, cell_start, cell_end, position_old, b_id, s_position_old[tid], forward, capped);
+        add_capped_neighbors(capped, s_position_old[tid], position_old, velocity_old, separation, avg_vel, avg_pos, neighbors_count);
+    } else {
+        CellCoords cell_coords = get_cell_cords(params, position_old[b_id]);
 
-    auto y_start = static_cast<CellCoord>(max(int(cell_coords.y) - 1, 0));
-    auto y_end = static_cast<CellCoord>(min(cell_coords.y + 1, grid_size_y - 1));
+        CellCoord grid_size_x = std::ceil(params->aquarium_size.x / params->distance);
+        CellCoord grid_size_y = std::ceil(params->aquarium_size.y / params->distance);
+        CellCoord grid_size_z = std::ceil(params->aquarium_size.z / params->distance);
 
-    auto z_start = static_cast<CellCoord>(max(int(cell_coords.z) - 1, 0));
-    auto z_end = static_cast<CellCoord>(min(cell_coords.z + 1, grid_size_z - 1));
+        auto x_start = static_cast<CellCoord>(max(int(cell_coords.x) - 1, 0));
+        auto x_end = static_cast<CellCoord>(min(cell_coords.x + 1, grid_size_x - 1));
 
-    for (CellCoord curr_cell_z = z_start; curr_cell_z <= z_end; ++curr_cell_z) {
-        for (CellCoord curr_cell_y = y_start; curr_cell_y <= y_end; ++curr_cell_y) {
-            for (CellCoord curr_cell_x = x_start; curr_cell_x <= x_end; ++curr_cell_x) {
-                if (curr_cell_x == cell_coords.x && curr_cell_y == cell_coords.y && curr_cell_z == cell_coords.z) {
-                    continue;
-                }
-                CellId curr_flat_id = flatten_coords(
-                        params,
-                        curr_cell_x,
-                        curr_cell_y,
-                        curr_cell_z
-                );
+        auto y_start = static_cast<CellCoord>(max(int(cell_coords.y) - 1, 0));
+        auto y_end = static_cast<CellCoord>(min(cell_coords.y + 1, grid_size_y - 1));
 
-                for (int k = cell_start[curr_flat_id]; k < cell_end[curr_flat_id]; ++k) {
-                    BoidId other_id = boid_id[k];
+        auto z_start = static_cast<CellCoord>(max(int(cell_coords.z) - 1, 0));
+        auto z_end = static_cast<CellCoord>(min(cell_coords.z + 1, grid_size_z - 1));
 
-                    if (other_id == b_id) {
+        for (CellCoord curr_cell_z = z_start; curr_cell_z <= z_end; ++curr_cell_z) {
+            for (CellCoord curr_cell_y = y_start; curr_cell_y <= y_end; ++curr_cell_y) {
+                for (CellCoord curr_cell_x = x_start; curr_cell_x <= x_end; ++curr_cell_x) {
+                    if (curr_cell_x == cell_coords.x && curr_cell_y == cell_coords.y && curr_cell_z == cell_coords.z) {
                         continue;
                     }
-
-                    auto distance2 = glm::dot(s_position_old[tid] - position_old[other_id], s_position_old[tid] - position_old[other_id]);
-                    if (distance2 > params->distance * params->distance) {
-                        continue;
+                    // Prune cells lying entirely in the blind angle before scanning them
+                    if (limited_view) {
+                        glm::vec3 cell_center = (glm::vec3(curr_cell_x, curr_cell_y, curr_cell_z) + 0.5f) * params->distance - params->aquarium_size / 2.f;
+                        if (sphere_in_view_cone(forward, cell_center - glm::vec3(s_position_old[tid]), cell_radius, cos_half_view_angle) == ConeOverlap::Outside) {
+                            continue;
+                        }
                     }
 
-                    separation += glm::vec3(glm::normalize(s_position_old[tid] - position_old[other_id]) / distance2);
-                    avg_vel += velocity_old[other_id];
-                    avg_pos += glm::vec3(position_old[other_id]);
+                    CellId curr_flat_id = flatten_coords(
+                            params,
+                            curr_cell_x,
+                            curr_cell_y,
+                            curr_cell_z
+                    );
 
-                    ++neighbors_count;
+                    for (int k = cell_start[curr_flat_id]; k < cell_end[curr_flat_id]; ++k) {
+                        BoidId other_id = boid_id[k];
+
+                        if (other_id == b_id) {
+                            continue;
+                        }
+
+                        auto distance2 = glm::dot(s_position_old[tid] - position_old[other_id], s_position_old[tid] - position_old[other_id]);
+                        if (distance2 > params->distance * params->distance) {
+                            continue;
+                        }
+
+                        if (limited_view && !in_view_cone(forward, glm::vec3(position_old[other_id] - s_position_old[tid]), distance2, cos_half_view_angle)) {
+                            continue;
+                        }
+
+                        separation += glm::vec3(glm::normalize(s_position_old[tid] - position_old[other_id]) / distance2);
+                        avg_vel += velocity_old[other_id];
+                        avg_pos += glm::vec3(position_old[other_id]);
+
+                        ++neighbors_count;
+                    }
                 }
             }
         }
-    }
 
-    // Update current cell
-    CellId curr_flat_id = flatten_coords(
-            params,
-            cell_coords
-    );
+        // Update current cell
+        CellId curr_flat_id = flatten_coords(
+                params,
+                cell_coords
+        );
 
-    for (int k = cell_start[curr_flat_id]; k < cell_end[curr_flat_id]; ++k) {
-        BoidId other_id = boid_id[k];
+        for (int k = cell_start[curr_flat_id]; k < cell_end[curr_flat_id]; ++k) {
+            BoidId other_id = boid_id[k];
 
-        if (other_id == b_id) {
-            continue;
-        }
+            if (other_id == b_id) {
+                continue;
+            }
 
-        auto distance2 = glm::dot(s_position_old[tid] - position_old[other_id], s_position_old[tid] - position_old[other_id]);
-        if (distance2 > params->distance * params->distance) {
-            continue;
-        }
+            auto distance2 = glm::dot(s_position_old[tid] - position_old[other_id], s_position_old[tid] - position_old[other_id]);
+            if (distance2 > params->distance * params->distance) {
+                continue;
+            }
+
+            if (limited_view && !in_view_cone(forward, glm::vec3(position_old[other_id] - s_position_old[tid]), distance2, cos_half_view_angle)) {
+                continue;
+            }
 
-        int other_block_id = int(other_id) / BLOCK_SIZE;
-        if (other_block_id == blockIdx.x) {
-            int other_tid = int(other_id) % BLOCK_SIZE;
-            separation += glm::vec3(glm::normalize(s_position_old[tid] - s_position_old[other_tid]) / distance2);
-            avg_vel += s_velocity_old[other_tid];
-            avg_pos += glm::vec3(s_position_old[other_tid]);
-        } else {
-            separation += glm::vec3(glm::normalize(s_position_old[tid] - position_old[other_id]) / distance2);
-            avg_vel += velocity_old[other_id];
-            avg_pos += glm::vec3(position_old[other_id]);
+            int other_block_id = int(other_id) / BLOCK_SIZE;
+            if (other_block_id == blockIdx.x) {
+                int other_tid = int(other_id) % BLOCK_SIZE;
+                separation += glm::vec3(glm::normalize(s_position_old[tid] - s_position_old[other_tid]) / distance2);
+                avg_vel += s_velocity_old[other_tid];
+                avg_pos += glm::vec3(s_position_old[other_tid]);
+            } else {
+                separation += glm::vec3(glm::normalize(s_position_old[tid] - position_old[other_id]) / distance2);
+                avg_vel += velocity_old[other_id];
+                avg_pos += glm::vec3(position_old[other_id]);
+            }
+            ++neighbors_count;
         }
-        ++neighbors_count;
     }
 
     if (neighbors_count > 0) {
@@ -491,6 +596,7 @@ __global__ void ker_update_simulation_with_sort0(
             obstacle_position,
             obstacle_radius,
             obstacle_count,
+            environment,
             b_id,
             tid,
             position,
@@ -505,11 +611,13 @@ __global__ void ker_update_simulation_with_sort0(
     );
 }
 
+template<bool Capped>
 __global__ void ker_update_simulation_with_sort1(
         const SimulationParameters *params,
         const glm::vec3* obstacle_position,
         const float* obstacle_radius,
         const int obstacle_count,
+        const SdfView environment,
         const BoidId *boid_id,
         const int *cell_start,
         const int *cell_end,
@@ -539,48 +647,72 @@ __global__ void ker_update_simulation_with_sort1(
     glm::vec3 avg_pos(0.);
     uint32_t neighbors_count = 0;
 
-    CellCoords cell_coords = get_cell_cords(params, position_old[b_id]);
+    bool limited_view = params->limited_view();
+    float cos_half_view_angle = params->cos_half_view_angle();
+    glm::vec3 forward = glm::normalize(s_velocity_old[tid]);
+    float cell_radius = 0.5f * sqrtf(3.f) * params->distance;
 
-    CellCoord grid_size_x = std::ceil(params->aquarium_size.x / params->distance);
-    CellCoord grid_size_y = std::ceil(params->aquarium_size.y / params->distance);
-    CellCoord grid_size_z = std::ceil(params->aquarium_size.z / params->distance);
+    if (Capped) {
+        BoidNeighbor nearest[SimulationParameters::MAX_CAPPED_NEIGHBORS];
+        NeighborHeap capped(nearest, params->neighbor_cap());
+        gather_capped_neighbors(params, boid_id, cell_start, cell_end, position_old, b_id, s_position_old[tid], forward, capped);
+        add_capped_neighbors(capped, s_position_old[tid], position_old, velocity_old, separation, avg_vel, avg_pos, neighbors_count);
+    } else {
+        CellCoords cell_coords = get_cell_cords(params, position_old[b_id]);
+
+        CellCoord grid_size_x = std::ceil(params->aquarium_size.x / params->distance);
+        CellCoord grid_size_y = std::ceil(params->aquarium_size.y / params->distance);
+        CellCoord grid_size_z = std::ceil(params->aquarium_size.z / params->distance);
+
+        auto x_start = static_cast<CellCoord>(max(int(cell_coords.x) - 1, 0));
+        auto x_end = static_cast<CellCoord>(min(cell_coords.x + 1, grid_size_x - 1));
+
+        auto y_start = static_cast<CellCoord>(max(int(cell_coords.y) - 1, 0));
+        auto y_end = static_cast<CellCoord>(min(cell_coords.y + 1, grid_size_y - 1));
+
+        auto z_start = static_cast<CellCoord>(max(int(cell_coords.z) - 1, 0));
+        auto z_end = static_cast<CellCoord>(min(cell_coords.z + 1, grid_size_z - 1));
+
+        for (CellCoord curr_cell_z = z_start; curr_cell_z <= z_end; ++curr_cell_z) {
+            for (CellCoord curr_cell_y = y_start; curr_cell_y <= y_end; ++curr_cell_y) {
+                for (CellCoord curr_cell_x = x_start; curr_cell_x <= x_end; ++curr_cell_x) {
+                    // Prune cells lying entirely in the blind angle before scanning them
+                    if (limited_view) {
+                        glm::vec3 cell_center = (glm::vec3(curr_cell_x, curr_cell_y, curr_cell_z) + 0.5f) * params->distance - params->aquarium_size / 2.f;
+                        if (sphere_in_view_cone(forward, cell_center - glm::vec3(s_position_old[tid]), cell_radius, cos_half_view_angle) == ConeOverlap::Outside) {
+                            continue;
+                        }
+                    }
 
-    auto x_start = static_cast<CellCoord>(max(int(cell_coords.x) - 1, 0));
-    auto x_end = static_cast<CellCoord>(min(cell_coords.x + 1, grid_size_x - 1));
+                    CellId curr_flat_id = flatten_coords(
+                            params,
+                            curr_cell_x,
+                            curr_cell_y,
+                            curr_cell_z
+                    );
 
-    auto y_start = static_cast<CellCoord>(max(int(cell_coords.y) - 1, 0));
-    auto y_end = static_cast<CellCoord>(min(cell_coords.y + 1, grid_size_y - 1));
+                    for (int k = cell_start[curr_flat_id]; k < cell_end[curr_flat_id]; ++k) {
+                        BoidId other_id = boid_id[k];
 
-    auto z_start = static_cast<CellCoord>(max(int(cell_coords.z) - 1, 0));
-    auto z_end = static_cast<CellCoord>(min(cell_coords.z + 1, grid_size_z - 1));
+                        if (other_id == b_id) {
+                            continue;
+                        }
 
-    for (CellCoord curr_cell_z = z_start; curr_cell_z <= z_end; ++curr_cell_z) {
-        for (CellCoord curr_cell_y = y_start; curr_cell_y <= y_end; ++curr_cell_y) {
-            for (CellCoord curr_cell_x = x_start; curr_cell_x <= x_end; ++curr_cell_x) {
-                CellId curr_flat_id = flatten_coords(
-                        params,
-                        curr_cell_x,
-                        curr_cell_y,
-                        curr_cell_z
-                );
+                        auto distance2 = glm::dot(s_position_old[tid] - position_old[other_id], s_position_old[tid] - position_old[other_id]);
+                        if (distance2 > params->distance * params->distance) {
+                            continue;
+                        }
 
-                for (int k = cell_start[curr_flat_id]; k < cell_end[curr_flat_id]; ++k) {
-                    BoidId other_id = boid_id[k];
+                        if (limited_view && !in_view_cone(forward, glm::vec3(position_old[other_id] - s_position_old[tid]), distance2, cos_half_view_angle)) {
+                            continue;
+                        }
 
-                    if (other_id == b_id) {
-                        continue;
-                    }
+                        separation += glm::vec3(glm::normalize(s_position_old[tid] - position_old[other_id]) / distance2);
+                        avg_vel += velocity_old[other_id];
+                        avg_pos += glm::vec3(position_old[other_id]);
 
-                    auto distance2 = glm::dot(s_position_old[tid] - position_old[other_id], s_position_old[tid] - position_old[other_id]);
-                    if (distance2 > params->distance * params->distance) {
-                        continue;
+                        ++neighbors_count;
                     }
-
-                    separation += glm::vec3(glm::normalize(s_position_old[tid] - position_old[other_id]) / distance2);
-                    avg_vel += velocity_old[other_id];
-                    avg_pos += glm::vec3(position_old[other_id]);
-
-                    ++neighbors_count;
                 }
             }
         }
@@ -611,6 +743,7 @@ __global__ void ker_update_simulation_with_sort1(
             obstacle_position,
             obstacle_radius,
             obstacle_count,
+            environment,
             b_id,
             tid,
             position,
@@ -655,7 +788,7 @@ __global__ void ker_reset_simulation(
     velocity_old[b_id] = glm::vec3(0.05f * glm::normalize(glm::vec3(x, y, z)));
 
     // Update basis vectors (orientation)
-    update_orientation(forward, up, right, velocity_old, b_id);
+    update_orientation(params, forward, up, right, velocity_old, b_id);
 
     state[b_id] = local_state;
 }
@@ -763,6 +896,12 @@ void GPUBoids::init_default(const Boids& boids) {
 
     // Setup curand
     setup_curand<<<1024,SimulationParameters::MAX_BOID_COUNT / 1024 + 1>>>(SimulationParameters::MAX_BOID_COUNT);
+
+    init_uploads();
+
+    // Without GL interop the host renders from steps read back into pinned memory
+    m_copy_engine = std::make_unique<CudaCopyEngine>();
+    m_readback = std::make_unique<AsyncReadback>(*m_copy_engine, SimulationParameters::MAX_BOID_COUNT);
 }
 
 void GPUBoids::init_with_gl(const Boids &boids, const BoidsRenderer &renderer) {
@@ -835,6 +974,13 @@ void GPUBoids::init_with_gl(const Boids &boids, const BoidsRenderer &renderer) {
 
     // Setup curand
     setup_curand<<<1024, SimulationParameters::MAX_BOID_COUNT / 1024 + 1>>>(SimulationParameters::MAX_BOID_COUNT);
+
+    init_uploads();
+}
+
+void GPUBoids::init_uploads() {
+    m_param_sink = std::make_unique<CudaParameterSink>(m_dev_sim_params, m_dev_obstacle_position, m_dev_obstacle_radius);
+    m_uploader = std::make_unique<ParameterUploader>(*m_param_sink);
 }
 
 GPUBoids::~GPUBoids() {
@@ -855,24 +1001,42 @@ GPUBoids::~GPUBoids() {
     cudaFree(m_dev_sim_params);
     cudaFree(m_dev_cell_id);
     cudaFree(m_dev_boid_id);
+    cudaFree(m_dev_sdf);
 }
 
-void GPUBoids::update_simulation_naive(const boids::SimulationParameters &params, const Obstacles &obstacles, Boids &boids, float dt) {
-    cudaError_t cuda_status = cudaMemcpy(m_dev_sim_params, &params, sizeof(boids::SimulationParameters), cudaMemcpyHostToDevice);
+void GPUBoids::set_environment(const SignedDistanceField& environment) {
+    cudaError_t cuda_status;
+
+    cudaFree(m_dev_sdf);
+    cuda_status = cudaMalloc((void**)&m_dev_sdf, environment.voxel_count() * sizeof(float));
+    check_cuda_error(cuda_status, "[CUDA]: cudaMalloc failed: ");
+    cuda_status = cudaMemcpy(m_dev_sdf, environment.data().data(), environment.voxel_count() * sizeof(float), cudaMemcpyHostToDevice);
     check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
+
+    m_dev_environment = environment.view();
+    m_dev_environment.data = m_dev_sdf;
+}
+
+void GPUBoids::upload_inputs(const SimulationParameters &params, const Obstacles &obstacles) {
+    m_inputs.update(params, obstacles);
+    m_uploader->sync(m_inputs);
+}
+
+void GPUBoids::update_simulation_naive(const boids::SimulationParameters &params, const Obstacles &obstacles, float dt) {
+    upload_inputs(params, obstacles);
     size_t threads_per_block = BLOCK_SIZE;
     size_t blocks_num = params.boids_count / threads_per_block + 1;
 
-    cuda_status = cudaMemcpy(m_dev_obstacle_position, obstacles.get_pos_array(), SimulationParameters::MAX_OBSTACLES_COUNT * sizeof(glm::vec3), cudaMemcpyHostToDevice);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
-    cuda_status = cudaMemcpy(m_dev_obstacle_radius, obstacles.get_radius_array(), SimulationParameters::MAX_OBSTACLES_COUNT * sizeof(float), cudaMemcpyHostToDevice);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
+    // The kernel overwrites the orientation the previous readback may still be copying
+    protect_readback_sources();
 
-    ker_update_simulation_naive<<<blocks_num, threads_per_block>>>(
+    auto kernel = params.neighbor_cap() > 0 ? ker_update_simulation_naive<true> : ker_update_simulation_naive<false>;
+    kernel<<<blocks_num, threads_per_block>>>(
             m_dev_sim_params,
             m_dev_obstacle_position,
             m_dev_obstacle_radius,
-            obstacles.count(),
+            m_inputs.obstacle_count(),
+            m_dev_environment,
             m_dev_position,
             m_dev_position_old,
             m_dev_velocity,
@@ -882,25 +1046,21 @@ void GPUBoids::update_simulation_naive(const boids::SimulationParameters &params
             m_dev_right,
             dt
     );
-    cudaDeviceSynchronize();
 
     if (!m_gl_registered) {
-        move_boids_data_to_cpu(boids);
+        request_readback(params.boids_count);
     }
+
+    // Waits for the kernels but not for the readback, which overlaps the rest of the frame
+    cudaStreamSynchronize(0);
     swap_buffers(params.boids_count);
 }
 
-void GPUBoids::update_simulation_with_sort(const boids::SimulationParameters &params, const Obstacles &obstacles, Boids &boids, float dt, int variant = 1) {
-    cudaError_t cuda_status = cudaMemcpy(m_dev_sim_params, &params, sizeof(boids::SimulationParameters), cudaMemcpyHostToDevice);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
+void GPUBoids::update_simulation_with_sort(const boids::SimulationParameters &params, const Obstacles &obstacles, float dt, int variant = 1) {
+    upload_inputs(params, obstacles);
     size_t threads_per_block = BLOCK_SIZE;
     size_t blocks_num = params.boids_count / threads_per_block + 1;
 
-    cuda_status = cudaMemcpy(m_dev_obstacle_position, obstacles.get_pos_array(), SimulationParameters::MAX_OBSTACLES_COUNT * sizeof(glm::vec3), cudaMemcpyHostToDevice);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
-    cuda_status = cudaMemcpy(m_dev_obstacle_radius, obstacles.get_radius_array(), SimulationParameters::MAX_OBSTACLES_COUNT * sizeof(float), cudaMemcpyHostToDevice);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
-
     // 1. Update simulation parameters
     ker_find_cell_ids<<<blocks_num, threads_per_block>>>(
             m_dev_sim_params,
@@ -908,7 +1068,6 @@ void GPUBoids::update_simulation_with_sort(const boids::SimulationParameters &pa
             m_dev_cell_id,
             m_dev_position_old
     );
-    cudaDeviceSynchronize();
 
     // 2.
     thrust::sort_by_key(
@@ -917,7 +1076,6 @@ void GPUBoids::update_simulation_with_sort(const boids::SimulationParameters &pa
             m_dev_cell_id + params.boids_count,
             m_dev_boid_id
     );
-    cudaDeviceSynchronize();
 
     // 3.
     ker_find_starts<<<blocks_num, threads_per_block>>>(
@@ -926,15 +1084,18 @@ void GPUBoids::update_simulation_with_sort(const boids::SimulationParameters &pa
             m_dev_cell_end,
             params.boids_count
     );
-    cudaDeviceSynchronize();
 
-    // 4.
+    // 4. Overwrites the orientation the previous readback may still be copying
+    protect_readback_sources();
+    bool capped = params.neighbor_cap() > 0;
     if (variant == 1) {
-        ker_update_simulation_with_sort1<<<blocks_num, threads_per_block>>>(
+        auto kernel = capped ? ker_update_simulation_with_sort1<true> : ker_update_simulation_with_sort1<false>;
+        kernel<<<blocks_num, threads_per_block>>>(
                 m_dev_sim_params,
                 m_dev_obstacle_position,
                 m_dev_obstacle_radius,
-                obstacles.count(),
+                m_inputs.obstacle_count(),
+                m_dev_environment,
                 m_dev_boid_id,
                 m_dev_cell_start,
                 m_dev_cell_end,
@@ -948,11 +1109,13 @@ void GPUBoids::update_simulation_with_sort(const boids::SimulationParameters &pa
                 dt
         );
     } else {
-         ker_update_simulation_with_sort0<<<blocks_num, threads_per_block>>>(
+        auto kernel = capped ? ker_update_simulation_with_sort0<true> : ker_update_simulation_with_sort0<false>;
+        kernel<<<blocks_num, threads_per_block>>>(
                 m_dev_sim_params,
                 m_dev_obstacle_position,
                 m_dev_obstacle_radius,
-                obstacles.count(),
+                m_inputs.obstacle_count(),
+                m_dev_environment,
                 m_dev_boid_id,
                 m_dev_cell_start,
                 m_dev_cell_end,
@@ -966,8 +1129,11 @@ void GPUBoids::update_simulation_with_sort(const boids::SimulationParameters &pa
                 dt
         );
     }
-    cudaDeviceSynchronize();
 
+    // The copies only wait for the kernels queued so far
+    if (!m_gl_registered) {
+        request_readback(params.boids_count);
+    }
 
     // 5.
     ker_clear_starts<<<blocks_num, threads_per_block>>>(
@@ -976,15 +1142,17 @@ void GPUBoids::update_simulation_with_sort(const boids::SimulationParameters &pa
             m_dev_cell_end,
             params.boids_count
     );
-    cudaDeviceSynchronize();
 
-    if (!m_gl_registered) {
-        move_boids_data_to_cpu(boids);
-    }
+    // Waits for the kernels but not for the readback, which overlaps the rest of the frame
+    cudaStreamSynchronize(0);
     swap_buffers(params.boids_count);
 }
 
 void GPUBoids::reset(const SimulationParameters& params, const Boids& boids, const BoidsRenderer& renderer) {
+    if (m_readback) {
+        m_readback->reset();
+    }
+
     size_t array_size_vec3 = SimulationParameters::MAX_BOID_COUNT * sizeof(glm::vec3);
     size_t array_size_vec4 = SimulationParameters::MAX_BOID_COUNT * sizeof(glm::vec4);
     cudaError cuda_status;
@@ -1025,16 +1193,18 @@ void GPUBoids::reset(const SimulationParameters& params, const Boids& boids, con
 		check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
 	}
 }
-void GPUBoids::move_boids_data_to_cpu(Boids &boids) {
-    cudaError_t cuda_status;
-    cuda_status = cudaMemcpy(boids.position.data(), m_dev_position, sizeof(glm::vec4) * SimulationParameters::MAX_BOID_COUNT, cudaMemcpyDeviceToHost);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
-    cuda_status = cudaMemcpy(boids.orientation.forward.data(), m_dev_forward, sizeof(glm::vec4) * SimulationParameters::MAX_BOID_COUNT, cudaMemcpyDeviceToHost);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
-    cuda_status = cudaMemcpy(boids.orientation.up.data(), m_dev_up,sizeof(glm::vec4) * SimulationParameters::MAX_BOID_COUNT, cudaMemcpyDeviceToHost);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
-    cuda_status = cudaMemcpy(boids.orientation.right.data(), m_dev_right,sizeof(glm::vec4) * SimulationParameters::MAX_BOID_COUNT, cudaMemcpyDeviceToHost);
-    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpy failed: ");
+void GPUBoids::request_readback(int count) {
+    m_readback->request(count, AsyncReadback::DeviceSources { m_dev_position, m_dev_forward, m_dev_up, m_dev_right });
+}
+
+void GPUBoids::protect_readback_sources() {
+    if (m_readback) {
+        m_readback->protect_sources();
+    }
+}
+
+bool GPUBoids::acquire_readback(ReadbackFrame &frame) {
+    return m_readback && m_readback->acquire_previous(frame);
 }
 
 void GPUBoids::swap_buffers(int count) {
@@ -1052,4 +1222,100 @@ void GPUBoids::swap_buffers(int count) {
         check_cuda_error(cuda_status, "[CUDA]: m_dev_poistion_vbo cudaMemcpy failed: ");
 
 	}
+}
+
+CudaCopyEngine::CudaCopyEngine() {
+    cudaError_t cuda_status = cudaStreamCreateWithFlags(&m_stream, cudaStreamNonBlocking);
+    check_cuda_error(cuda_status, "[CUDA]: cudaStreamCreate failed: ");
+    cuda_status = cudaEventCreateWithFlags(&m_produced, cudaEventDisableTiming);
+    check_cuda_error(cuda_status, "[CUDA]: cudaEventCreate failed: ");
+    for (cudaEvent_t &fence : m_fences) {
+        cuda_status = cudaEventCreateWithFlags(&fence, cudaEventDisableTiming);
+        check_cuda_error(cuda_status, "[CUDA]: cudaEventCreate failed: ");
+    }
+}
+
+CudaCopyEngine::~CudaCopyEngine() {
+    for (cudaEvent_t fence : m_fences) {
+        cudaEventDestroy(fence);
+    }
+    cudaEventDestroy(m_produced);
+    cudaStreamDestroy(m_stream);
+}
+
+void *CudaCopyEngine::allocate_host(size_t size) {
+    void *ptr = nullptr;
+    cudaError_t cuda_status = cudaMallocHost(&ptr, size);
+    check_cuda_error(cuda_status, "[CUDA]: cudaMallocHost failed: ");
+    return ptr;
+}
+
+void CudaCopyEngine::free_host(void *ptr) {
+    cudaFreeHost(ptr);
+}
+
+void CudaCopyEngine::wait_for_device() {
+    cudaError_t cuda_status = cudaEventRecord(m_produced, 0);
+    check_cuda_error(cuda_status, "[CUDA]: cudaEventRecord failed: ");
+    cuda_status = cudaStreamWaitEvent(m_stream, m_produced, 0);
+    check_cuda_error(cuda_status, "[CUDA]: cudaStreamWaitEvent failed: ");
+}
+
+void CudaCopyEngine::copy_to_host(void *dst, const void *src, size_t size) {
+    cudaError_t cuda_status = cudaMemcpyAsync(dst, src, size, cudaMemcpyDeviceToHost, m_stream);
+    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpyAsync failed: ");
+}
+
+void CudaCopyEngine::record_fence(int slot) {
+    cudaError_t cuda_status = cudaEventRecord(m_fences[slot], m_stream);
+    check_cuda_error(cuda_status, "[CUDA]: cudaEventRecord failed: ");
+}
+
+bool CudaCopyEngine::fence_reached(int slot) {
+    return cudaEventQuery(m_fences[slot]) == cudaSuccess;
+}
+
+void CudaCopyEngine::wait_fence(int slot) {
+    cudaError_t cuda_status = cudaEventSynchronize(m_fences[slot]);
+    check_cuda_error(cuda_status, "[CUDA]: cudaEventSynchronize failed: ");
+}
+
+CudaParameterSink::CudaParameterSink(SimulationParameters *dev_params, glm::vec3 *dev_obstacle_position, float *dev_obstacle_radius)
+: m_dev_params(dev_params), m_dev_obstacle_position(dev_obstacle_position), m_dev_obstacle_radius(dev_obstacle_radius) {
+    cudaError_t cuda_status = cudaMallocHost((void**)&m_staging_params, sizeof(SimulationParameters));
+    check_cuda_error(cuda_status, "[CUDA]: cudaMallocHost failed: ");
+    cuda_status = cudaMallocHost((void**)&m_staging_obstacle_position, SimulationParameters::MAX_OBSTACLES_COUNT * sizeof(glm::vec3));
+    check_cuda_error(cuda_status, "[CUDA]: cudaMallocHost failed: ");
+    cuda_status = cudaMallocHost((void**)&m_staging_obstacle_radius, SimulationParameters::MAX_OBSTACLES_COUNT * sizeof(float));
+    check_cuda_error(cuda_status, "[CUDA]: cudaMallocHost failed: ");
+}
+
+CudaParameterSink::~CudaParameterSink() {
+    cudaFreeHost(m_staging_params);
+    cudaFreeHost(m_staging_obstacle_position);
+    cudaFreeHost(m_staging_obstacle_radius);
+}
+
+void CudaParameterSink::upload_params(const SimulationParameters &params) {
+    std::memcpy(m_staging_params, &params, sizeof(SimulationParameters));
+    cudaError_t cuda_status = cudaMemcpyAsync(m_dev_params, m_staging_params, sizeof(SimulationParameters), cudaMemcpyHostToDevice, 0);
+    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpyAsync failed: ");
+}
+
+void CudaParameterSink::upload_obstacles(size_t count, const glm::vec3 *position, const float *radius) {
+    if (count == 0) {
+        return;
+    }
+
+    std::memcpy(m_staging_obstacle_position, position, count * sizeof(glm::vec3));
+    std::memcpy(m_staging_obstacle_radius, radius, count * sizeof(float));
+    cudaError_t cuda_status = cudaMemcpyAsync(m_dev_obstacle_position, m_staging_obstacle_position, count * sizeof(glm::vec3), cudaMemcpyHostToDevice, 0);
+    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpyAsync failed: ");
+    cuda_status = cudaMemcpyAsync(m_dev_obstacle_radius, m_staging_obstacle_radius, count * sizeof(float), cudaMemcpyHostToDevice, 0);
+    check_cuda_error(cuda_status, "[CUDA]: cudaMemcpyAsync failed: ");
+}
+
+void CudaCopyEngine::device_wait_fence(int slot) {
+    cudaError_t cuda_status = cudaStreamWaitEvent(0, m_fences[slot], 0);
+    check_cuda_error(cuda_status, "[CUDA]: cudaStreamWaitEvent failed: ");
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
 #ifndef BOIDS_SIMULATION_BOIDS_CUDA_HPP
 #define BOIDS_SIMULATION_BOIDS_CUDA_HPP
-#include "boids.hpp"
+#include <array>
+#include <memory>
+#include "async_readback.hpp"
+#include "boids_renderer.hpp"
+#include "parameter_store.hpp"
+#include "sdf.hpp"
 
 namespace boids::cuda_gpu {
     using CellId = uint32_t;
@@ -10,6 +15,53 @@ namespace boids::cuda_gpu {
         CellCoord x, y, z;
     };
 
+    // Device to host copies on a non-blocking stream of their own, so they run alongside the kernels queued after
+    // them. The order with the default stream is explicit: copies wait on an event recorded after the producing
+    // kernels, and kernels overwriting the sources wait on the fence of the copies.
+    class CudaCopyEngine : public CopyEngine {
+    public:
+        CudaCopyEngine();
+        ~CudaCopyEngine() override;
+
+        void *allocate_host(size_t size) override;
+        void free_host(void *ptr) override;
+        void wait_for_device() override;
+        void copy_to_host(void *dst, const void *src, size_t size) override;
+        void record_fence(int slot) override;
+        bool fence_reached(int slot) override;
+        void wait_fence(int slot) override;
+        void device_wait_fence(int slot) override;
+
+    private:
+        cudaStream_t m_stream{};
+        cudaEvent_t m_produced{};
+        std::array<cudaEvent_t, AsyncReadback::SLOT_COUNT> m_fences{};
+    };
+
+    // Uploads from pinned staging copies with cudaMemcpyAsync on the default stream, ordered before the next
+    // kernels without blocking the host. Every step ends by synchronizing the default stream, so the staging
+    // memory is free again by the time the next step writes it.
+    class CudaParameterSink : public ParameterSink {
+    public:
+        CudaParameterSink(SimulationParameters *dev_params, glm::vec3 *dev_obstacle_position, float *dev_obstacle_radius);
+        ~CudaParameterSink() override;
+
+        CudaParameterSink(const CudaParameterSink &) = delete;
+        CudaParameterSink &operator=(const CudaParameterSink &) = delete;
+
+        void upload_params(const SimulationParameters &params) override;
+        void upload_obstacles(size_t count, const glm::vec3 *position, const float *radius) override;
+
+    private:
+        SimulationParameters *m_dev_params;
+        glm::vec3 *m_dev_obstacle_position;
+        float *m_dev_obstacle_radius;
+
+        SimulationParameters *m_staging_params{};
+        glm::vec3 *m_staging_obstacle_position{};
+        float *m_staging_obstacle_radius{};
+    };
+
     class GPUBoids {
     public:
         GPUBoids() = delete;
@@ -17,17 +69,31 @@ namespace boids::cuda_gpu {
         explicit GPUBoids(const Boids& boids, const BoidsRenderer& renderer);
         explicit GPUBoids(const Boids& boids);
 
-        void update_simulation_with_sort(const SimulationParameters& params, const Obstacles& obstacles, Boids &boids, float dt, int variant);
-        void update_simulation_naive(const SimulationParameters &params, const Obstacles& obstacles, Boids &boids, float dt);
+        void update_simulation_with_sort(const SimulationParameters& params, const Obstacles& obstacles, float dt, int variant);
+        void update_simulation_naive(const SimulationParameters &params, const Obstacles& obstacles, float dt);
+
+        // Without registered GL buffers every step is read back asynchronously, this takes the step before
+        // the last one, waiting for its copies only if they have not completed yet
+        bool acquire_readback(ReadbackFrame &frame);
 
         void reset(const SimulationParameters& params, const Boids& boids, const BoidsRenderer& renderer);
 
+        // Uploads the baked environment used for wall avoidance
+        void set_environment(const SignedDistanceField& environment);
+
         bool gl_buffers_registerd() const { return m_gl_registered; }
     private:
         void init_default(const Boids& boids);
         void init_with_gl(const Boids& boids, const BoidsRenderer& renderer);
 
-        void move_boids_data_to_cpu(Boids &boids);
+        void init_uploads();
+
+        // Uploads whatever changed since the previous step
+        void upload_inputs(const SimulationParameters& params, const Obstacles& obstacles);
+
+        // Queues the copies of the step just computed into the readback slots
+        void request_readback(int count);
+        void protect_readback_sources();
 
         void swap_buffers(int count);
 
@@ -40,6 +106,9 @@ namespace boids::cuda_gpu {
         glm::vec3 *m_dev_obstacle_position{};
         float *m_dev_obstacle_radius{};
 
+        float *m_dev_sdf{};
+        SdfView m_dev_environment{};
+
         glm::vec4 *m_dev_forward{};
         glm::vec4 *m_dev_up{};
         glm::vec4 *m_dev_right{};
@@ -58,6 +127,13 @@ namespace boids::cuda_gpu {
         cudaGraphicsResource *m_positionVBO_CUDA, *m_forwardVBO_CUDA, *m_upVBO_CUDA, *m_rightVBO_CUDA;
 
         bool m_gl_registered;
+
+        ParameterStore m_inputs;
+        std::unique_ptr<CudaParameterSink> m_param_sink;
+        std::unique_ptr<ParameterUploader> m_uploader;
+
+        std::unique_ptr<CudaCopyEngine> m_copy_engine;
+        std::unique_ptr<AsyncReadback> m_readback;
     };
 }
 
@@ -0,0 +1,83 @@
+#include <iostream>
+#include "boids_culling.hpp"
+#include "gl_debug.h"
+
+namespace {
+    // Bounding radius of the boid mesh
+    constexpr float BOID_RADIUS = 0.6f;
+}
+
+boids::CullingStage::CullingStage(const std::string &compute_path) {
+    if (!supported()) {
+        std::cout << "[Culling]: GL 4.3 not supported, boids are drawn without culling" << std::endl;
+        return;
+    }
+
+    m_program = std::make_unique<common::ShaderProgram>(compute_path);
+    if (!m_program->is_valid()) {
+        m_program.reset();
+        return;
+    }
+
+    GLCall( glGenBuffers(1, &m_visible_id) );
+    GLCall( glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visible_id) );
+    GLCall( glBufferData(GL_SHADER_STORAGE_BUFFER, SimulationParameters::MAX_BOID_COUNT * 4 * sizeof(glm::vec4), nullptr, GL_DYNAMIC_COPY) );
+
+    GLCall( glGenBuffers(1, &m_far_id) );
+    GLCall( glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_far_id) );
+    GLCall( glBufferData(GL_SHADER_STORAGE_BUFFER, SimulationParameters::MAX_BOID_COUNT * sizeof(glm::vec4), nullptr, GL_DYNAMIC_COPY) );
+
+    GLCall( glGenBuffers(1, &m_command_id) );
+    GLCall( glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_command_id) );
+    GLCall( glBufferData(GL_SHADER_STORAGE_BUFFER, 9 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY) );
+    GLCall( glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0) );
+}
+
+boids::CullingStage::~CullingStage() {
+    if (initialized()) {
+        GLuint buffers[] = { m_visible_id, m_far_id, m_command_id };
+        GLCall( glDeleteBuffers(3, buffers) );
+    }
+}
+
+bool boids::CullingStage::supported() {
+    return GLEW_VERSION_4_3;
+}
+
+void boids::CullingStage::cull(const InstanceSource &source, int count, const glm::mat4 &projection_view, glm::vec3 camera_position, float lod_distance) {
+    // Mesh: 12 indices, no instances yet; points: no vertices yet, one instance
+    GLuint commands[] = { 12, 0, 0, 0, 0, 0, 1, 0, 0 };
+    GLCall( glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_command_id) );
+    GLCall( glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(commands), commands) );
+    GLCall( glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0) );
+
+    // Packed formats are read as words from the start of the buffer, the segment offset goes into a uniform
+    bool basis = source.format == InstanceFormat::Basis;
+    for (GLuint binding = 0; binding < 4; ++binding) {
+        GLCall( glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, basis ? source.buffers[binding] : source.buffers[0]) );
+    }
+    GLCall( glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, source.buffers[0]) );
+    GLCall( glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_visible_id) );
+    GLCall( glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_far_id) );
+    GLCall( glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_command_id) );
+
+    // Frustum planes from the rows of the projection view matrix, normalized for distance tests
+    static const char* plane_names[] = { "u_planes[0]", "u_planes[1]", "u_planes[2]", "u_planes[3]", "u_planes[4]", "u_planes[5]" };
+    glm::mat4 rows = glm::transpose(projection_view);
+    for (int i = 0; i < 6; ++i) {
+        glm::vec4 plane = rows[3] + (i % 2 == 0 ? 1.f : -1.f) * rows[i / 2];
+        m_program->set_uniform_4f(plane_names[i], plane / glm::length(glm::vec3(plane)));
+    }
+
+    m_program->set_uniform_1i("u_format", static_cast<int>(source.format));
+    m_program->set_uniform_1i("u_word_offset", static_cast<int>(source.offset / sizeof(GLuint)));
+    m_program->set_uniform_1i("u_count", count);
+    m_program->set_uniform_1i("u_derive_orientation", source.derive_orientation);
+    m_program->set_uniform_3f("u_camera_position", camera_position);
+    m_program->set_uniform_1f("u_lod_distance", lod_distance);
+    m_program->set_uniform_1f("u_radius", BOID_RADIUS);
+
+    m_program->bind();
+    GLCall( glDispatchCompute((count + 255) / 256, 1, 1) );
+    GLCall( glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT) );
+}
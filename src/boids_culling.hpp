@@ -0,0 +1,46 @@
+#ifndef BOIDS_SIMULATION_BOIDS_CULLING_HPP
+#define BOIDS_SIMULATION_BOIDS_CULLING_HPP
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include "boids_renderer.hpp"
+#include "shader_program.hpp"
+
+namespace boids {
+    // Compute pass that compacts the boids inside the view frustum into a mesh instance list, and the ones
+    // beyond the LOD distance into a point list, and writes the indirect draw commands of both lists
+    class CullingStage {
+    public:
+        // Byte offsets of DrawElementsIndirectCommand and DrawArraysIndirectCommand in command_buffer()
+        constexpr static const size_t MESH_COMMAND_OFFSET = 0;
+        constexpr static const size_t POINT_COMMAND_OFFSET = 5 * sizeof(GLuint);
+
+        // Loads the compute shader only if culling is supported
+        explicit CullingStage(const std::string &compute_path);
+        ~CullingStage();
+
+        CullingStage(const CullingStage &) = delete;
+        CullingStage &operator=(const CullingStage &) = delete;
+
+        // Needs GL 4.3 (compute shaders, storage buffers and indirect draws)
+        static bool supported();
+        bool initialized() const { return m_program != nullptr; }
+
+        // Hot reload of the compute shader, see common::ShaderProgram::reload_if_changed
+        bool reload_if_changed() { return initialized() && m_program->reload_if_changed(); }
+
+        void cull(const InstanceSource &source, int count, const glm::mat4 &projection_view, glm::vec3 camera_position, float lod_distance);
+
+        // Visible instances as four vec4s (position, forward, up, right) each, far ones as one vec4 position
+        GLuint visible_buffer() const { return m_visible_id; }
+        GLuint far_buffer() const { return m_far_id; }
+        GLuint command_buffer() const { return m_command_id; }
+
+    private:
+        std::unique_ptr<common::ShaderProgram> m_program;
+        GLuint m_visible_id{}, m_far_id{}, m_command_id{};
+    };
+}
+
+#endif //BOIDS_SIMULATION_BOIDS_CULLING_HPP
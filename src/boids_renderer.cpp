@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "boids_renderer.hpp"
+#include "boids_culling.hpp"
+#include "gl_debug.h"
+#include "cuda_runtime.h"
+#include "cuda_gl_interop.h"
+
+boids::BoidsRenderer::BoidsRenderer()
+: m_mesh(common::Mesh()) {
+    // Let a boid face the direction based on forward vector in lh
+    float vertices[] = {
+            0.3f,  0.f, -0.3f,
+            -0.3f, 0.f, -0.3f,
+            0.f, 0.f, 0.6f,
+            0.f, 0.3f, -0.3f
+    };
+
+    unsigned int indices[] = {
+            0, 1, 2,
+            0, 3, 2,
+            1, 2, 3,
+            0, 1, 3
+    };
+
+    m_mesh.set(vertices, sizeof(vertices), indices, sizeof(indices), 12);
+    m_culled_mesh.set(vertices, sizeof(vertices), indices, sizeof(indices), 12);
+    GLCall( glGenVertexArrays(1, &m_far_vao_id) );
+
+    m_mesh.bind();
+    GLCall( glGenBuffers(1, &m_pos_vbo_id) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_pos_vbo_id) );
+    GLCall( glEnableVertexAttribArray(1) );
+    GLCall( glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
+    GLCall( glVertexAttribDivisor(1, 1) );
+
+    GLCall( glGenBuffers(1, &m_forward_vbo_id) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_forward_vbo_id) );
+    GLCall( glEnableVertexAttribArray(2) );
+    GLCall( glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
+    GLCall( glVertexAttribDivisor(2, 1) );
+
+    GLCall( glGenBuffers(1, &m_up_vbo_id) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_up_vbo_id) );
+    GLCall( glEnableVertexAttribArray(3) );
+    GLCall( glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
+    GLCall( glVertexAttribDivisor(3, 1) );
+
+    GLCall( glGenBuffers(1, &m_right_vbo_id) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_right_vbo_id) );
+    GLCall( glEnableVertexAttribArray(4) );
+    GLCall( glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
+    GLCall( glVertexAttribDivisor(4, 1) );
+
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, 0) );
+    GLCall( glBindVertexArray(0) );
+
+    // Fallback for the packed instances if persistent mapping is not supported
+    GLCall( glGenBuffers(1, &m_instance_vbo_id) );
+
+    size_t instance_size = std::max(sizeof(PackedBoidInstance), sizeof(VelocityBoidInstance));
+    if (!m_stream.init(SimulationParameters::MAX_BOID_COUNT * instance_size)) {
+        std::cout << "[BoidsRenderer]: Persistent mapping not supported, CPU frames are uploaded with glBufferData" << std::endl;
+    }
+}
+
+void boids::BoidsRenderer::bind_packed_attributes(GLuint buffer, size_t offset) {
+    m_mesh.bind();
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, buffer) );
+    GLCall( glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(PackedBoidInstance), INT2VOIDP(offset + offsetof(PackedBoidInstance, position))) );
+    GLCall( glVertexAttribPointer(2, 4, GL_SHORT, GL_TRUE, sizeof(PackedBoidInstance), INT2VOIDP(offset + offsetof(PackedBoidInstance, orientation))) );
+    GLCall( glDisableVertexAttribArray(3) );
+    GLCall( glDisableVertexAttribArray(4) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, 0) );
+    GLCall( glBindVertexArray(0) );
+}
+
+void boids::BoidsRenderer::bind_velocity_attributes(GLuint buffer, size_t offset) {
+    // Same locations as the separate VBOs, boids.vert reads the velocity from a_boid_forward
+    m_mesh.bind();
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, buffer) );
+    GLCall( glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VelocityBoidInstance), INT2VOIDP(offset + offsetof(VelocityBoidInstance, position))) );
+    GLCall( glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(VelocityBoidInstance), INT2VOIDP(offset + offsetof(VelocityBoidInstance, velocity))) );
+    GLCall( glDisableVertexAttribArray(3) );
+    GLCall( glDisableVertexAttribArray(4) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, 0) );
+    GLCall( glBindVertexArray(0) );
+}
+
+void boids::BoidsRenderer::bind_vbo_attributes() {
+    GLuint vbos[] = { m_pos_vbo_id, m_forward_vbo_id, m_up_vbo_id, m_right_vbo_id };
+
+    m_mesh.bind();
+    for (GLuint attribute = 1; attribute <= 4; ++attribute) {
+        GLCall( glBindBuffer(GL_ARRAY_BUFFER, vbos[attribute - 1]) );
+        GLCall( glEnableVertexAttribArray(attribute) );
+        GLCall( glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
+    }
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, 0) );
+    GLCall( glBindVertexArray(0) );
+}
+
+void boids::BoidsRenderer::upload_instances(const void *data, size_t size, GLuint &buffer, size_t &offset) {
+    if (!m_stream.initialized()) {
+        GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_instance_vbo_id) );
+        GLCall( glBufferData(GL_ARRAY_BUFFER, size, data, GL_STREAM_DRAW) );
+        GLCall( glBindBuffer(GL_ARRAY_BUFFER, 0) );
+        buffer = m_instance_vbo_id;
+        offset = 0;
+        return;
+    }
+
+    // Written straight into the mapped segment, no reallocation and no driver side staging copy
+    std::memcpy(m_stream.begin_segment(), data, size);
+    buffer = m_stream.id();
+    offset = m_stream.segment_offset();
+}
+
+void boids::BoidsRenderer::stream_instances(const std::vector<PackedBoidInstance> &instances, int count) {
+    GLuint buffer;
+    size_t offset;
+    upload_instances(instances.data(), count * sizeof(PackedBoidInstance), buffer, offset);
+    bind_packed_attributes(buffer, offset);
+    m_instance_buffer = buffer;
+    m_instance_offset = offset;
+    m_format = InstanceFormat::Quaternion;
+}
+
+void boids::BoidsRenderer::stream_instances(const std::vector<VelocityBoidInstance> &instances, int count) {
+    GLuint buffer;
+    size_t offset;
+    upload_instances(instances.data(), count * sizeof(VelocityBoidInstance), buffer, offset);
+    bind_velocity_attributes(buffer, offset);
+    m_instance_buffer = buffer;
+    m_instance_offset = offset;
+    m_format = InstanceFormat::Velocity;
+}
+
+boids::InstanceSource boids::BoidsRenderer::instance_source(bool derive_orientation) const {
+    if (m_format == InstanceFormat::Basis) {
+        return { m_format, { m_pos_vbo_id, m_forward_vbo_id, m_up_vbo_id, m_right_vbo_id }, 0, derive_orientation };
+    }
+    return { m_format, { m_instance_buffer, 0, 0, 0 }, m_instance_offset, m_format == InstanceFormat::Velocity };
+}
+
+void boids::BoidsRenderer::set_vbos(const SimulationParameters& params, const std::vector<glm::vec4> &position, const boids::BoidsOrientation &orientation) {
+    set_vbos(params.boids_count, position.data(), orientation.forward.data(), orientation.up.data(), orientation.right.data());
+}
+
+void boids::BoidsRenderer::set_vbos(int count, const glm::vec4 *position, const glm::vec4 *forward, const glm::vec4 *up, const glm::vec4 *right) {
+    if (m_format != InstanceFormat::Basis) {
+        bind_vbo_attributes();
+        m_format = InstanceFormat::Basis;
+    }
+
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_pos_vbo_id) );
+    GLCall( glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec4), position, GL_DYNAMIC_DRAW));
+
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_forward_vbo_id) );
+    GLCall( glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec4), forward, GL_DYNAMIC_DRAW));
+
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_up_vbo_id) );
+    GLCall( glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec4), up, GL_DYNAMIC_DRAW));
+
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_right_vbo_id) );
+    GLCall( glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec4), right, GL_DYNAMIC_DRAW));
+}
+
+void boids::BoidsRenderer::cuda_register_vbos(cudaGraphicsResource** positions, cudaGraphicsResource** forward, cudaGraphicsResource** up, cudaGraphicsResource** right) const {
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_pos_vbo_id) );
+    cudaGraphicsGLRegisterBuffer(positions, m_pos_vbo_id, cudaGraphicsMapFlagsWriteDiscard);
+
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_forward_vbo_id) );
+    cudaGraphicsGLRegisterBuffer(forward, m_forward_vbo_id, cudaGraphicsMapFlagsWriteDiscard);
+
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_up_vbo_id) );
+    cudaGraphicsGLRegisterBuffer(up, m_up_vbo_id, cudaGraphicsMapFlagsWriteDiscard);
+
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_right_vbo_id) );
+    cudaGraphicsGLRegisterBuffer(right, m_right_vbo_id, cudaGraphicsMapFlagsWriteDiscard);
+}
+
+void boids::BoidsRenderer::draw(const common::ShaderProgram &shader_program, int count) {
+    shader_program.bind();
+    m_mesh.bind();
+    GLCall( glDrawElementsInstanced(GL_TRIANGLES, m_mesh.get_count(), GL_UNSIGNED_INT, nullptr, count) );
+
+    if (m_format != InstanceFormat::Basis && m_stream.initialized()) {
+        m_stream.end_segment();
+    }
+}
+
+void boids::BoidsRenderer::draw_sprites(common::ShaderProgram &sprite_program, int count) {
+    // A single vertex per instance, the sprite shader ignores the mesh and reads position and forward
+    sprite_program.set_uniform_1i("u_quaternion", m_format == InstanceFormat::Quaternion);
+    sprite_program.bind();
+    m_mesh.bind();
+    GLCall( glDrawArraysInstanced(GL_POINTS, 0, 1, count) );
+
+    if (m_format != InstanceFormat::Basis && m_stream.initialized()) {
+        m_stream.end_segment();
+    }
+}
+
+void boids::BoidsRenderer::draw_culled(
+        CullingStage &culling,
+        common::ShaderProgram &mesh_program,
+        const common::ShaderProgram &point_program,
+        int count,
+        const glm::mat4 &projection_view,
+        glm::vec3 camera_position,
+        float lod_distance,
+        bool derive_orientation
+) {
+    culling.cull(instance_source(derive_orientation), count, projection_view, camera_position, lod_distance);
+
+    // The culling stage already built the basis of every visible instance
+    m_culled_mesh.bind();
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, culling.visible_buffer()) );
+    for (GLuint attribute = 1; attribute <= 4; ++attribute) {
+        GLCall( glEnableVertexAttribArray(attribute) );
+        GLCall( glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(glm::vec4), INT2VOIDP((attribute - 1) * sizeof(glm::vec4))) );
+        GLCall( glVertexAttribDivisor(attribute, 1) );
+    }
+
+    mesh_program.set_uniform_1i("u_derive_orientation", 0);
+    mesh_program.bind();
+    GLCall( glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling.command_buffer()) );
+    GLCall( glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, INT2VOIDP(CullingStage::MESH_COMMAND_OFFSET)) );
+
+    GLCall( glBindVertexArray(m_far_vao_id) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, culling.far_buffer()) );
+    GLCall( glEnableVertexAttribArray(0) );
+    GLCall( glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0) );
+
+    point_program.bind();
+    GLCall( glDrawArraysIndirect(GL_POINTS, INT2VOIDP(CullingStage::POINT_COMMAND_OFFSET)) );
+
+    GLCall( glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, 0) );
+    GLCall( glBindVertexArray(0) );
+
+    if (m_format != InstanceFormat::Basis && m_stream.initialized()) {
+        m_stream.end_segment();
+    }
+}
+
+boids::ObstaclesRenderer::ObstaclesRenderer()
+: m_buffer(OBSTACLES_BINDING, sizeof(m_block)) {
+    m_buffer.update(m_block);
+}
+
+void boids::ObstaclesRenderer::draw(const common::ShaderProgram &program, const Obstacles &obstacles) {
+    std::array<glm::vec4, SimulationParameters::MAX_OBSTACLES_COUNT> block{};
+    for (size_t i = 0; i < obstacles.count(); ++i) {
+        block[i] = glm::vec4(obstacles.pos(i), obstacles.radius(i));
+    }
+    if (block != m_block) {
+        m_block = block;
+        m_buffer.update(m_block);
+    }
+
+    program.bind();
+    m_box.draw_instanced(program, obstacles.count());
+}
@@ -0,0 +1,108 @@
+#ifndef BOIDS_SIMULATION_BOIDS_RENDERER_HPP
+#define BOIDS_SIMULATION_BOIDS_RENDERER_HPP
+
+#include <GL/glew.h>
+#include <array>
+#include <cuda_runtime.h>
+#include <cuda_gl_interop.h>
+#include "boids.hpp"
+#include "primitives.h"
+#include "shader_program.hpp"
+#include "streaming_buffer.hpp"
+#include "uniform_buffer.hpp"
+
+namespace boids {
+    enum class InstanceFormat {
+        Basis,      // Separate position, forward, up and right VBOs (boids.vert)
+        Quaternion, // PackedBoidInstance (boids_packed.vert)
+        Velocity    // VelocityBoidInstance (boids.vert with u_derive_orientation)
+    };
+
+    // Where the current instance attributes live, for passes that read them outside the vertex shader
+    struct InstanceSource {
+        InstanceFormat format;
+        GLuint buffers[4];       // Position, forward, up and right VBOs, or the packed instances in buffers[0]
+        size_t offset;           // Byte offset of the packed instances
+        bool derive_orientation; // Forward holds the velocity
+    };
+
+    class CullingStage;
+
+    class BoidsRenderer {
+    public:
+        // Initializes boids data
+        BoidsRenderer();
+
+        void draw(const common::ShaderProgram &shader_program, int count);
+
+        // One oriented point sprite per boid (boids_sprite.vert), reads the instance attributes of any format
+        void draw_sprites(common::ShaderProgram &sprite_program, int count);
+        void set_vbos(const SimulationParameters &params, const std::vector<glm::vec4> &position, const BoidsOrientation &orientation);
+        void set_vbos(int count, const glm::vec4 *position, const glm::vec4 *forward, const glm::vec4 *up, const glm::vec4 *right);
+        void cuda_register_vbos(cudaGraphicsResource** positions, cudaGraphicsResource** forward, cudaGraphicsResource** up, cudaGraphicsResource** right) const;
+
+        // Per-frame upload of CPU solved boids through the persistently mapped ring,
+        // or with glBufferData if persistent mapping is not supported
+        void stream_instances(const std::vector<PackedBoidInstance> &instances, int count);
+        void stream_instances(const std::vector<VelocityBoidInstance> &instances, int count);
+
+        InstanceFormat instance_format() const { return m_format; }
+        InstanceSource instance_source(bool derive_orientation) const;
+
+        // Draws only the boids `culling` finds in the frustum, with `mesh_program` (boids.vert) near the camera
+        // and as points with `point_program` (boids_point.vert) beyond `lod_distance`
+        void draw_culled(
+                CullingStage &culling,
+                common::ShaderProgram &mesh_program,
+                const common::ShaderProgram &point_program,
+                int count,
+                const glm::mat4 &projection_view,
+                glm::vec3 camera_position,
+                float lod_distance,
+                bool derive_orientation
+        );
+
+    private:
+        // Copies `size` bytes into the next ring segment (or the fallback VBO), returns where they landed
+        void upload_instances(const void *data, size_t size, GLuint &buffer, size_t &offset);
+
+        // Points the instance attributes at instances at `offset` in `buffer`, or at the separate VBOs
+        void bind_packed_attributes(GLuint buffer, size_t offset);
+        void bind_velocity_attributes(GLuint buffer, size_t offset);
+        void bind_vbo_attributes();
+
+    private:
+        common::Mesh m_mesh;
+
+        // Same mesh, its instance attributes read the compacted output of the culling stage
+        common::Mesh m_culled_mesh;
+        GLuint m_far_vao_id;
+
+        GLuint m_pos_vbo_id, m_forward_vbo_id, m_up_vbo_id, m_right_vbo_id;
+        GLuint m_instance_vbo_id;
+        GLuint m_instance_buffer{};
+        size_t m_instance_offset{};
+
+        common::StreamingBuffer m_stream;
+        InstanceFormat m_format = InstanceFormat::Basis;
+    };
+
+    class ObstaclesRenderer {
+    public:
+        constexpr static const GLuint OBSTACLES_BINDING = 1;
+
+        ObstaclesRenderer();
+
+        // The program has to bind its `Obstacles` block to OBSTACLES_BINDING
+        void draw(const common::ShaderProgram& program, const Obstacles& obstacles);
+
+    private:
+        common::Box m_box;
+
+        // Mirrors the std140 `Obstacles` block, xyz position and w radius, uploaded only when it changes
+        std::array<glm::vec4, SimulationParameters::MAX_OBSTACLES_COUNT> m_block{};
+        common::UniformBuffer m_buffer;
+    };
+}
+
+#endif //BOIDS_SIMULATION_BOIDS_RENDERER_HPP
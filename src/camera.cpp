@@ -2,6 +2,14 @@
 #include <glm/gtx/transform.hpp>
 #include <algorithm>
 
+common::CameraBlock::CameraBlock(const ICamera &camera, float screen_width, float screen_height)
+: projection_view(camera.get_proj() * camera.get_view()),
+  position(glm::inverse(camera.get_view())[3]),
+  viewport(screen_width, screen_height),
+  focal_scale(camera.get_proj()[1][1]),
+  padding(0.f) {
+}
+
 common::OrbitingCamera::OrbitingCamera(glm::vec3 center, float screen_width, float screen_height)
 : m_center(center), m_radius(30.), m_polar_angle(glm::radians(30.)), m_azimuthal_angle(30.) {
     m_proj_mat = glm::perspectiveLH(
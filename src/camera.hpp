@@ -11,6 +11,20 @@ namespace common {
         virtual void set_screen_size(float screen_width, float screen_height) = 0;
     };
 
+    // Per frame camera data shared by all programs, mirrors the std140 `Camera` block of the shaders
+    struct CameraBlock {
+        constexpr static const unsigned int BINDING = 0;
+
+        glm::mat4 projection_view;
+        glm::vec4 position;    // w unused
+        glm::vec2 viewport;    // pixels
+        float focal_scale;     // projection[1][1]
+        float padding;
+
+        CameraBlock(const ICamera &camera, float screen_width, float screen_height);
+    };
+    static_assert(sizeof(CameraBlock) == 96, "CameraBlock must match the std140 layout of the Camera block");
+
     class OrbitingCamera : public ICamera {
     public:
         OrbitingCamera() = delete;
@@ -0,0 +1,276 @@
+#include "density_field.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <glm/gtc/packing.hpp>
+
+namespace {
+    const char FIELD_MAGIC[8] = { 'B', 'O', 'I', 'D', 'S', 'F', 'L', 'D' };
+    const uint32_t FIELD_VERSION = 1;
+
+    // Fewer boids than this per chunk do not pay for clearing and summing another private grid
+    const uint32_t MIN_CHUNK_SIZE = 4096;
+    // Bounds the memory of the private grids, 50000 boids make 12 chunks
+    const uint32_t MAX_CHUNK_COUNT = 16;
+
+    // Largest finite half float, larger values would be stored as infinity
+    const float HALF_MAX = 65504.f;
+
+    uint16_t pack_half(float value) {
+        return glm::packHalf1x16(glm::clamp(value, -HALF_MAX, HALF_MAX));
+    }
+}
+
+const boids::cpu::DensityField &boids::cpu::FieldRasterizer::rasterize(
+        const SimulationParameters &sim_params,
+        const FieldSettings &settings,
+        const std::vector<glm::vec4> &position,
+        const std::vector<glm::vec3> &velocity,
+        uint64_t step
+) {
+    DensityField &field = m_field;
+    field.step = step;
+    field.resolution = glm::clamp(settings.resolution, glm::ivec3(1), glm::ivec3(FieldSettings::MAX_RESOLUTION));
+    field.origin = -sim_params.aquarium_size / 2.f;
+    field.cell_size = sim_params.aquarium_size / glm::vec3(field.resolution);
+    size_t cell_count = field.cell_count();
+
+    uint32_t count = uint32_t(sim_params.boids_count);
+    uint32_t chunk_count = settings.execution == Execution::Parallel ? std::clamp(count / MIN_CHUNK_SIZE, 1u, MAX_CHUNK_COUNT) : 1u;
+    uint32_t chunk_size = (count + chunk_count - 1) / chunk_count;
+
+    m_private.resize(chunk_count);
+
+    bool periodic = sim_params.periodic();
+    bool open = sim_params.boundary_mode == BoundaryMode::Open;
+    glm::ivec3 last_cell = field.resolution - 1;
+
+    IndexRange<uint32_t> chunks = indices(chunk_count);
+    boids::for_each(settings.execution, chunks.begin(), chunks.end(), [&](uint32_t chunk) {
+        std::vector<glm::vec4> &grid = m_private[chunk];
+        grid.assign(cell_count, glm::vec4(0.f));
+
+        uint32_t end = std::min(count, (chunk + 1) * chunk_size);
+        for (uint32_t b_id = chunk * chunk_size; b_id < end; ++b_id) {
+            glm::vec3 cell_position = (glm::vec3(position[b_id]) - field.origin) / field.cell_size;
+            if (open && (glm::any(glm::lessThan(cell_position, glm::vec3(0.f))) ||
+                         glm::any(glm::greaterThanEqual(cell_position, glm::vec3(field.resolution))))) {
+                continue;
+            }
+
+            // Lower of the two cell centres around the boid on each axis and the weight of the upper one
+            glm::vec3 centered = cell_position - 0.5f;
+            glm::ivec3 lower = glm::ivec3(glm::floor(centered));
+            glm::vec3 upper_weight = centered - glm::vec3(lower);
+            glm::vec4 momentum = glm::vec4(velocity[b_id], 1.f);
+
+            for (int corner = 0; corner < 8; ++corner) {
+                glm::ivec3 offset(corner & 1, (corner >> 1) & 1, corner >> 2);
+                glm::ivec3 cell = lower + offset;
+                glm::vec3 axis_weight = glm::mix(1.f - upper_weight, upper_weight, glm::vec3(offset));
+                float weight = axis_weight.x * axis_weight.y * axis_weight.z;
+
+                cell = periodic
+                        ? (cell % field.resolution + field.resolution) % field.resolution
+                        : glm::clamp(cell, glm::ivec3(0), last_cell);
+                grid[field.index(cell)] += weight * momentum;
+            }
+        }
+    });
+
+    // Chunks are summed in a fixed order
+    field.density.resize(cell_count);
+    field.velocity.resize(cell_count);
+    float cell_volume = field.cell_size.x * field.cell_size.y * field.cell_size.z;
+
+    IndexRange<uint32_t> cells = indices(uint32_t(cell_count));
+    boids::for_each(settings.execution, cells.begin(), cells.end(), [&](uint32_t cell) {
+        glm::vec4 sum(0.f);
+        for (const std::vector<glm::vec4> &grid : m_private) {
+            sum += grid[cell];
+        }
+        field.density[cell] = sum.w / cell_volume;
+        field.velocity[cell] = sum.w > 0.f ? glm::vec3(sum) / sum.w : glm::vec3(0.f);
+    });
+
+    return field;
+}
+
+boids::cpu::FieldStreamWriter::FieldStreamWriter(const std::string &path) {
+    m_file = std::fopen(path.c_str(), "wb");
+    if (!m_file) {
+        std::cerr << "[Fields]: Cannot open " << path << " for writing" << std::endl;
+    }
+}
+
+boids::cpu::FieldStreamWriter::~FieldStreamWriter() {
+    if (m_file) {
+        std::fclose(m_file);
+    }
+}
+
+void boids::cpu::FieldStreamWriter::write(const DensityField &field) {
+    if (!m_file) {
+        return;
+    }
+
+    if (!m_header_written) {
+        m_header_written = true;
+        m_resolution = field.resolution;
+        std::fwrite(FIELD_MAGIC, 1, sizeof(FIELD_MAGIC), m_file);
+        std::fwrite(&FIELD_VERSION, sizeof(FIELD_VERSION), 1, m_file);
+        std::fwrite(&field.resolution, sizeof(field.resolution), 1, m_file);
+        std::fwrite(&field.origin, sizeof(field.origin), 1, m_file);
+        std::fwrite(&field.cell_size, sizeof(field.cell_size), 1, m_file);
+    }
+    if (field.resolution != m_resolution) {
+        std::cerr << "[Fields]: Skipping step " << field.step << ", the field resolution changed" << std::endl;
+        return;
+    }
+
+    m_runs.clear();
+    m_cells.clear();
+    size_t cell_count = field.cell_count();
+    for (size_t cell = 0; cell < cell_count;) {
+        size_t run_start = cell;
+        while (cell < cell_count && field.density[cell] == 0.f) {
+            ++cell;
+        }
+        size_t occupied_start = cell;
+        while (cell < cell_count && field.density[cell] != 0.f) {
+            m_cells.push_back(pack_half(field.density[cell]));
+            m_cells.push_back(pack_half(field.velocity[cell].x));
+            m_cells.push_back(pack_half(field.velocity[cell].y));
+            m_cells.push_back(pack_half(field.velocity[cell].z));
+            ++cell;
+        }
+        m_runs.push_back(uint32_t(occupied_start - run_start));
+        m_runs.push_back(uint32_t(cell - occupied_start));
+    }
+
+    uint32_t run_count = uint32_t(m_runs.size() / 2);
+    std::fwrite(&field.step, sizeof(field.step), 1, m_file);
+    std::fwrite(&run_count, sizeof(run_count), 1, m_file);
+    std::fwrite(m_runs.data(), sizeof(uint32_t), m_runs.size(), m_file);
+    std::fwrite(m_cells.data(), sizeof(uint16_t), m_cells.size(), m_file);
+}
+
+boids::cpu::FieldStreamReader::FieldStreamReader(const std::string &path) {
+    m_file = std::fopen(path.c_str(), "rb");
+    if (!m_file) {
+        std::cerr << "[Fields]: Cannot open " << path << std::endl;
+        return;
+    }
+
+    char magic[sizeof(FIELD_MAGIC)];
+    uint32_t version = 0;
+    bool valid = std::fread(magic, 1, sizeof(magic), m_file) == sizeof(magic) &&
+                 std::memcmp(magic, FIELD_MAGIC, sizeof(magic)) == 0 &&
+                 std::fread(&version, sizeof(version), 1, m_file) == 1 && version == FIELD_VERSION &&
+                 std::fread(&m_layout.resolution, sizeof(m_layout.resolution), 1, m_file) == 1 &&
+                 std::fread(&m_layout.origin, sizeof(m_layout.origin), 1, m_file) == 1 &&
+                 std::fread(&m_layout.cell_size, sizeof(m_layout.cell_size), 1, m_file) == 1 &&
+                 glm::all(glm::greaterThan(m_layout.resolution, glm::ivec3(0))) &&
+                 glm::all(glm::lessThanEqual(m_layout.resolution, glm::ivec3(FieldSettings::MAX_RESOLUTION)));
+    if (!valid) {
+        std::cerr << "[Fields]: " << path << " is not a field stream" << std::endl;
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+boids::cpu::FieldStreamReader::~FieldStreamReader() {
+    if (m_file) {
+        std::fclose(m_file);
+    }
+}
+
+bool boids::cpu::FieldStreamReader::read(DensityField &field) {
+    uint32_t run_count = 0;
+    if (!m_file || std::fread(&field.step, sizeof(field.step), 1, m_file) != 1 || std::fread(&run_count, sizeof(run_count), 1, m_file) != 1) {
+        return false;
+    }
+
+    // Every run covers at least one cell, so a larger count is corrupt and must not size the allocation
+    size_t cell_count = m_layout.cell_count();
+    if (run_count > cell_count) {
+        std::cerr << "[Fields]: Corrupted field of step " << field.step << std::endl;
+        return false;
+    }
+
+    m_runs.resize(2 * size_t(run_count));
+    if (std::fread(m_runs.data(), sizeof(uint32_t), m_runs.size(), m_file) != m_runs.size()) {
+        return false;
+    }
+
+    field.resolution = m_layout.resolution;
+    field.origin = m_layout.origin;
+    field.cell_size = m_layout.cell_size;
+    field.density.assign(cell_count, 0.f);
+    field.velocity.assign(cell_count, glm::vec3(0.f));
+
+    size_t cell = 0;
+    for (uint32_t run = 0; run < run_count; ++run) {
+        cell += m_runs[2 * run];
+        uint32_t occupied = m_runs[2 * run + 1];
+        if (cell + occupied > cell_count) {
+            std::cerr << "[Fields]: Corrupted field of step " << field.step << std::endl;
+            return false;
+        }
+
+        m_cells.resize(4 * size_t(occupied));
+        if (std::fread(m_cells.data(), sizeof(uint16_t), m_cells.size(), m_file) != m_cells.size()) {
+            return false;
+        }
+        for (uint32_t i = 0; i < occupied; ++i, ++cell) {
+            field.density[cell] = glm::unpackHalf1x16(m_cells[4 * i]);
+            field.velocity[cell] = glm::vec3(
+                    glm::unpackHalf1x16(m_cells[4 * i + 1]),
+                    glm::unpackHalf1x16(m_cells[4 * i + 2]),
+                    glm::unpackHalf1x16(m_cells[4 * i + 3])
+            );
+        }
+    }
+    return true;
+}
+
+bool boids::cpu::write_density_heatmap(const DensityField &field, const std::string &path, int scale, float max_column) {
+    glm::ivec3 resolution = field.resolution;
+    std::vector<float> column(size_t(resolution.x) * resolution.z, 0.f);
+    for (int z = 0; z < resolution.z; ++z) {
+        for (int y = 0; y < resolution.y; ++y) {
+            for (int x = 0; x < resolution.x; ++x) {
+                column[size_t(z) * resolution.x + x] += field.density[field.index({ x, y, z })] * field.cell_size.y;
+            }
+        }
+    }
+    if (max_column <= 0.f) {
+        max_column = std::max(*std::max_element(column.begin(), column.end()), 1e-6f);
+    }
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "[Fields]: Cannot write " << path << std::endl;
+        return false;
+    }
+
+    scale = std::max(scale, 1);
+    int width = resolution.x * scale;
+    int height = resolution.z * scale;
+    std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+
+    std::vector<uint8_t> row(3 * size_t(width));
+    for (int py = 0; py < height; ++py) {
+        for (int px = 0; px < width; ++px) {
+            // Black through red and yellow to white
+            float t = std::sqrt(column[size_t(py / scale) * resolution.x + px / scale] / max_column);
+            glm::vec3 color = glm::clamp(glm::vec3(3.f * t, 3.f * t - 1.f, 3.f * t - 2.f), 0.f, 1.f);
+            row[3 * px] = uint8_t(color.r * 255.f);
+            row[3 * px + 1] = uint8_t(color.g * 255.f);
+            row[3 * px + 2] = uint8_t(color.b * 255.f);
+        }
+        std::fwrite(row.data(), 1, row.size(), file);
+    }
+    std::fclose(file);
+    return true;
+}
@@ -0,0 +1,118 @@
+#ifndef BOIDS_SIMULATION_DENSITY_FIELD_HPP
+#define BOIDS_SIMULATION_DENSITY_FIELD_HPP
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "boids.hpp"
+#include "execution.hpp"
+
+namespace boids::cpu {
+    struct FieldSettings {
+        // Cells per axis, also the largest a field stream may declare
+        constexpr static const int MAX_RESOLUTION = 256;
+
+        bool enabled = false;
+
+        // Fields are rasterized on every n-th step only
+        int sample_every = 1;
+
+        // Cells per axis over the aquarium, clamped to [1, MAX_RESOLUTION]
+        glm::ivec3 resolution = glm::ivec3(32);
+
+        // Every field is appended to this stream if it is not empty, see FieldStreamWriter
+        std::string output_path;
+
+        Execution execution = Execution::Parallel;
+    };
+
+    // Density (boids per unit volume) and mean velocity sampled at cell centres, x runs fastest
+    struct DensityField {
+        uint64_t step{};
+        glm::ivec3 resolution{};
+        glm::vec3 origin{};
+        glm::vec3 cell_size{};
+        std::vector<float> density;
+        std::vector<glm::vec3> velocity;
+
+        size_t cell_count() const { return size_t(resolution.x) * resolution.y * resolution.z; }
+        size_t index(glm::ivec3 cell) const { return (size_t(cell.z) * resolution.y + cell.y) * resolution.x + cell.x; }
+    };
+
+    // Splats boids onto a coarse grid over the aquarium with cloud-in-cell weights: every boid spreads over the
+    // 8 cell centres around it, trilinearly. In parallel, boids are split into chunks of a fixed size rasterized into
+    // private grids, which are then summed per cell, so the result depends neither on thread scheduling nor on the
+    // number of cores. Sequential execution rasterizes into a single grid.
+    // The periodic boundary wraps the weights around, otherwise they are clamped to the border cells and boids
+    // of the open world outside the aquarium are left out.
+    class FieldRasterizer {
+    public:
+        const DensityField &rasterize(
+                const SimulationParameters &sim_params,
+                const FieldSettings &settings,
+                const std::vector<glm::vec4> &position,
+                const std::vector<glm::vec3> &velocity,
+                uint64_t step
+        );
+
+        const DensityField &field() const { return m_field; }
+
+    private:
+        DensityField m_field;
+
+        // Per chunk momentum (xyz) and weight (w)
+        std::vector<std::vector<glm::vec4>> m_private;
+    };
+
+    // Long runs: "BOIDSFLD", version, resolution, origin and cell size, then per field the step, the runs of
+    // occupied cells as (empty cells skipped, occupied cells) pairs and the occupied cells as half floats
+    // (density, velocity xyz), clamped to the largest finite half. Empty cells, usually most of the aquarium,
+    // take no space.
+    class FieldStreamWriter {
+    public:
+        FieldStreamWriter(const std::string &path);
+        ~FieldStreamWriter();
+
+        FieldStreamWriter(const FieldStreamWriter &) = delete;
+        FieldStreamWriter &operator=(const FieldStreamWriter &) = delete;
+
+        // The layout of the grid is fixed by the first field, others are skipped
+        void write(const DensityField &field);
+
+        bool is_valid() const { return m_file != nullptr; }
+
+    private:
+        FILE *m_file{};
+        bool m_header_written{};
+        glm::ivec3 m_resolution{};
+        std::vector<uint32_t> m_runs;
+        std::vector<uint16_t> m_cells;
+    };
+
+    class FieldStreamReader {
+    public:
+        FieldStreamReader(const std::string &path);
+        ~FieldStreamReader();
+
+        FieldStreamReader(const FieldStreamReader &) = delete;
+        FieldStreamReader &operator=(const FieldStreamReader &) = delete;
+
+        // Reads the next field, false at the end of the stream
+        bool read(DensityField &field);
+
+        bool is_valid() const { return m_file != nullptr; }
+
+    private:
+        FILE *m_file{};
+        DensityField m_layout;
+        std::vector<uint32_t> m_runs;
+        std::vector<uint16_t> m_cells;
+    };
+
+    // Column density seen from above (boids per unit area, summed along y) as a heatmap PPM with `scale` pixels
+    // per cell. `max_column` maps to white, 0 normalizes by the densest column of the field.
+    bool write_density_heatmap(const DensityField &field, const std::string &path, int scale = 8, float max_column = 0.f);
+}
+
+#endif //BOIDS_SIMULATION_DENSITY_FIELD_HPP
@@ -0,0 +1,90 @@
+#ifndef BOIDS_SIMULATION_EXECUTION_HPP
+#define BOIDS_SIMULATION_EXECUTION_HPP
+#include <algorithm>
+#include <cstddef>
+#include <execution>
+#include <iterator>
+#include <numeric>
+
+namespace boids {
+    // Parallel spreads per-boid phases over all cores. Sequential keeps a whole simulation on the calling
+    // thread, for many independent simulations run side by side (see ParameterSweep).
+    enum class Execution {
+        Parallel,
+        Sequential
+    };
+
+    // Random access iterator over consecutive indices, dereferencing to the index itself. Parallel loops over
+    // boids, cells or worlds iterate these instead of a vector filled with 0, 1, 2, ...
+    template<typename Index>
+    class CountingIterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = Index;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Index;
+
+        CountingIterator() = default;
+        explicit CountingIterator(Index index) : m_index(index) {}
+
+        Index operator*() const { return m_index; }
+        Index operator[](difference_type n) const { return Index(m_index + n); }
+
+        CountingIterator &operator++() { ++m_index; return *this; }
+        CountingIterator operator++(int) { CountingIterator it = *this; ++m_index; return it; }
+        CountingIterator &operator--() { --m_index; return *this; }
+        CountingIterator operator--(int) { CountingIterator it = *this; --m_index; return it; }
+
+        CountingIterator &operator+=(difference_type n) { m_index = Index(m_index + n); return *this; }
+        CountingIterator &operator-=(difference_type n) { m_index = Index(m_index - n); return *this; }
+        CountingIterator operator+(difference_type n) const { return CountingIterator(Index(m_index + n)); }
+        CountingIterator operator-(difference_type n) const { return CountingIterator(Index(m_index - n)); }
+        friend CountingIterator operator+(difference_type n, CountingIterator it) { return it + n; }
+        difference_type operator-(CountingIterator other) const { return difference_type(m_index) - difference_type(other.m_index); }
+
+        bool operator==(CountingIterator other) const { return m_index == other.m_index; }
+        bool operator!=(CountingIterator other) const { return m_index != other.m_index; }
+        bool operator<(CountingIterator other) const { return m_index < other.m_index; }
+        bool operator>(CountingIterator other) const { return m_index > other.m_index; }
+        bool operator<=(CountingIterator other) const { return m_index <= other.m_index; }
+        bool operator>=(CountingIterator other) const { return m_index >= other.m_index; }
+
+    private:
+        Index m_index{};
+    };
+
+    template<typename Index>
+    struct IndexRange {
+        CountingIterator<Index> first;
+        CountingIterator<Index> last;
+
+        CountingIterator<Index> begin() const { return first; }
+        CountingIterator<Index> end() const { return last; }
+    };
+
+    // 0, 1, ..., count - 1
+    template<typename Index>
+    IndexRange<Index> indices(Index count) {
+        return { CountingIterator<Index>(0), CountingIterator<Index>(count) };
+    }
+
+    template<typename Iterator, typename Function>
+    void for_each(Execution execution, Iterator first, Iterator last, Function function) {
+        if (execution == Execution::Parallel) {
+            std::for_each(std::execution::par, first, last, function);
+        } else {
+            std::for_each(first, last, function);
+        }
+    }
+
+    template<typename Iterator, typename T, typename Reduce, typename Transform>
+    T transform_reduce(Execution execution, Iterator first, Iterator last, T init, Reduce reduce, Transform transform) {
+        if (execution == Execution::Parallel) {
+            return std::transform_reduce(std::execution::par, first, last, init, reduce, transform);
+        }
+        return std::transform_reduce(first, last, init, reduce, transform);
+    }
+}
+
+#endif //BOIDS_SIMULATION_EXECUTION_HPP
@@ -0,0 +1,283 @@
+#include "flock_analytics.hpp"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+const boids::cpu::FlockMetrics &boids::cpu::FlockAnalytics::compute(
+        const SimulationParameters &sim_params,
+        SpatialGrid &grid,
+        const std::vector<glm::vec4> &position,
+        const std::vector<glm::vec3> &velocity,
+        uint64_t step
+) {
+    auto start_time = std::chrono::steady_clock::now();
+    uint32_t count = uint32_t(sim_params.boids_count);
+
+    FlockMetrics &metrics = m_metrics;
+    metrics.step = step;
+
+    IndexRange<uint32_t> ids = indices(count);
+
+    // Order parameters
+    glm::vec3 heading_sum = boids::transform_reduce(m_settings.execution, ids.begin(), ids.end(), glm::vec3(0.f), std::plus<>(),
+        [&](uint32_t id) {
+            float speed = glm::length(velocity[id]);
+            return speed > 0.f ? velocity[id] / speed : glm::vec3(0.f);
+        });
+    glm::vec3 center = boids::transform_reduce(m_settings.execution, ids.begin(), ids.end(), glm::vec3(0.f), std::plus<>(),
+        [&](uint32_t id) { return glm::vec3(position[id]); }) / float(std::max(count, 1u));
+    glm::vec3 rotation_sum = boids::transform_reduce(m_settings.execution, ids.begin(), ids.end(), glm::vec3(0.f), std::plus<>(),
+        [&](uint32_t id) {
+            glm::vec3 radius = glm::vec3(position[id]) - center;
+            float radius_length = glm::length(radius);
+            float speed = glm::length(velocity[id]);
+            return radius_length > 0.f && speed > 0.f ? glm::cross(radius / radius_length, velocity[id] / speed) : glm::vec3(0.f);
+        });
+    metrics.polarization = glm::length(heading_sum) / float(std::max(count, 1u));
+    metrics.milling = glm::length(rotation_sum) / float(std::max(count, 1u));
+
+    // The grid of the last step was built on the previous positions and the view radius
+    float link_distance = m_settings.link_distance > 0.f ? m_settings.link_distance : sim_params.distance;
+    SimulationParameters grid_params = sim_params;
+    grid_params.distance = link_distance;
+    // Halved cells fit within the link distance, see find_clusters
+    grid_params.grid_subdivision = std::max(grid_params.grid_subdivision, 2);
+    grid_params.max_neighbors = 0;
+    grid.build(grid_params, position, velocity);
+
+    // Flocks
+    find_clusters(grid, position, link_distance, count);
+
+    m_cluster_size.assign(count, 0);
+    for (uint32_t id = 0; id < count; ++id) {
+        ++m_cluster_size[m_parent[id].load(std::memory_order_relaxed)];
+    }
+    metrics.cluster_count = 0;
+    metrics.largest_cluster = 0;
+    for (uint32_t size : m_cluster_size) {
+        metrics.cluster_count += size > 0;
+        metrics.largest_cluster = std::max(metrics.largest_cluster, size);
+    }
+    metrics.mean_cluster_size = metrics.cluster_count > 0 ? float(count) / float(metrics.cluster_count) : 0.f;
+
+    // Nearest neighbour distances of evenly spaced boids, negative for a boid without neighbours
+    uint32_t stride = m_settings.nn_samples > 0 ? std::max(count / uint32_t(m_settings.nn_samples), 1u) : 1u;
+    m_nn_distance.resize((count + stride - 1) / stride);
+    boids::for_each(m_settings.execution, ids.begin(), ids.begin() + m_nn_distance.size(), [&](uint32_t sample) {
+        BoidNeighbor nearest;
+        m_nn_distance[sample] = grid.find_k_nearest(position, sample * stride, 1, &nearest) > 0 ? std::sqrt(nearest.distance2) : -1.f;
+    });
+
+    int bins = std::max(m_settings.histogram_bins, 1);
+    metrics.histogram_max = m_settings.histogram_max > 0.f ? m_settings.histogram_max : sim_params.distance;
+    metrics.nn_histogram.assign(bins, 0);
+
+    double nn_sum = 0.;
+    uint32_t nn_count = 0;
+    for (float distance : m_nn_distance) {
+        if (distance < 0.f) {
+            continue;
+        }
+        int bin = std::min(int(distance / metrics.histogram_max * float(bins)), bins - 1);
+        ++metrics.nn_histogram[bin];
+        nn_sum += distance;
+        ++nn_count;
+    }
+    metrics.mean_nn_distance = nn_count > 0 ? float(nn_sum / nn_count) : 0.f;
+
+    std::chrono::duration<float, std::milli> compute_time = std::chrono::steady_clock::now() - start_time;
+    metrics.compute_time_ms = compute_time.count();
+
+    return metrics;
+}
+
+void boids::cpu::FlockAnalytics::find_clusters(const SpatialGrid &grid, const std::vector<glm::vec4> &position, float link_distance, uint32_t count) {
+    if (m_parent_capacity < count) {
+        m_parent = std::make_unique<std::atomic<uint32_t>[]>(count);
+        m_parent_capacity = count;
+    }
+    for (uint32_t id = 0; id < count; ++id) {
+        m_parent[id].store(id, std::memory_order_relaxed);
+    }
+
+    float link_distance2 = link_distance * link_distance;
+    bool per_boid_images = grid.window_wraps(grid.search_range());
+    const std::vector<BoidId> &sorted_ids = grid.sorted_ids();
+    IndexRange<uint32_t> ids = indices(count);
+
+    // Boids sharing a cell whose diagonal fits within the link distance are linked to each other. Such cells
+    // then join through any single pair of their boids, the remaining pairs need no scan.
+    glm::vec3 cell_size = grid.cell_size();
+    bool linked_cells = glm::dot(cell_size, cell_size) <= link_distance2;
+
+    // Links the boids of `cell` to those of `other`, the image of `other` at `other_coords` is taken for the distances
+    auto link_cells = [&](CellId cell, CellId other, glm::ivec3 other_coords) {
+        glm::vec3 image_offset = grid.image_offset(other_coords);
+        for (uint32_t i = grid.cell_start(cell); i < grid.cell_end(cell); ++i) {
+            BoidId b_id = sorted_ids[i];
+            glm::vec3 pos = glm::vec3(position[b_id]);
+            uint32_t first = cell == other ? i + 1 : grid.cell_start(other);
+            for (uint32_t k = first; k < grid.cell_end(other); ++k) {
+                BoidId other_id = sorted_ids[k];
+                glm::vec3 diff = per_boid_images
+                        ? grid.offset(pos, glm::vec3(position[other_id]))
+                        : glm::vec3(position[other_id]) + image_offset - pos;
+                if (glm::dot(diff, diff) <= link_distance2) {
+                    unite(b_id, other_id);
+                    if (linked_cells) {
+                        return;
+                    }
+                }
+            }
+        }
+    };
+
+    // The first boid of every occupied cell handles the cell
+    boids::for_each(m_settings.execution, ids.begin(), ids.end(), [&](BoidId b_id) {
+        glm::ivec3 cell_coords = grid.get_cell_coords(glm::vec3(position[b_id]));
+        CellId cell = grid.flatten_coords(cell_coords);
+        if (sorted_ids[grid.cell_start(cell)] != b_id) {
+            return;
+        }
+
+        if (linked_cells) {
+            for (uint32_t i = grid.cell_start(cell) + 1; i < grid.cell_end(cell); ++i) {
+                unite(b_id, sorted_ids[i]);
+            }
+        } else {
+            link_cells(cell, cell, cell_coords);
+        }
+
+        // Only the forward half of the window, the other half visits this cell from its own side
+        glm::ivec3 start, end;
+        grid.search_window(cell_coords, grid.search_range(), start, end);
+        for (int z = cell_coords.z; z <= end.z; ++z) {
+            for (int y = z == cell_coords.z ? cell_coords.y : start.y; y <= end.y; ++y) {
+                for (int x = z == cell_coords.z && y == cell_coords.y ? cell_coords.x + 1 : start.x; x <= end.x; ++x) {
+                    glm::ivec3 coords(x, y, z);
+
+                    // Gap between the two cells
+                    glm::vec3 gap = glm::vec3(glm::max(glm::abs(coords - cell_coords) - 1, 0)) * cell_size;
+                    if (glm::dot(gap, gap) > link_distance2) {
+                        continue;
+                    }
+
+                    CellId other = grid.flatten_coords(grid.wrap_coords(coords));
+                    if (grid.cell_start(other) == grid.cell_end(other)) {
+                        continue;
+                    }
+                    if (linked_cells && find_root(b_id) == find_root(sorted_ids[grid.cell_start(other)])) {
+                        continue;
+                    }
+
+                    link_cells(cell, other, coords);
+                }
+            }
+        }
+    });
+
+    // Points every boid straight at its root
+    boids::for_each(m_settings.execution, ids.begin(), ids.end(), [&](uint32_t id) {
+        m_parent[id].store(find_root(id), std::memory_order_relaxed);
+    });
+}
+
+uint32_t boids::cpu::FlockAnalytics::find_root(uint32_t id) {
+    // Path halving, a failed exchange only means another thread already shortened the path
+    while (true) {
+        uint32_t parent = m_parent[id].load(std::memory_order_relaxed);
+        if (parent == id) {
+            return id;
+        }
+        uint32_t grandparent = m_parent[parent].load(std::memory_order_relaxed);
+        m_parent[id].compare_exchange_weak(parent, grandparent, std::memory_order_relaxed);
+        id = grandparent;
+    }
+}
+
+void boids::cpu::FlockAnalytics::unite(uint32_t a, uint32_t b) {
+    // Roots are only ever linked below a smaller root, so no cycle can form
+    while (true) {
+        a = find_root(a);
+        b = find_root(b);
+        if (a == b) {
+            return;
+        }
+        if (a < b) {
+            std::swap(a, b);
+        }
+        uint32_t expected = a;
+        if (m_parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+boids::cpu::MetricsWriter::MetricsWriter(const std::string &path, MetricsFormat format)
+: m_format(format) {
+    m_file = std::fopen(path.c_str(), format == MetricsFormat::Csv ? "w" : "wb");
+    if (!m_file) {
+        std::cerr << "[Analytics]: Cannot open " << path << " for writing" << std::endl;
+    }
+}
+
+boids::cpu::MetricsWriter::~MetricsWriter() {
+    if (m_file) {
+        std::fclose(m_file);
+    }
+}
+
+void boids::cpu::MetricsWriter::write_header(size_t bins) {
+    m_bins = bins;
+    m_header_written = true;
+
+    if (m_format == MetricsFormat::Csv) {
+        std::fprintf(m_file, "step,polarization,milling,cluster_count,largest_cluster,mean_cluster_size,mean_nn_distance,histogram_max,compute_time_ms");
+        for (size_t i = 0; i < bins; ++i) {
+            std::fprintf(m_file, ",nn_bin_%zu", i);
+        }
+        std::fprintf(m_file, "\n");
+    } else {
+        uint32_t version = 1;
+        uint32_t bin_count = uint32_t(bins);
+        std::fwrite("BOIDSMET", 1, 8, m_file);
+        std::fwrite(&version, sizeof(version), 1, m_file);
+        std::fwrite(&bin_count, sizeof(bin_count), 1, m_file);
+    }
+}
+
+void boids::cpu::MetricsWriter::write(const FlockMetrics &metrics) {
+    if (!m_file) {
+        return;
+    }
+    if (!m_header_written) {
+        write_header(metrics.nn_histogram.size());
+    }
+    if (metrics.nn_histogram.size() != m_bins) {
+        std::cerr << "[Analytics]: Skipping step " << metrics.step << ", the histogram bin count changed" << std::endl;
+        return;
+    }
+
+    if (m_format == MetricsFormat::Csv) {
+        std::fprintf(m_file, "%llu,%.6f,%.6f,%u,%u,%.3f,%.6f,%.6f,%.4f",
+                     static_cast<unsigned long long>(metrics.step), metrics.polarization, metrics.milling,
+                     metrics.cluster_count, metrics.largest_cluster, metrics.mean_cluster_size,
+                     metrics.mean_nn_distance, metrics.histogram_max, metrics.compute_time_ms);
+        for (uint32_t bin : metrics.nn_histogram) {
+            std::fprintf(m_file, ",%u", bin);
+        }
+        std::fprintf(m_file, "\n");
+    } else {
+        std::fwrite(&metrics.step, sizeof(metrics.step), 1, m_file);
+        std::fwrite(&metrics.polarization, sizeof(float), 1, m_file);
+        std::fwrite(&metrics.milling, sizeof(float), 1, m_file);
+        std::fwrite(&metrics.cluster_count, sizeof(uint32_t), 1, m_file);
+        std::fwrite(&metrics.largest_cluster, sizeof(uint32_t), 1, m_file);
+        std::fwrite(&metrics.mean_cluster_size, sizeof(float), 1, m_file);
+        std::fwrite(&metrics.mean_nn_distance, sizeof(float), 1, m_file);
+        std::fwrite(&metrics.histogram_max, sizeof(float), 1, m_file);
+        std::fwrite(&metrics.compute_time_ms, sizeof(float), 1, m_file);
+        std::fwrite(metrics.nn_histogram.data(), sizeof(uint32_t), metrics.nn_histogram.size(), m_file);
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef BOIDS_SIMULATION_FLOCK_ANALYTICS_HPP
+#define BOIDS_SIMULATION_FLOCK_ANALYTICS_HPP
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "boids.hpp"
+#include "execution.hpp"
+#include "spatial_grid.hpp"
+
+namespace boids::cpu {
+    enum class MetricsFormat {
+        Csv,
+        Binary // "BOIDSMET" header, then records in native byte order, see MetricsWriter
+    };
+
+    struct AnalyticsSettings {
+        bool enabled = false;
+
+        // Metrics are computed on every n-th step only
+        int sample_every = 10;
+
+        // Boids closer than this belong to the same flock, 0 takes the view radius
+        float link_distance = 0.f;
+
+        // Nearest neighbour distances are binned over [0, histogram_max), the last bin also counts farther
+        // neighbours. 0 takes the view radius.
+        int histogram_bins = 32;
+        float histogram_max = 0.f;
+
+        // Nearest neighbours are searched for this many evenly spaced boids, 0 takes every boid
+        int nn_samples = 2048;
+
+        // Every sample is appended to this file if it is not empty
+        std::string output_path;
+        MetricsFormat output_format = MetricsFormat::Csv;
+
+        Execution execution = Execution::Parallel;
+    };
+
+    struct FlockMetrics {
+        uint64_t step{};
+
+        // Length of the mean heading, 1 for a perfectly aligned flock
+        float polarization{};
+
+        // Length of the mean of r x v (both normalized, r taken from the centre of mass), 1 for a perfect mill.
+        // Meaningless with the periodic boundary, where the centre of mass is not defined.
+        float milling{};
+
+        uint32_t cluster_count{};
+        uint32_t largest_cluster{};
+        float mean_cluster_size{};
+
+        float mean_nn_distance{};
+        float histogram_max{};
+        std::vector<uint32_t> nn_histogram;
+
+        float compute_time_ms{};
+    };
+
+    // Per step order parameters of the flock. The grid of the solver is rebuilt on the current positions with the
+    // link distance as view radius, neighbour pairs are then merged into flocks with a lock-free union-find.
+    // Every stage runs in parallel over the boids unless the settings ask for sequential execution.
+    class FlockAnalytics {
+    public:
+        void set_settings(const AnalyticsSettings &settings) { m_settings = settings; }
+        const AnalyticsSettings &settings() const { return m_settings; }
+
+        bool should_sample(uint64_t step) const {
+            return m_settings.enabled && step % uint64_t(std::max(m_settings.sample_every, 1)) == 0;
+        }
+
+        const FlockMetrics &compute(
+                const SimulationParameters &sim_params,
+                SpatialGrid &grid,
+                const std::vector<glm::vec4> &position,
+                const std::vector<glm::vec3> &velocity,
+                uint64_t step
+        );
+
+        const FlockMetrics &metrics() const { return m_metrics; }
+
+    private:
+        void find_clusters(const SpatialGrid &grid, const std::vector<glm::vec4> &position, float link_distance, uint32_t count);
+        uint32_t find_root(uint32_t id);
+        void unite(uint32_t a, uint32_t b);
+
+    private:
+        AnalyticsSettings m_settings;
+        FlockMetrics m_metrics;
+
+        std::unique_ptr<std::atomic<uint32_t>[]> m_parent;
+        size_t m_parent_capacity{};
+        std::vector<uint32_t> m_cluster_size;
+        std::vector<float> m_nn_distance;
+    };
+
+    // Writes metrics to a CSV or binary file. The CSV has one column per histogram bin, the binary format writes
+    // a version and the bin count after the magic and per record the fields of FlockMetrics in order, the step
+    // as uint64 and the rest as 32 bit values. The bin count is fixed by the first record.
+    class MetricsWriter {
+    public:
+        MetricsWriter(const std::string &path, MetricsFormat format);
+        ~MetricsWriter();
+
+        MetricsWriter(const MetricsWriter &) = delete;
+        MetricsWriter &operator=(const MetricsWriter &) = delete;
+
+        void write(const FlockMetrics &metrics);
+
+        bool is_valid() const { return m_file != nullptr; }
+
+    private:
+        void write_header(size_t bins);
+
+    private:
+        FILE *m_file{};
+        MetricsFormat m_format;
+        size_t m_bins{};
+        bool m_header_written{};
+    };
+}
+
+#endif //BOIDS_SIMULATION_FLOCK_ANALYTICS_HPP
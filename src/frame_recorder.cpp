@@ -0,0 +1,213 @@
+#include "frame_recorder.hpp"
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include "gl_debug.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+common::FrameRecorder::FrameRecorder(int width, int height, const std::string &directory, FrameFormat format, const std::string &pipe_command)
+: m_width(width),
+  m_height(height),
+  m_frame_size(size_t(width) * size_t(height) * 3),
+  m_directory(directory),
+  m_format(format) {
+    GLCall( glGenFramebuffers(1, &m_fbo_id) );
+    GLCall( glBindFramebuffer(GL_FRAMEBUFFER, m_fbo_id) );
+
+    GLCall( glGenRenderbuffers(1, &m_color_rb_id) );
+    GLCall( glBindRenderbuffer(GL_RENDERBUFFER, m_color_rb_id) );
+    GLCall( glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height) );
+    GLCall( glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color_rb_id) );
+
+    GLCall( glGenRenderbuffers(1, &m_depth_rb_id) );
+    GLCall( glBindRenderbuffer(GL_RENDERBUFFER, m_depth_rb_id) );
+    GLCall( glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height) );
+    GLCall( glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth_rb_id) );
+
+    GLCall( GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER) );
+    GLCall( glBindRenderbuffer(GL_RENDERBUFFER, 0) );
+    GLCall( glBindFramebuffer(GL_FRAMEBUFFER, 0) );
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "[FrameRecorder]: Framebuffer incomplete: " << status << std::endl;
+        return;
+    }
+
+    GLCall( glGenBuffers(PBO_COUNT, m_pbo_ids) );
+    for (GLuint pbo_id : m_pbo_ids) {
+        GLCall( glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_id) );
+        GLCall( glBufferData(GL_PIXEL_PACK_BUFFER, m_frame_size, nullptr, GL_STREAM_READ) );
+    }
+    GLCall( glBindBuffer(GL_PIXEL_PACK_BUFFER, 0) );
+
+    if (!pipe_command.empty()) {
+        m_pipe = popen(pipe_command.c_str(), "w");
+        if (m_pipe == nullptr) {
+            std::cerr << "[FrameRecorder]: Cannot open pipe: " << pipe_command << std::endl;
+            return;
+        }
+    } else {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if (error) {
+            std::cerr << "[FrameRecorder]: Cannot create " << directory << ": " << error.message() << std::endl;
+            return;
+        }
+    }
+
+    m_valid = true;
+    m_writer = std::thread(&FrameRecorder::write_loop, this);
+}
+
+common::FrameRecorder::~FrameRecorder() {
+    finish();
+
+    for (GLsync fence : m_fences) {
+        if (fence) {
+            GLCall( glDeleteSync(fence) );
+        }
+    }
+    GLCall( glDeleteBuffers(PBO_COUNT, m_pbo_ids) );
+    GLCall( glDeleteRenderbuffers(1, &m_color_rb_id) );
+    GLCall( glDeleteRenderbuffers(1, &m_depth_rb_id) );
+    GLCall( glDeleteFramebuffers(1, &m_fbo_id) );
+}
+
+void common::FrameRecorder::bind() const {
+    GLCall( glBindFramebuffer(GL_FRAMEBUFFER, m_fbo_id) );
+    GLCall( glViewport(0, 0, m_width, m_height) );
+}
+
+void common::FrameRecorder::capture() {
+    if (!m_valid) {
+        return;
+    }
+
+    // The slot was filled PBO_COUNT frames ago, its copy is almost always done by now
+    int slot = m_next_slot;
+    if (m_fences[slot]) {
+        retire(slot);
+    }
+
+    GLCall( glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo_id) );
+    GLCall( glReadBuffer(GL_COLOR_ATTACHMENT0) );
+    GLCall( glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo_ids[slot]) );
+    GLCall( glPixelStorei(GL_PACK_ALIGNMENT, 1) );
+
+    // With a pack buffer bound this only queues the copy, it does not wait for the frame
+    GLCall( glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, nullptr) );
+    GLCall( m_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) );
+    GLCall( glBindBuffer(GL_PIXEL_PACK_BUFFER, 0) );
+
+    m_pbo_frames[slot] = m_captured++;
+    m_next_slot = (slot + 1) % PBO_COUNT;
+}
+
+void common::FrameRecorder::retire(int slot) {
+    GLenum result;
+    do {
+        GLCall( result = glClientWaitSync(m_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) );
+    } while (result == GL_TIMEOUT_EXPIRED);
+    GLCall( glDeleteSync(m_fences[slot]) );
+    m_fences[slot] = nullptr;
+
+    Frame frame { m_pbo_frames[slot], std::vector<uint8_t>(m_frame_size) };
+    GLCall( glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo_ids[slot]) );
+    GLCall( auto pixels = static_cast<const uint8_t *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, m_frame_size, GL_MAP_READ_BIT)) );
+    if (pixels) {
+        std::memcpy(frame.pixels.data(), pixels, m_frame_size);
+    }
+    GLCall( glUnmapBuffer(GL_PIXEL_PACK_BUFFER) );
+    GLCall( glBindBuffer(GL_PIXEL_PACK_BUFFER, 0) );
+
+    // Back pressure, a slow disk or encoder must not let the queue grow without bound
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queue_changed.wait(lock, [this] { return m_queue.size() < MAX_QUEUED_FRAMES; });
+    m_queue.push_back(std::move(frame));
+    lock.unlock();
+    m_queue_changed.notify_all();
+}
+
+void common::FrameRecorder::finish() {
+    if (!m_writer.joinable()) {
+        return;
+    }
+
+    // Oldest first, so frames reach the writer in order
+    for (int i = 0; i < PBO_COUNT; ++i) {
+        int slot = (m_next_slot + i) % PBO_COUNT;
+        if (m_fences[slot]) {
+            retire(slot);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_queue_changed.notify_all();
+    m_writer.join();
+
+    if (m_pipe) {
+        pclose(m_pipe);
+        m_pipe = nullptr;
+    }
+}
+
+uint64_t common::FrameRecorder::frames_written() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_written;
+}
+
+void common::FrameRecorder::write_loop() {
+    while (true) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_queue_changed.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;
+            }
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_queue_changed.notify_all();
+
+        write_frame(frame);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_written;
+    }
+}
+
+void common::FrameRecorder::write_frame(const Frame &frame) {
+    FILE *file = m_pipe;
+    if (!file) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%06llu.%s", static_cast<unsigned long long>(frame.index), m_format == FrameFormat::PPM ? "ppm" : "rgb");
+        std::string path = (std::filesystem::path(m_directory) / name).string();
+
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            std::cerr << "[FrameRecorder]: Cannot write " << path << std::endl;
+            return;
+        }
+    }
+
+    if (m_format == FrameFormat::PPM) {
+        std::fprintf(file, "P6\n%d %d\n255\n", m_width, m_height);
+    }
+
+    // GL rows start at the bottom
+    size_t row_size = size_t(m_width) * 3;
+    for (int row = m_height - 1; row >= 0; --row) {
+        std::fwrite(frame.pixels.data() + row * row_size, 1, row_size, file);
+    }
+
+    if (file != m_pipe) {
+        std::fclose(file);
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef BOIDS_SIMULATION_FRAME_RECORDER_HPP
+#define BOIDS_SIMULATION_FRAME_RECORDER_HPP
+#include <GL/glew.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace common {
+    enum class FrameFormat {
+        PPM, // Binary RGB portable pixmap per frame
+        Raw  // Headerless RGB24, top row first
+    };
+
+    // Offscreen render target whose frames are read back through a ring of pixel buffer objects. A frame is
+    // mapped only after its fence signals, two frames later, and a writer thread stores it to numbered
+    // files or to the stdin of a pipe (e.g. an ffmpeg rawvideo encoder).
+    class FrameRecorder {
+    public:
+        constexpr static const int PBO_COUNT = 3;
+
+        // Frames waiting for the writer before capture() blocks
+        constexpr static const size_t MAX_QUEUED_FRAMES = 8;
+
+        // Writes to `pipe_command` if it is not empty, otherwise into `directory`
+        FrameRecorder(int width, int height, const std::string &directory, FrameFormat format, const std::string &pipe_command = "");
+        ~FrameRecorder();
+
+        FrameRecorder(const FrameRecorder &) = delete;
+        FrameRecorder &operator=(const FrameRecorder &) = delete;
+
+        // False if the framebuffer is incomplete or the output could not be opened
+        bool is_valid() const { return m_valid; }
+
+        // Binds the framebuffer and sets the viewport, draw the frame after this
+        void bind() const;
+
+        // Starts the asynchronous readback of the drawn frame and hands finished ones to the writer
+        void capture();
+
+        // Reads back the frames in flight and waits until the writer has stored all of them
+        void finish();
+
+        int width() const { return m_width; }
+        int height() const { return m_height; }
+        uint64_t frames_written() const;
+
+    private:
+        struct Frame {
+            uint64_t index;
+            std::vector<uint8_t> pixels;
+        };
+
+        void retire(int slot);
+        void write_loop();
+        void write_frame(const Frame &frame);
+
+    private:
+        int m_width, m_height;
+        size_t m_frame_size;
+        bool m_valid = false;
+
+        GLuint m_fbo_id{}, m_color_rb_id{}, m_depth_rb_id{};
+        GLuint m_pbo_ids[PBO_COUNT]{};
+        GLsync m_fences[PBO_COUNT]{};
+        uint64_t m_pbo_frames[PBO_COUNT]{};
+        uint64_t m_captured = 0;
+        int m_next_slot = 0;
+
+        std::string m_directory;
+        FrameFormat m_format;
+        FILE *m_pipe = nullptr;
+
+        // Guarded by m_mutex
+        mutable std::mutex m_mutex;
+        std::condition_variable m_queue_changed;
+        std::deque<Frame> m_queue;
+        uint64_t m_written = 0;
+        bool m_stop = false;
+
+        std::thread m_writer;
+    };
+}
+
+#endif //BOIDS_SIMULATION_FRAME_RECORDER_HPP
@@ -0,0 +1,11 @@
+#ifndef BOIDS_SIMULATION_HOST_DEVICE_HPP
+#define BOIDS_SIMULATION_HOST_DEVICE_HPP
+
+// Marks helpers shared by the CPU solvers and the CUDA kernels
+#ifdef __CUDACC__
+#define BOIDS_HOST_DEVICE __host__ __device__
+#else
+#define BOIDS_HOST_DEVICE
+#endif
+
+#endif //BOIDS_SIMULATION_HOST_DEVICE_HPP
@@ -8,15 +8,25 @@
 
 #include "shader_program.hpp"
 #include "camera.hpp"
+#include "uniform_buffer.hpp"
 #include "gl_debug.h"
 #include "primitives.h"
 
 #include "boids.hpp"
+#include "boids_renderer.hpp"
 #include "boids_cpu.hpp"
+#include "boids_culling.hpp"
 #include "boids_cuda.hpp"
+#include "sdf.hpp"
+#include "simulation_thread.hpp"
+#include "frame_recorder.hpp"
+#include "parameter_sweep.hpp"
 
 #include <iostream>
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <memory>
 #include <glm/gtx/transform.hpp>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -26,11 +36,41 @@ bool list_view_getter(void* data, int index, const char** output);
 
 enum Solution {
     CPUNaive,
+    CPUGrid,
     GPUCUDANaive,
     GPUCUDASortVar1,
     GPUCUDASortVar2
 };
 
+bool is_cpu_solution(Solution solution);
+
+// Command line options, the offscreen mode renders a fixed number of fixed steps into image files
+struct RunOptions {
+    bool offscreen = false;
+    int frames = 600;
+    float dt = 1.f / 60.f;
+    bool seeded = false;
+    uint32_t seed = 0;
+    int width = 1280;
+    int height = 720;
+    std::string output = "frames";
+    common::FrameFormat format = common::FrameFormat::PPM;
+    std::string pipe;
+    Solution solution = Solution::GPUCUDASortVar2;
+    int boids_count = 10000;
+    boids::cpu::AnalyticsSettings analytics;
+    boids::cpu::FieldSettings fields;
+    std::string heatmaps;
+    std::vector<boids::SweepAxis> sweep;
+    int sweep_steps = 600;
+    std::string sweep_output = "sweep.csv";
+    int threads = 0;
+};
+
+bool parse_run_options(int argc, char **argv, RunOptions &options);
+int export_heatmaps(const std::string &field_stream, const std::string &directory);
+int run_sweep(const RunOptions &options);
+
 const uint32_t SCR_WIDTH = 800;
 const uint32_t SCR_HEIGHT = 600;
 
@@ -38,10 +78,32 @@ uint32_t curr_scr_width = SCR_WIDTH;
 uint32_t curr_scr_height = SCR_HEIGHT;
 bool scr_size_changed = false;
 
-int main() {
+int main(int argc, char **argv) {
+    RunOptions options;
+    if (!parse_run_options(argc, argv, options)) {
+        return -1;
+    }
+
+    if (!options.heatmaps.empty()) {
+        return export_heatmaps(options.heatmaps, options.output);
+    }
+
+    if (!options.sweep.empty()) {
+        return run_sweep(options);
+    }
+
+    if (options.seeded) {
+        boids::seed_random(options.seed);
+    }
+
     // GLFW: initialize and configure
     glfwInit();
 
+    // Offscreen runs still need a context, the window just never shows up
+    if (options.offscreen) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
+
     // Decide GL+GLSL versions
 #if defined(IMGUI_IMPL_OPENGL_ES2)
     // GL ES 2.0 + GLSL 100
@@ -114,11 +176,15 @@ int main() {
     // -------------------------------------------------------------------------
 
     std::string executable_dir = std::filesystem::path(__FILE__).parent_path().string();
+    common::ShaderProgram::set_binary_cache_directory(executable_dir + "/../cache/shaders");
     common::ShaderProgram boids_sp(executable_dir + "/../res/boids.vert", executable_dir + "/../res/boids.frag");
+    common::ShaderProgram boids_packed_sp(executable_dir + "/../res/boids_packed.vert", executable_dir + "/../res/boids.frag");
+    common::ShaderProgram boids_point_sp(executable_dir + "/../res/boids_point.vert", executable_dir + "/../res/boids.frag");
+    common::ShaderProgram boids_sprite_sp(executable_dir + "/../res/boids_sprite.vert", executable_dir + "/../res/boids_sprite.frag");
     common::ShaderProgram basic_sp(executable_dir + "/../res/basic.vert", executable_dir + "/../res/basic.frag");
     common::ShaderProgram obstacles_sp(executable_dir + "/../res/obstacles.vert",executable_dir +  "/../res/basic.frag");
 
-    Solution curr_solution = Solution::GPUCUDASortVar2;
+    Solution curr_solution = options.solution;
 
     boids::SimulationParameters sim_params(4.5f, 0.85f, 2.f, 1.4f);
 
@@ -127,30 +193,79 @@ int main() {
     sim_params.aquarium_size.x = 90.f;
     sim_params.aquarium_size.y = 90.f;
     sim_params.aquarium_size.z = 90.f;
-    sim_params.boids_count = 10000;
+    sim_params.boids_count = options.boids_count;
     new_sim_params = sim_params;
 
+    std::string sdf_cache_dir = executable_dir + "/../cache/sdf";
+    boids::SignedDistanceField environment = boids::SignedDistanceField::load_or_bake(boids::SdfScene::aquarium(sim_params.aquarium_size), sdf_cache_dir);
+
     boids::Obstacles obstacles;
+    boids::ObstaclesRenderer obstacles_renderer;
+    boids::cpu::SpatialGrid cpu_grid;
 
     boids::BoidsRenderer boids_renderer;
     boids::Boids boids(sim_params);
     boids_renderer.set_vbos(sim_params, boids.position, boids.orientation);
+    int rendered_boids_count = sim_params.boids_count;
 
     boids::cuda_gpu::GPUBoids gpu_boids = boids::cuda_gpu::GPUBoids(boids, boids_renderer);
+    gpu_boids.set_environment(environment);
+
+    // CPU solutions step on their own thread, GPU ones stay on this thread for the GL interop
+    boids::SimulationThread simulation(boids, environment);
+    boids::cpu::AnalyticsSettings analytics = options.analytics;
+    simulation.set_analytics(analytics);
+    simulation.set_fields(options.fields);
+
+    // Optional frustum and distance culling on the GPU, needs GL 4.3
+    boids::CullingStage culling(executable_dir + "/../res/boids_cull.comp");
+    bool gpu_culling = false;
+    float lod_distance = 150.f;
+
+    // Tetrahedron meshes, or one oriented point sprite per boid for large counts
+    enum class BoidsStyle { Mesh, Sprites };
+    BoidsStyle boids_style = BoidsStyle::Mesh;
 
+    // Camera data lives in one uniform buffer shared by every program, updated once per camera change
     common::OrbitingCamera camera(glm::vec3(0.), SCR_WIDTH, SCR_HEIGHT);
-    boids_sp.set_uniform_mat4f("u_projection_view", camera.get_proj() * camera.get_view());
-    obstacles_sp.set_uniform_mat4f("u_projection_view", camera.get_proj() * camera.get_view());
-    basic_sp.set_uniform_mat4f("u_projection_view", camera.get_proj() * camera.get_view());
+    common::CameraBlock camera_block(camera, SCR_WIDTH, SCR_HEIGHT);
+    common::UniformBuffer camera_ubo(common::CameraBlock::BINDING, sizeof(common::CameraBlock));
+    camera_ubo.update(camera_block);
+    for (common::ShaderProgram *program : { &boids_sp, &boids_packed_sp, &boids_point_sp, &boids_sprite_sp, &basic_sp, &obstacles_sp }) {
+        program->bind_uniform_block("Camera", common::CameraBlock::BINDING);
+    }
+    obstacles_sp.bind_uniform_block("Obstacles", boids::ObstaclesRenderer::OBSTACLES_BINDING);
+    boids_sprite_sp.set_uniform_1f("u_sprite_size", 1.2f);
 
     common::Box aquarium;
     basic_sp.set_uniform_mat4f("u_model", glm::scale(sim_params.aquarium_size));
 
+    std::unique_ptr<common::FrameRecorder> recorder;
+    int recorded_frames = 0;
+    if (options.offscreen) {
+        recorder = std::make_unique<common::FrameRecorder>(options.width, options.height, options.output, options.format, options.pipe);
+        if (!recorder->is_valid()) {
+            glfwTerminate();
+            return -1;
+        }
+
+        // The camera block follows the recorder size from the first frame on
+        curr_scr_width = options.width;
+        curr_scr_height = options.height;
+        scr_size_changed = true;
+    }
+
     std::chrono::steady_clock::time_point current_time = std::chrono::steady_clock::now();
     std::chrono::steady_clock::time_point previous_time = current_time;
+
+    // Edited shaders in res/ are picked up while the simulation keeps running
+    common::ShaderProgram *hot_reload_programs[] = { &boids_sp, &boids_packed_sp, &boids_point_sp, &boids_sprite_sp, &basic_sp, &obstacles_sp };
+    std::chrono::steady_clock::time_point last_reload_check = current_time;
     float dt_as_seconds = 0.f;
+    float step_time_ms = 0.f;
 
     GLCall( glEnable(GL_DEPTH_TEST) );
+    GLCall( glEnable(GL_PROGRAM_POINT_SIZE) );
     GLCall( glEnable(GL_BLEND) );
     GLCall( glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) );
     while (!glfwWindowShouldClose(window))
@@ -158,14 +273,21 @@ int main() {
         glfwPollEvents();
         process_input(window);
 
+        if (current_time - last_reload_check > std::chrono::milliseconds(500)) {
+            last_reload_check = current_time;
+            for (common::ShaderProgram *program : hot_reload_programs) {
+                program->reload_if_changed();
+            }
+            culling.reload_if_changed();
+        }
+
         if (scr_size_changed) {
             camera.set_screen_size(static_cast<float>(curr_scr_width), static_cast<float>(curr_scr_height));
         }
 
         if (process_camera_input(window, camera, dt_as_seconds) || scr_size_changed) {
-            boids_sp.set_uniform_mat4f("u_projection_view", camera.get_proj() * camera.get_view());
-            basic_sp.set_uniform_mat4f("u_projection_view", camera.get_proj() * camera.get_view());
-            obstacles_sp.set_uniform_mat4f("u_projection_view", camera.get_proj() * camera.get_view());
+            camera_block = common::CameraBlock(camera, static_cast<float>(curr_scr_width), static_cast<float>(curr_scr_height));
+            camera_ubo.update(camera_block);
         }
 
         // Start the Dear ImGui frame
@@ -173,7 +295,7 @@ int main() {
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         {
-            static const char* items[] = { "CPU: Naive", "GPU CUDA: Naive", "GPU CUDA: Sort Var1", "GPU CUDA: Sort Var2"};
+            static const char* items[] = { "CPU: Naive", "CPU: Grid", "GPU CUDA: Naive", "GPU CUDA: Sort Var1", "GPU CUDA: Sort Var2"};
             ImGui::Begin("Simulation");
 
             // Display floating text
@@ -185,6 +307,7 @@ int main() {
             ImGui::Text("Solution: %s", items[curr_solution]);
             ImGui::Text("Boids count: %d", sim_params.boids_count);
             ImGui::Text("Aquarium size: (%.2f, %.2f, %.2f)", sim_params.aquarium_size.x, sim_params.aquarium_size.y, sim_params.aquarium_size.z);
+            ImGui::Text("Step: %.2f ms", step_time_ms);
 
             ImGui::End();
 
@@ -197,10 +320,16 @@ int main() {
                     sim_params.boids_count = new_sim_params.boids_count;
 
                     basic_sp.set_uniform_mat4f("u_model", glm::scale(sim_params.aquarium_size));
+                    environment = boids::SignedDistanceField::load_or_bake(boids::SdfScene::aquarium(sim_params.aquarium_size), sdf_cache_dir);
+                    gpu_boids.set_environment(environment);
+                    simulation.set_environment(environment);
                     boids.reset(sim_params);
                     boids_renderer.set_vbos(sim_params, boids.position, boids.orientation);
+                    rendered_boids_count = sim_params.boids_count;
 
-                    if (curr_item != Solution::CPUNaive) {
+                    if (is_cpu_solution(curr_item)) {
+                        simulation.reset(boids);
+                    } else {
                         gpu_boids.reset(sim_params, boids, boids_renderer);
                     }
 
@@ -226,6 +355,90 @@ int main() {
                 ImGui::SliderFloat("Min speed", &sim_params.min_speed, boids::SimulationParameters::MIN_SPEED, sim_params.max_speed);
                 ImGui::SliderFloat("Max speed", &sim_params.max_speed, sim_params.min_speed, boids::SimulationParameters::MAX_SPEED);
                 ImGui::SliderFloat("Noise", &sim_params.noise, 0.0f, 5.0f);
+                ImGui::SliderFloat("View angle", &sim_params.view_angle, 0.0f, 360.0f);
+
+                static const char* modes[] = { "Metric", "Topological" };
+                ImGui::Combo("Interaction (CPU grid)", reinterpret_cast<int *>(&sim_params.interaction_mode), modes, IM_ARRAYSIZE(modes));
+                if (sim_params.interaction_mode == boids::InteractionMode::Topological) {
+                    ImGui::SliderInt("Nearest neighbours", &sim_params.topological_neighbors, 1, boids::SimulationParameters::MAX_TOPOLOGICAL_NEIGHBORS);
+                }
+
+                static const char* boundaries[] = { "Walls", "Periodic", "Open" };
+                ImGui::Combo("Boundary (CPU)", reinterpret_cast<int *>(&sim_params.boundary_mode), boundaries, IM_ARRAYSIZE(boundaries));
+
+                ImGui::Checkbox("Orientation in shader", &sim_params.shader_orientation);
+            }
+
+            if (ImGui::CollapsingHeader("Approximation")) {
+                static boids::cpu::ApproximationError approx_error { 0.f, 0.f, 0 };
+
+                ImGui::SliderInt("Max neighbours", &sim_params.max_neighbors, 0, boids::SimulationParameters::MAX_CAPPED_NEIGHBORS);
+                ImGui::Text("Nearest neighbours kept per boid, 0 means the exact neighbour search.");
+                ImGui::SliderInt("Grid subdivision", &sim_params.grid_subdivision, 1, 8);
+                ImGui::Checkbox("Cell aggregates (CPU grid)", &sim_params.use_cell_aggregates);
+
+                // The exact solver needs positions and velocities on the host, a snapshot of the next step is
+                // requested and the error measured once its frame arrives
+                static bool measure_requested = false;
+                bool measurable = is_cpu_solution(curr_solution) && sim_params.interaction_mode == boids::InteractionMode::Metric;
+                if (measurable && ImGui::Button("Measure error")) {
+                    simulation.request_snapshot();
+                    measure_requested = true;
+                }
+
+                const boids::SimulationFrame &frame = simulation.frame();
+                bool snapshot_ready = !frame.position.empty() && frame.position.size() == size_t(frame.params.boids_count);
+                if (measure_requested && measurable && snapshot_ready) {
+                    measure_requested = false;
+                    if (curr_solution == Solution::CPUGrid) {
+                        cpu_grid.build(frame.params, frame.position, frame.velocity);
+                    }
+                    approx_error = boids::cpu::measure_approximation_error(
+                            frame.params,
+                            frame.position,
+                            frame.velocity,
+                            curr_solution == Solution::CPUGrid ? &cpu_grid : nullptr,
+                            256
+                    );
+                }
+                if (approx_error.samples > 0) {
+                    ImGui::Text("Relative error: mean %.3f, max %.3f (%d boids)", approx_error.mean_relative, approx_error.max_relative, approx_error.samples);
+                }
+            }
+
+            if (ImGui::CollapsingHeader("Analytics")) {
+                bool changed = ImGui::Checkbox("Enabled (CPU)", &analytics.enabled);
+                changed |= ImGui::SliderInt("Sample every", &analytics.sample_every, 1, 120);
+                changed |= ImGui::SliderFloat("Link distance", &analytics.link_distance, 0.f, 20.f);
+                ImGui::Text("0 means the view radius.");
+                if (changed) {
+                    simulation.set_analytics(analytics);
+                }
+
+                const boids::cpu::FlockMetrics &metrics = simulation.frame().metrics;
+                if (analytics.enabled && is_cpu_solution(curr_solution) && metrics.step > 0) {
+                    ImGui::Text("Step %llu (%.2f ms)", static_cast<unsigned long long>(metrics.step), metrics.compute_time_ms);
+                    ImGui::Text("Polarization: %.3f", metrics.polarization);
+                    ImGui::Text("Milling: %.3f", metrics.milling);
+                    ImGui::Text("Flocks: %u, largest %u, mean size %.1f", metrics.cluster_count, metrics.largest_cluster, metrics.mean_cluster_size);
+                    ImGui::Text("Mean nearest neighbour distance: %.3f", metrics.mean_nn_distance);
+
+                    static std::vector<float> histogram;
+                    histogram.assign(metrics.nn_histogram.begin(), metrics.nn_histogram.end());
+                    ImGui::PlotHistogram("NN distance", histogram.data(), static_cast<int>(histogram.size()), 0, nullptr, 0.f, FLT_MAX, ImVec2(0, 60));
+                }
+            }
+
+            if (ImGui::CollapsingHeader("Rendering")) {
+                static const char* styles[] = { "Mesh", "Sprites" };
+                ImGui::Combo("Boids style", reinterpret_cast<int *>(&boids_style), styles, IM_ARRAYSIZE(styles));
+
+                if (culling.initialized()) {
+                    ImGui::Checkbox("GPU culling (mesh style)", &gpu_culling);
+                    ImGui::SliderFloat("Point LOD distance", &lod_distance, 10.f, 500.f);
+                } else {
+                    ImGui::Text("GPU culling needs OpenGL 4.3");
+                }
             }
 
             if (ImGui::CollapsingHeader("Obstacles", ImGuiTreeNodeFlags_DefaultOpen)) {
@@ -274,40 +487,95 @@ int main() {
         std::chrono::duration<float> delta_time = std::chrono::duration_cast<std::chrono::duration<float>>(current_time - previous_time);
         previous_time = current_time;
 
-        // Get the delta time in seconds
-        dt_as_seconds = delta_time.count();
-        if (curr_solution == Solution::CPUNaive) {
-            boids::cpu::update_simulation_naive(sim_params, obstacles, boids.position, boids.velocity, boids.acceleration, boids.orientation, dt_as_seconds);
-            boids_renderer.set_vbos(sim_params, boids.position, boids.orientation);
+        // Get the delta time in seconds, offscreen runs use fixed steps
+        dt_as_seconds = options.offscreen ? options.dt : delta_time.count();
+
+        if (is_cpu_solution(curr_solution)) {
+            // The next step is computed while this frame draws the last completed one,
+            // offscreen runs wait for it so every recorded frame shows exactly one more step
+            simulation.request_step(sim_params, obstacles, curr_solution == Solution::CPUGrid, dt_as_seconds);
+
+            if (options.offscreen ? simulation.wait_frame() : simulation.acquire_frame()) {
+                const boids::SimulationFrame &frame = simulation.frame();
+                if (frame.params.shader_orientation) {
+                    boids_renderer.stream_instances(frame.velocity_instances, frame.params.boids_count);
+                } else {
+                    boids_renderer.stream_instances(frame.instances, frame.params.boids_count);
+                }
+                rendered_boids_count = frame.params.boids_count;
+
+                // Smoothed simulation step time, used to compare solutions and interaction modes
+                step_time_ms = 0.95f * step_time_ms + 0.05f * frame.step_time_ms;
+            }
         } else {
+            auto step_start = std::chrono::steady_clock::now();
             if (curr_solution == Solution::GPUCUDASortVar1) {
-                gpu_boids.update_simulation_with_sort(sim_params, obstacles, boids, dt_as_seconds, 0);
+                gpu_boids.update_simulation_with_sort(sim_params, obstacles, dt_as_seconds, 0);
             } else if (curr_solution == Solution::GPUCUDASortVar2) {
-                gpu_boids.update_simulation_with_sort(sim_params, obstacles, boids, dt_as_seconds, 1);
+                gpu_boids.update_simulation_with_sort(sim_params, obstacles, dt_as_seconds, 1);
             } else {
-                gpu_boids.update_simulation_naive(sim_params, obstacles, boids, dt_as_seconds);
+                gpu_boids.update_simulation_naive(sim_params, obstacles, dt_as_seconds);
             }
-            if (!gpu_boids.gl_buffers_registerd()) {
-                boids_renderer.set_vbos(sim_params, boids.position, boids.orientation);
+
+            // Without GL interop the boids drawn are one step behind the device
+            boids::ReadbackFrame readback;
+            if (!gpu_boids.gl_buffers_registerd() && gpu_boids.acquire_readback(readback)) {
+                boids_renderer.set_vbos(readback.count, readback.position, readback.forward, readback.up, readback.right);
+                rendered_boids_count = readback.count;
             }
+
+            std::chrono::duration<float, std::milli> step_time = std::chrono::steady_clock::now() - step_start;
+            step_time_ms = 0.95f * step_time_ms + 0.05f * step_time.count();
+        }
+
+        if (recorder) {
+            recorder->bind();
         }
 
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         GLCall( glPolygonMode(GL_FRONT_AND_BACK, GL_FILL) );
-        obstacles.draw(obstacles_sp);
+        obstacles_renderer.draw(obstacles_sp, obstacles);
 
         GLCall( glPolygonMode(GL_FRONT_AND_BACK, GL_LINE) );
-        boids_renderer.draw(boids_sp, sim_params.boids_count);
+        // CUDA solutions write the velocity into the forward VBO when the shader derives the orientation
+        bool derive_orientation = boids_renderer.instance_format() == boids::InstanceFormat::Velocity ||
+                (!is_cpu_solution(curr_solution) && sim_params.shader_orientation);
+
+        if (boids_style == BoidsStyle::Sprites) {
+            boids_renderer.draw_sprites(boids_sprite_sp, rendered_boids_count);
+        } else if (gpu_culling && culling.initialized()) {
+            boids_renderer.draw_culled(culling, boids_sp, boids_point_sp, rendered_boids_count,
+                                       camera_block.projection_view, glm::vec3(camera_block.position), lod_distance, derive_orientation);
+        } else if (boids_renderer.instance_format() == boids::InstanceFormat::Quaternion) {
+            boids_renderer.draw(boids_packed_sp, rendered_boids_count);
+        } else {
+            boids_sp.set_uniform_1i("u_derive_orientation", derive_orientation);
+            boids_renderer.draw(boids_sp, rendered_boids_count);
+        }
         aquarium.draw(basic_sp);
 
+        if (recorder) {
+            recorder->capture();
+            if (++recorded_frames >= options.frames) {
+                break;
+            }
+            continue;
+        }
+
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
         // GLFW: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         glfwSwapBuffers(window);
     }
 
+    if (recorder) {
+        recorder->finish();
+        std::cout << "[Offscreen]: Wrote " << recorder->frames_written() << " frames" << std::endl;
+        recorder.reset();
+    }
+
     // GLFW: terminate, clearing all previously allocated GLFW resources.
     glfwTerminate();
     return 0;
@@ -375,3 +643,180 @@ bool list_view_getter(void* data, int index, const char** output) {
     *output = curr_name.c_str();
     return true;
 }
+
+bool is_cpu_solution(Solution solution) {
+    return solution == Solution::CPUNaive || solution == Solution::CPUGrid;
+}
+
+bool parse_run_options(int argc, char **argv, RunOptions &options) {
+    static const char* solutions[] = { "cpu-naive", "cpu-grid", "gpu-naive", "gpu-sort1", "gpu-sort2" };
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool takes_value = std::strcmp(arg, "--offscreen") != 0 && std::strcmp(arg, "--help") != 0;
+        if (takes_value && value == nullptr) {
+            std::cerr << "[Options]: Missing value for " << arg << std::endl;
+            return false;
+        }
+
+        if (std::strcmp(arg, "--offscreen") == 0) {
+            options.offscreen = true;
+        } else if (std::strcmp(arg, "--frames") == 0) {
+            options.frames = std::atoi(value);
+        } else if (std::strcmp(arg, "--dt") == 0) {
+            options.dt = static_cast<float>(std::atof(value));
+        } else if (std::strcmp(arg, "--seed") == 0) {
+            options.seeded = true;
+            options.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (std::strcmp(arg, "--width") == 0) {
+            options.width = std::atoi(value);
+        } else if (std::strcmp(arg, "--height") == 0) {
+            options.height = std::atoi(value);
+        } else if (std::strcmp(arg, "--output") == 0) {
+            options.output = value;
+        } else if (std::strcmp(arg, "--format") == 0) {
+            options.format = std::strcmp(value, "raw") == 0 ? common::FrameFormat::Raw : common::FrameFormat::PPM;
+        } else if (std::strcmp(arg, "--pipe") == 0) {
+            options.pipe = value;
+            options.format = common::FrameFormat::Raw;
+        } else if (std::strcmp(arg, "--boids") == 0) {
+            options.boids_count = glm::clamp(std::atoi(value), 0, static_cast<int>(boids::SimulationParameters::MAX_BOID_COUNT));
+        } else if (std::strcmp(arg, "--metrics") == 0) {
+            options.analytics.enabled = true;
+            options.analytics.output_path = value;
+        } else if (std::strcmp(arg, "--metrics-every") == 0) {
+            options.analytics.sample_every = std::max(std::atoi(value), 1);
+        } else if (std::strcmp(arg, "--metrics-format") == 0) {
+            options.analytics.output_format = std::strcmp(value, "binary") == 0 ? boids::cpu::MetricsFormat::Binary : boids::cpu::MetricsFormat::Csv;
+        } else if (std::strcmp(arg, "--fields") == 0) {
+            options.fields.enabled = true;
+            options.fields.output_path = value;
+        } else if (std::strcmp(arg, "--fields-every") == 0) {
+            options.fields.sample_every = std::max(std::atoi(value), 1);
+        } else if (std::strcmp(arg, "--fields-resolution") == 0) {
+            options.fields.resolution = glm::ivec3(std::clamp(std::atoi(value), 1, boids::cpu::FieldSettings::MAX_RESOLUTION));
+        } else if (std::strcmp(arg, "--heatmaps") == 0) {
+            options.heatmaps = value;
+        } else if (std::strcmp(arg, "--sweep") == 0) {
+            boids::SweepAxis axis;
+            if (!boids::SweepAxis::parse(value, axis)) {
+                std::cerr << "[Options]: Expected NAME=FIRST:LAST:COUNT for --sweep, got " << value << std::endl;
+                return false;
+            }
+            options.sweep.push_back(axis);
+        } else if (std::strcmp(arg, "--sweep-steps") == 0) {
+            options.sweep_steps = std::max(std::atoi(value), 1);
+        } else if (std::strcmp(arg, "--sweep-output") == 0) {
+            options.sweep_output = value;
+        } else if (std::strcmp(arg, "--threads") == 0) {
+            options.threads = std::max(std::atoi(value), 0);
+        } else if (std::strcmp(arg, "--solution") == 0) {
+            auto found = std::find_if(std::begin(solutions), std::end(solutions), [value](const char *name) { return std::strcmp(name, value) == 0; });
+            if (found == std::end(solutions)) {
+                std::cerr << "[Options]: Unknown solution " << value << std::endl;
+                return false;
+            }
+            options.solution = static_cast<Solution>(found - std::begin(solutions));
+        } else {
+            std::cout << "Usage: boids_simulation [--offscreen] [--frames N] [--dt SECONDS] [--seed N] [--width W] [--height H]\n"
+                         "                        [--output DIR] [--format ppm|raw] [--pipe COMMAND] [--boids N]\n"
+                         "                        [--solution cpu-naive|cpu-grid|gpu-naive|gpu-sort1|gpu-sort2]\n"
+                         "                        [--metrics FILE] [--metrics-every N] [--metrics-format csv|binary]\n"
+                         "                        [--fields FILE] [--fields-every N] [--fields-resolution N]\n"
+                         "       boids_simulation --heatmaps FIELD_FILE [--output DIR]\n"
+                         "       boids_simulation --sweep NAME=FIRST:LAST:COUNT [--sweep ...] [--sweep-steps N]\n"
+                         "                        [--sweep-output FILE] [--threads N] [--boids N] [--dt SECONDS] [--seed N]\n"
+                         "                        [--solution cpu-naive|cpu-grid] [--metrics-every N]" << std::endl;
+            return false;
+        }
+
+        if (takes_value) {
+            ++i;
+        }
+    }
+
+    if (options.width <= 0 || options.height <= 0 || options.frames <= 0 || options.dt <= 0.f) {
+        std::cerr << "[Options]: Frames, dt and the frame size must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int export_heatmaps(const std::string &field_stream, const std::string &directory) {
+    // The first pass finds one scale for the whole run, so brightness can be compared between images
+    float max_column = 0.f;
+    boids::cpu::DensityField field;
+    {
+        boids::cpu::FieldStreamReader reader(field_stream);
+        if (!reader.is_valid()) {
+            return -1;
+        }
+        while (reader.read(field)) {
+            for (int z = 0; z < field.resolution.z; ++z) {
+                for (int x = 0; x < field.resolution.x; ++x) {
+                    float column = 0.f;
+                    for (int y = 0; y < field.resolution.y; ++y) {
+                        column += field.density[field.index({ x, y, z })] * field.cell_size.y;
+                    }
+                    max_column = std::max(max_column, column);
+                }
+            }
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    boids::cpu::FieldStreamReader reader(field_stream);
+    int exported = 0;
+    while (reader.read(field)) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "heatmap_%06llu.ppm", static_cast<unsigned long long>(field.step));
+        if (!boids::cpu::write_density_heatmap(field, (std::filesystem::path(directory) / name).string(), 8, max_column)) {
+            return -1;
+        }
+        ++exported;
+    }
+    std::cout << "[Fields]: Exported " << exported << " heatmaps to " << directory << std::endl;
+    return 0;
+}
+
+int run_sweep(const RunOptions &options) {
+    boids::SweepSettings settings;
+    settings.base.boids_count = options.boids_count;
+    settings.axes = options.sweep;
+    // Runs share no device, so the GPU solutions fall back to the CPU grid
+    settings.use_grid = options.solution != Solution::CPUNaive;
+    settings.dt = options.dt;
+    settings.steps = options.sweep_steps;
+    settings.warmup_steps = options.sweep_steps / 2;
+    settings.analytics.sample_every = options.analytics.sample_every;
+    settings.seed = options.seed;
+    settings.threads = options.threads;
+
+    boids::ParameterSweep sweep(settings);
+    for (const boids::SweepAxis &axis : options.sweep) {
+        const std::vector<std::string> &names = boids::sweep_parameter_names();
+        if (std::find(names.begin(), names.end(), axis.parameter) == names.end()) {
+            std::cerr << "[Sweep]: Unknown parameter " << axis.parameter << ", expected one of:";
+            for (const std::string &name : names) {
+                std::cerr << " " << name;
+            }
+            std::cerr << std::endl;
+            return -1;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<boids::SweepResult> results = sweep.run([](size_t done, size_t total) {
+        std::cout << "[Sweep]: " << done << "/" << total << " configurations" << std::endl;
+    });
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+    if (results.empty() || !sweep.write_csv(options.sweep_output, results)) {
+        return -1;
+    }
+    std::cout << "[Sweep]: Wrote " << results.size() << " configurations to " << options.sweep_output << " in " << seconds << " s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,103 @@
+#ifndef BOIDS_SIMULATION_NEIGHBOR_HEAP_HPP
+#define BOIDS_SIMULATION_NEIGHBOR_HEAP_HPP
+#include <cfloat>
+#include <glm/glm.hpp>
+#include "boids.hpp"
+#include "host_device.hpp"
+
+namespace boids {
+    struct BoidNeighbor {
+        float distance2;
+        BoidId id;
+    };
+
+    // The `capacity` nearest candidates offered so far, as a max-heap on distance over caller-provided storage.
+    // Approximate mode keeps a boid's max_neighbors nearest neighbours this way, so the cap drops the farthest
+    // ones instead of whichever the scan reaches last.
+    class NeighborHeap {
+    public:
+        BOIDS_HOST_DEVICE NeighborHeap(BoidNeighbor *items, int capacity) : m_items(items), m_capacity(capacity) {}
+
+        BOIDS_HOST_DEVICE int count() const { return m_count; }
+        BOIDS_HOST_DEVICE const BoidNeighbor &operator[](int i) const { return m_items[i]; }
+
+        // Squared distance a candidate has to be below to enter, anything goes until the heap is full
+        BOIDS_HOST_DEVICE float bound() const { return m_count < m_capacity ? FLT_MAX : m_items[0].distance2; }
+
+        BOIDS_HOST_DEVICE void offer(float distance2, BoidId id) {
+            if (m_count < m_capacity) {
+                // Sift the new candidate up from the last leaf
+                int i = m_count++;
+                while (i > 0 && m_items[(i - 1) / 2].distance2 < distance2) {
+                    m_items[i] = m_items[(i - 1) / 2];
+                    i = (i - 1) / 2;
+                }
+                m_items[i] = BoidNeighbor { distance2, id };
+                return;
+            }
+
+            if (m_capacity == 0 || distance2 >= m_items[0].distance2) {
+                return;
+            }
+
+            // Replace the farthest candidate and sift it down
+            int i = 0;
+            for (int child = 1; child < m_count; child = 2 * i + 1) {
+                if (child + 1 < m_count && m_items[child + 1].distance2 > m_items[child].distance2) {
+                    ++child;
+                }
+                if (m_items[child].distance2 <= distance2) {
+                    break;
+                }
+                m_items[i] = m_items[child];
+                i = child;
+            }
+            m_items[i] = BoidNeighbor { distance2, id };
+        }
+
+    private:
+        BoidNeighbor *m_items;
+        int m_capacity;
+        int m_count = 0;
+    };
+
+    // Visits the cells of `window` at Chebyshev distance `shell` from `center`, the surface of the shell only.
+    // Capped searches visit the shells nearest first and stop once a whole shell lies beyond NeighborHeap::bound().
+    template<typename Visit>
+    BOIDS_HOST_DEVICE void for_each_shell_cell(glm::ivec3 center, int shell, glm::ivec3 window_start, glm::ivec3 window_end, Visit visit) {
+        glm::ivec3 start = glm::max(window_start, center - shell);
+        glm::ivec3 end = glm::min(window_end, center + shell);
+        for (int z = start.z; z <= end.z; ++z) {
+            for (int y = start.y; y <= end.y; ++y) {
+                bool on_surface = glm::abs(z - center.z) == shell || glm::abs(y - center.y) == shell;
+                for (int x = start.x; x <= end.x; ++x) {
+                    // Inside the shell only its two x faces are on the surface
+                    if (!on_surface && glm::abs(x - center.x) != shell) {
+                        x = glm::max(x, center.x + shell - 1);
+                        continue;
+                    }
+                    visit(glm::ivec3(x, y, z));
+                }
+            }
+        }
+    }
+
+    // Largest shell of the window around `center`
+    BOIDS_HOST_DEVICE inline int max_shell(glm::ivec3 center, glm::ivec3 window_start, glm::ivec3 window_end) {
+        glm::ivec3 reach = glm::max(window_end - center, center - window_start);
+        return glm::max(reach.x, glm::max(reach.y, reach.z));
+    }
+
+    // Every cell of `shell` lies at least (shell - 1) cells away, so the shell and all farther ones
+    // hold neither a boid within the view radius nor one nearer than the current candidates
+    BOIDS_HOST_DEVICE inline bool shell_beyond(int shell, float min_cell_size, float distance2_max, const NeighborHeap &capped) {
+        if (shell == 0) {
+            return false;
+        }
+        float shell_distance = float(shell - 1) * min_cell_size;
+        float shell_distance2 = shell_distance * shell_distance;
+        return shell_distance2 > distance2_max || shell_distance2 >= capped.bound();
+    }
+}
+
+#endif //BOIDS_SIMULATION_NEIGHBOR_HEAP_HPP
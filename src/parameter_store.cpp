@@ -0,0 +1,45 @@
+#include "parameter_store.hpp"
+#include <algorithm>
+
+boids::ParameterStore::Changes boids::ParameterStore::update(const SimulationParameters &params, const Obstacles &obstacles) {
+    Changes changes {};
+
+    if (m_params_version == 0 || m_params != params) {
+        m_params = params;
+        ++m_params_version;
+        changes.params = true;
+    }
+
+    size_t count = obstacles.count();
+    bool obstacles_changed = m_obstacles_version == 0 || count != obstacle_count() ||
+            !std::equal(m_obstacle_position.begin(), m_obstacle_position.end(), obstacles.get_pos_array()) ||
+            !std::equal(m_obstacle_radius.begin(), m_obstacle_radius.end(), obstacles.get_radius_array());
+    if (obstacles_changed) {
+        m_obstacle_position.assign(obstacles.get_pos_array(), obstacles.get_pos_array() + count);
+        m_obstacle_radius.assign(obstacles.get_radius_array(), obstacles.get_radius_array() + count);
+        ++m_obstacles_version;
+        changes.obstacles = true;
+    }
+
+    return changes;
+}
+
+bool boids::ParameterUploader::sync(const ParameterStore &store) {
+    bool uploaded = false;
+    if (params_dirty(store)) {
+        m_sink.upload_params(store.params());
+        m_params_version = store.params_version();
+        uploaded = true;
+    }
+    if (obstacles_dirty(store)) {
+        m_sink.upload_obstacles(store.obstacle_count(), store.obstacle_position(), store.obstacle_radius());
+        m_obstacles_version = store.obstacles_version();
+        uploaded = true;
+    }
+    return uploaded;
+}
+
+void boids::ParameterUploader::invalidate() {
+    m_params_version = 0;
+    m_obstacles_version = 0;
+}
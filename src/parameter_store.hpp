@@ -0,0 +1,73 @@
+#ifndef BOIDS_SIMULATION_PARAMETER_STORE_HPP
+#define BOIDS_SIMULATION_PARAMETER_STORE_HPP
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "boids.hpp"
+
+namespace boids {
+    // Host to device copies behind ParameterUploader, implemented with CUDA (cuda_gpu::CudaParameterSink)
+    // or by a mock on machines without a GPU. CPU solvers read the host values and need no sink.
+    class ParameterSink {
+    public:
+        virtual ~ParameterSink() = default;
+
+        virtual void upload_params(const SimulationParameters &params) = 0;
+
+        // Only the `count` obstacles in use are copied
+        virtual void upload_obstacles(size_t count, const glm::vec3 *position, const float *radius) = 0;
+    };
+
+    // Parameters and obstacles last handed to a solver, each with a version bumped whenever they change.
+    // Obstacles are edited in place through the UI, so changes are found by comparing against the copy
+    // kept here rather than by hooking every setter. Version 0 means nothing was stored yet.
+    class ParameterStore {
+    public:
+        struct Changes {
+            bool params;
+            bool obstacles;
+        };
+
+        // Copies what differs from the stored state and bumps its version
+        Changes update(const SimulationParameters &params, const Obstacles &obstacles);
+
+        uint64_t params_version() const { return m_params_version; }
+        uint64_t obstacles_version() const { return m_obstacles_version; }
+
+        const SimulationParameters &params() const { return m_params; }
+        size_t obstacle_count() const { return m_obstacle_radius.size(); }
+        const glm::vec3 *obstacle_position() const { return m_obstacle_position.data(); }
+        const float *obstacle_radius() const { return m_obstacle_radius.data(); }
+
+    private:
+        SimulationParameters m_params{};
+        std::vector<glm::vec3> m_obstacle_position;
+        std::vector<float> m_obstacle_radius;
+        uint64_t m_params_version = 0;
+        uint64_t m_obstacles_version = 0;
+    };
+
+    // Versions of a store one sink holds. A sync uploads only the dirty parts, a step with unchanged
+    // parameters and obstacles copies nothing.
+    class ParameterUploader {
+    public:
+        explicit ParameterUploader(ParameterSink &sink) : m_sink(sink) {}
+
+        bool params_dirty(const ParameterStore &store) const { return m_params_version != store.params_version(); }
+        bool obstacles_dirty(const ParameterStore &store) const { return m_obstacles_version != store.obstacles_version(); }
+
+        // Returns whether anything was uploaded
+        bool sync(const ParameterStore &store);
+
+        // The next sync uploads everything, e.g. after the device buffers were reallocated
+        void invalidate();
+
+    private:
+        ParameterSink &m_sink;
+        uint64_t m_params_version = 0;
+        uint64_t m_obstacles_version = 0;
+    };
+}
+
+#endif //BOIDS_SIMULATION_PARAMETER_STORE_HPP
@@ -0,0 +1,235 @@
+#include "parameter_sweep.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "boids_cpu.hpp"
+#include "sdf.hpp"
+#include "simulation_state.hpp"
+
+namespace {
+    template<typename T>
+    T round_to(float value) {
+        return static_cast<T>(std::lround(value));
+    }
+}
+
+bool boids::SweepAxis::parse(const std::string &text, SweepAxis &axis) {
+    size_t equals = text.find('=');
+    if (equals == std::string::npos) {
+        return false;
+    }
+
+    axis.parameter = text.substr(0, equals);
+    axis.count = 1;
+    std::string range = text.substr(equals + 1);
+    int fields = std::sscanf(range.c_str(), "%f:%f:%d", &axis.first, &axis.last, &axis.count);
+    if (fields == 1) {
+        axis.last = axis.first;
+        axis.count = 1;
+    }
+    return (fields == 1 || fields == 3) && axis.count > 0;
+}
+
+const std::vector<std::string> &boids::sweep_parameter_names() {
+    static const std::vector<std::string> names = {
+        "boids_count", "distance", "separation", "alignment", "cohesion", "max_speed", "min_speed", "noise",
+        "max_neighbors", "grid_subdivision", "use_cell_aggregates", "interaction_mode", "topological_neighbors",
+        "view_angle", "boundary_mode", "aquarium_size", "aquarium_size_x", "aquarium_size_y", "aquarium_size_z"
+    };
+    return names;
+}
+
+bool boids::set_sweep_parameter(SimulationParameters &params, const std::string &name, float value) {
+    if (name == "boids_count") {
+        params.boids_count = std::clamp(round_to<int>(value), 1, int(SimulationParameters::MAX_BOID_COUNT));
+    } else if (name == "distance") {
+        params.distance = std::max(value, SimulationParameters::MIN_DISTANCE);
+    } else if (name == "separation") {
+        params.separation = value;
+    } else if (name == "alignment") {
+        params.alignment = value;
+    } else if (name == "cohesion") {
+        params.cohesion = value;
+    } else if (name == "max_speed") {
+        params.max_speed = value;
+    } else if (name == "min_speed") {
+        params.min_speed = value;
+    } else if (name == "noise") {
+        params.noise = value;
+    } else if (name == "max_neighbors") {
+        params.max_neighbors = std::clamp(round_to<int>(value), 0, SimulationParameters::MAX_CAPPED_NEIGHBORS);
+    } else if (name == "grid_subdivision") {
+        params.grid_subdivision = std::max(round_to<int>(value), 1);
+    } else if (name == "use_cell_aggregates") {
+        params.use_cell_aggregates = value >= 0.5f;
+    } else if (name == "interaction_mode") {
+        params.interaction_mode = static_cast<InteractionMode>(std::clamp(round_to<int>(value), 0, 1));
+    } else if (name == "topological_neighbors") {
+        params.topological_neighbors = std::clamp(round_to<int>(value), 1, SimulationParameters::MAX_TOPOLOGICAL_NEIGHBORS);
+    } else if (name == "view_angle") {
+        params.view_angle = std::clamp(value, 0.f, 360.f);
+    } else if (name == "boundary_mode") {
+        params.boundary_mode = static_cast<BoundaryMode>(std::clamp(round_to<int>(value), 0, 2));
+    } else if (name == "aquarium_size") {
+        params.aquarium_size = glm::vec3(value);
+    } else if (name == "aquarium_size_x") {
+        params.aquarium_size.x = value;
+    } else if (name == "aquarium_size_y") {
+        params.aquarium_size.y = value;
+    } else if (name == "aquarium_size_z") {
+        params.aquarium_size.z = value;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+boids::ParameterSweep::ParameterSweep(SweepSettings settings)
+: m_settings(std::move(settings)) {
+    // Each configuration already runs on its own worker
+    m_settings.analytics.enabled = true;
+    m_settings.analytics.execution = Execution::Sequential;
+    m_settings.analytics.output_path.clear();
+}
+
+size_t boids::ParameterSweep::configuration_count() const {
+    size_t count = 1;
+    for (const SweepAxis &axis : m_settings.axes) {
+        count *= size_t(std::max(axis.count, 1));
+    }
+    return count;
+}
+
+boids::SimulationParameters boids::ParameterSweep::configuration(size_t index, std::vector<float> &values) const {
+    SimulationParameters params = m_settings.base;
+    values.assign(m_settings.axes.size(), 0.f);
+    for (size_t axis = m_settings.axes.size(); axis-- > 0;) {
+        const SweepAxis &sweep_axis = m_settings.axes[axis];
+        int count = std::max(sweep_axis.count, 1);
+        values[axis] = sweep_axis.value(int(index % count));
+        index /= count;
+        set_sweep_parameter(params, sweep_axis.parameter, values[axis]);
+    }
+    return params;
+}
+
+std::vector<boids::SweepResult> boids::ParameterSweep::run(const std::function<void(size_t, size_t)> &progress) const {
+    for (const SweepAxis &axis : m_settings.axes) {
+        SimulationParameters probe = m_settings.base;
+        if (!set_sweep_parameter(probe, axis.parameter, axis.first)) {
+            std::cerr << "[Sweep]: Unknown parameter " << axis.parameter << std::endl;
+            return {};
+        }
+    }
+
+    size_t total = configuration_count();
+    std::vector<SweepResult> results(total);
+
+    int thread_count = m_settings.threads > 0 ? m_settings.threads : int(std::max(std::thread::hardware_concurrency(), 1u));
+    thread_count = int(std::min(size_t(thread_count), total));
+
+    // Workers take configurations in order, so long and short runs balance out
+    std::atomic<size_t> next_index { 0 };
+    std::mutex progress_mutex;
+    size_t done = 0;
+
+    auto worker = [&]() {
+        for (size_t index = next_index++; index < total; index = next_index++) {
+            results[index] = run_configuration(index);
+
+            if (progress) {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                progress(++done, total);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < thread_count; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : workers) {
+        thread.join();
+    }
+
+    return results;
+}
+
+boids::SweepResult boids::ParameterSweep::run_configuration(size_t index) const {
+    SweepResult result;
+    SimulationParameters params = configuration(index, result.values);
+
+    seed_thread_random(m_settings.seed + uint32_t(index));
+    auto state = std::make_unique<SimulationState>(params);
+    cpu::SpatialGrid grid;
+    SignedDistanceField environment = SignedDistanceField::bake(SdfScene::aquarium(params.aquarium_size));
+    Obstacles obstacles;
+
+    cpu::FlockAnalytics analytics;
+    analytics.set_settings(m_settings.analytics);
+    int samples = 0;
+
+    std::chrono::steady_clock::duration solver_time {};
+    for (int step = 1; step <= m_settings.steps; ++step) {
+        auto step_start = std::chrono::steady_clock::now();
+        if (m_settings.use_grid) {
+            cpu::update_simulation_with_grid(params, obstacles, environment.view(), grid, *state, m_settings.dt, Execution::Sequential);
+        } else {
+            cpu::update_simulation_naive(params, obstacles, environment.view(), *state, m_settings.dt, Execution::Sequential);
+        }
+        solver_time += std::chrono::steady_clock::now() - step_start;
+
+        if (step > m_settings.warmup_steps && analytics.should_sample(uint64_t(step - m_settings.warmup_steps))) {
+            const cpu::FlockMetrics &metrics = analytics.compute(params, grid, state->front().position, state->front().velocity, uint64_t(step));
+            result.polarization += metrics.polarization;
+            result.milling += metrics.milling;
+            result.cluster_count += float(metrics.cluster_count);
+            result.largest_cluster += float(metrics.largest_cluster);
+            result.mean_nn_distance += metrics.mean_nn_distance;
+            ++samples;
+        }
+    }
+
+    if (samples > 0) {
+        result.polarization /= float(samples);
+        result.milling /= float(samples);
+        result.cluster_count /= float(samples);
+        result.largest_cluster /= float(samples);
+        result.mean_nn_distance /= float(samples);
+    }
+    float solver_seconds = std::chrono::duration<float>(solver_time).count();
+    result.steps_per_second = solver_seconds > 0.f ? float(m_settings.steps) / solver_seconds : 0.f;
+
+    return result;
+}
+
+bool boids::ParameterSweep::write_csv(const std::string &path, const std::vector<SweepResult> &results) const {
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        std::cerr << "[Sweep]: Cannot open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    for (const SweepAxis &axis : m_settings.axes) {
+        std::fprintf(file, "%s,", axis.parameter.c_str());
+    }
+    std::fprintf(file, "polarization,milling,cluster_count,largest_cluster,mean_nn_distance,steps_per_second\n");
+
+    for (const SweepResult &result : results) {
+        for (float value : result.values) {
+            std::fprintf(file, "%g,", value);
+        }
+        std::fprintf(file, "%.6f,%.6f,%.3f,%.3f,%.6f,%.2f\n", result.polarization, result.milling, result.cluster_count,
+                     result.largest_cluster, result.mean_nn_distance, result.steps_per_second);
+    }
+
+    std::fclose(file);
+    return true;
+}
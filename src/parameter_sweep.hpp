@@ -0,0 +1,85 @@
+#ifndef BOIDS_SIMULATION_PARAMETER_SWEEP_HPP
+#define BOIDS_SIMULATION_PARAMETER_SWEEP_HPP
+#include <functional>
+#include <string>
+#include <vector>
+#include "boids.hpp"
+#include "flock_analytics.hpp"
+
+namespace boids {
+    // `count` evenly spaced values of one SimulationParameters field, from `first` to `last`
+    struct SweepAxis {
+        std::string parameter;
+        float first;
+        float last;
+        int count;
+
+        float value(int i) const { return count > 1 ? first + (last - first) * float(i) / float(count - 1) : first; }
+
+        // Parses "name=first:last:count", or "name=value" for a single value
+        static bool parse(const std::string &text, SweepAxis &axis);
+    };
+
+    // Fields a sweep can vary, by name. Integers and enums are rounded, aquarium_size sets all three axes.
+    const std::vector<std::string> &sweep_parameter_names();
+    bool set_sweep_parameter(SimulationParameters &params, const std::string &name, float value);
+
+    struct SweepSettings {
+        SimulationParameters base;
+        std::vector<SweepAxis> axes;
+
+        bool use_grid = true;
+        float dt = 1.f / 60.f;
+        int steps = 600;
+
+        // Metrics are averaged over samples taken after the warmup, every analytics.sample_every steps
+        int warmup_steps = 300;
+        cpu::AnalyticsSettings analytics;
+
+        // Configuration i draws its initial state and noise from seed + i, whichever worker runs it
+        uint32_t seed = 0;
+
+        // Workers running configurations side by side, 0 takes the hardware concurrency
+        int threads = 0;
+    };
+
+    struct SweepResult {
+        // Value of every axis
+        std::vector<float> values;
+
+        float polarization{};
+        float milling{};
+        float cluster_count{};
+        float largest_cluster{};
+        float mean_nn_distance{};
+
+        // Solver steps only, the analytics are not timed
+        float steps_per_second{};
+    };
+
+    // Runs the grid of configurations spanned by the axes as independent headless CPU simulations. Every
+    // configuration owns its state, grid, environment and analytics and runs sequentially on one worker, so
+    // workers share nothing but the index of the next configuration, and many small runs fill all cores.
+    class ParameterSweep {
+    public:
+        explicit ParameterSweep(SweepSettings settings);
+
+        size_t configuration_count() const;
+
+        // Parameters of configuration `index`, the last axis varies fastest
+        SimulationParameters configuration(size_t index, std::vector<float> &values) const;
+
+        // Blocks until every configuration is done. `progress` is called after each one, one call at a time.
+        std::vector<SweepResult> run(const std::function<void(size_t done, size_t total)> &progress = {}) const;
+
+        bool write_csv(const std::string &path, const std::vector<SweepResult> &results) const;
+
+    private:
+        SweepResult run_configuration(size_t index) const;
+
+    private:
+        SweepSettings m_settings;
+    };
+}
+
+#endif //BOIDS_SIMULATION_PARAMETER_SWEEP_HPP
@@ -0,0 +1,146 @@
+#include <array>
+#include <optional>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "batched_worlds.hpp"
+#include "world.hpp"
+
+namespace py = pybind11;
+
+namespace {
+    // (count, 3) float32 array over `data` without a copy, `owner` stays alive as long as the array
+    py::array_t<float> vector_view(const float *data, size_t count, size_t stride, py::handle owner, bool writeable) {
+        py::array_t<float> array({ count, size_t(3) }, { stride, sizeof(float) }, data, owner);
+        if (!writeable) {
+            py::detail::array_proxy(array.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+        }
+        return array;
+    }
+
+    // (count, 3) float32 array holding a copy of `data`, for buffers that may be reallocated
+    py::array_t<float> vector_copy(const float *data, size_t count, size_t stride) {
+        return py::array_t<float>({ count, size_t(3) }, { stride, sizeof(float) }, data);
+    }
+
+    std::array<float, 3> to_array(glm::vec3 v) {
+        return { v.x, v.y, v.z };
+    }
+
+    glm::vec3 to_vec3(const std::array<float, 3> &a) {
+        return { a[0], a[1], a[2] };
+    }
+
+    boids::Execution execution(bool parallel) {
+        return parallel ? boids::Execution::Parallel : boids::Execution::Sequential;
+    }
+}
+
+PYBIND11_MODULE(boids, m) {
+    m.doc() = "Headless CPU flocking simulation. World.positions and World.velocities alias the world's "
+              "buffers, steps swap those buffers, so read the properties again after stepping. BatchedWorlds "
+              "returns copies, its buffers are reallocated when worlds are added.";
+
+    m.attr("MAX_BOID_COUNT") = boids::SimulationParameters::MAX_BOID_COUNT;
+    m.attr("MAX_OBSTACLES_COUNT") = boids::SimulationParameters::MAX_OBSTACLES_COUNT;
+
+    py::enum_<boids::InteractionMode>(m, "InteractionMode")
+            .value("Metric", boids::InteractionMode::Metric)
+            .value("Topological", boids::InteractionMode::Topological);
+
+    py::enum_<boids::BoundaryMode>(m, "BoundaryMode")
+            .value("Walls", boids::BoundaryMode::Walls)
+            .value("Periodic", boids::BoundaryMode::Periodic)
+            .value("Open", boids::BoundaryMode::Open);
+
+    py::class_<boids::SimulationParameters>(m, "Parameters")
+            .def(py::init<>())
+            .def_readwrite("boids_count", &boids::SimulationParameters::boids_count)
+            .def_readwrite("distance", &boids::SimulationParameters::distance)
+            .def_readwrite("separation", &boids::SimulationParameters::separation)
+            .def_readwrite("alignment", &boids::SimulationParameters::alignment)
+            .def_readwrite("cohesion", &boids::SimulationParameters::cohesion)
+            .def_readwrite("max_speed", &boids::SimulationParameters::max_speed)
+            .def_readwrite("min_speed", &boids::SimulationParameters::min_speed)
+            .def_readwrite("noise", &boids::SimulationParameters::noise)
+            .def_readwrite("max_neighbors", &boids::SimulationParameters::max_neighbors)
+            .def_readwrite("grid_subdivision", &boids::SimulationParameters::grid_subdivision)
+            .def_readwrite("use_cell_aggregates", &boids::SimulationParameters::use_cell_aggregates)
+            .def_readwrite("interaction_mode", &boids::SimulationParameters::interaction_mode)
+            .def_readwrite("topological_neighbors", &boids::SimulationParameters::topological_neighbors)
+            .def_readwrite("view_angle", &boids::SimulationParameters::view_angle)
+            .def_readwrite("boundary_mode", &boids::SimulationParameters::boundary_mode)
+            .def_property("aquarium_size",
+                    [](const boids::SimulationParameters &params) { return to_array(params.aquarium_size); },
+                    [](boids::SimulationParameters &params, const std::array<float, 3> &size) { params.aquarium_size = to_vec3(size); });
+
+    py::class_<boids::cpu::World>(m, "World")
+            .def(py::init([](const boids::SimulationParameters &params, bool use_grid, std::optional<uint32_t> seed) {
+                // Steps with parallel=False on the same thread continue the seeded sequence
+                if (seed) {
+                    boids::seed_thread_random(*seed);
+                }
+                return std::make_unique<boids::cpu::World>(params, use_grid);
+            }), py::arg("params"), py::arg("use_grid") = true, py::arg("seed") = py::none())
+            .def_property("params", [](const boids::cpu::World &world) { return world.params(); }, &boids::cpu::World::set_params,
+                    "Copy of the parameters, assign a modified copy back to apply it")
+            .def_property("use_grid", &boids::cpu::World::use_grid, &boids::cpu::World::set_use_grid)
+            .def_property_readonly("step_count", &boids::cpu::World::step_count)
+            .def("reset", &boids::cpu::World::reset)
+            .def("step", [](boids::cpu::World &world, int steps, float dt, bool parallel) {
+                py::gil_scoped_release release;
+                world.step(dt, steps, execution(parallel));
+            }, py::arg("steps") = 1, py::arg("dt") = 1.f / 60.f, py::arg("parallel") = true)
+            .def_property_readonly("positions", [](py::object self) {
+                boids::cpu::World &world = self.cast<boids::cpu::World &>();
+                const boids::Boids &boids = world.boids();
+                return vector_view(&boids.position[0].x, size_t(world.params().boids_count), sizeof(glm::vec4), self, true);
+            }, "(boids_count, 3) view of the positions of the last step, writable")
+            .def_property_readonly("velocities", [](py::object self) {
+                boids::cpu::World &world = self.cast<boids::cpu::World &>();
+                const boids::Boids &boids = world.boids();
+                return vector_view(&boids.velocity[0].x, size_t(world.params().boids_count), sizeof(glm::vec3), self, true);
+            }, "(boids_count, 3) view of the velocities of the last step, writable")
+            .def("add_obstacle", [](boids::cpu::World &world, const std::array<float, 3> &position, float radius) {
+                if (world.obstacles().count() >= boids::SimulationParameters::MAX_OBSTACLES_COUNT) {
+                    throw py::value_error("too many obstacles");
+                }
+                world.obstacles().push(to_vec3(position), radius);
+            }, py::arg("position"), py::arg("radius"))
+            .def("remove_obstacle", [](boids::cpu::World &world, size_t index) {
+                if (index >= world.obstacles().count()) {
+                    throw py::index_error("no such obstacle");
+                }
+                world.obstacles().remove(index);
+            }, py::arg("index"))
+            .def_property_readonly("obstacle_count", [](const boids::cpu::World &world) { return world.obstacles().count(); });
+
+    py::class_<boids::cpu::BatchedWorlds>(m, "BatchedWorlds")
+            .def(py::init<>())
+            .def("add_world", &boids::cpu::BatchedWorlds::add_world, py::arg("params"))
+            .def("clear", &boids::cpu::BatchedWorlds::clear)
+            .def("params", &boids::cpu::BatchedWorlds::params, py::arg("world"))
+            .def("set_params", &boids::cpu::BatchedWorlds::set_params, py::arg("world"), py::arg("params"))
+            .def("reset_world", &boids::cpu::BatchedWorlds::reset_world, py::arg("world"))
+            .def_property_readonly("world_count", &boids::cpu::BatchedWorlds::world_count)
+            .def_property_readonly("boid_count", &boids::cpu::BatchedWorlds::boid_count)
+            .def("world_range", [](const boids::cpu::BatchedWorlds &worlds, boids::cpu::WorldId world) {
+                return py::make_tuple(worlds.world_start(world), worlds.world_end(world));
+            }, py::arg("world"), "Boids of the world are positions[start:end]")
+            .def("step", [](boids::cpu::BatchedWorlds &worlds, int steps, float dt, bool parallel) {
+                py::gil_scoped_release release;
+                for (int i = 0; i < steps; ++i) {
+                    worlds.step(dt, execution(parallel));
+                }
+            }, py::arg("steps") = 1, py::arg("dt") = 1.f / 60.f, py::arg("parallel") = true)
+            // Adding worlds and stepping reallocate the batch buffers, so these are copies rather than views
+            .def_property_readonly("positions", [](const boids::cpu::BatchedWorlds &worlds) {
+                return vector_copy(reinterpret_cast<const float *>(worlds.position().data()), worlds.boid_count(), sizeof(glm::vec4));
+            }, "(boid_count, 3) copy of the positions of all worlds")
+            .def_property_readonly("velocities", [](const boids::cpu::BatchedWorlds &worlds) {
+                return vector_copy(reinterpret_cast<const float *>(worlds.velocity().data()), worlds.boid_count(), sizeof(glm::vec3));
+            }, "(boid_count, 3) copy of the velocities of all worlds")
+            .def_property_readonly("world_ids", [](const boids::cpu::BatchedWorlds &worlds) {
+                return py::array_t<uint32_t>({ worlds.boid_count() }, { sizeof(uint32_t) }, worlds.world_id().data());
+            }, "Copy of the world of every boid");
+}
@@ -0,0 +1,199 @@
+#include "sdf.hpp"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace {
+    constexpr uint32_t SDF_FILE_MAGIC = 0x46445342; // "BSDF"
+    constexpr uint32_t SDF_FILE_VERSION = 1;
+
+    // Per axis, far above anything baked, so a corrupt header cannot request a huge allocation
+    constexpr int32_t SDF_MAX_FILE_RESOLUTION = 1024;
+    // Trilinear sampling reads 2 voxels per axis
+    constexpr int32_t SDF_MIN_RESOLUTION = 2;
+
+    // Walls are 4 units thick, keep a margin so boids pushed outside still get a sensible gradient
+    constexpr float SDF_MARGIN = 8.f;
+
+    struct SdfFileHeader {
+        uint32_t magic;
+        uint32_t version;
+        int32_t resolution[3];
+        float origin[3];
+        float voxel_size;
+    };
+
+    uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+}
+
+float boids::SdfPrimitive::distance(glm::vec3 p) const {
+    switch (type) {
+        case Type::AquariumInterior: {
+            glm::vec3 d = size / 2.f - glm::abs(p - center);
+            if (d.x >= 0.f && d.y >= 0.f && d.z >= 0.f) {
+                return std::min(d.x, std::min(d.y, d.z));
+            }
+            return -glm::length(glm::min(d, glm::vec3(0.f)));
+        }
+        case Type::Sphere:
+            return glm::distance(p, center) - size.x;
+        case Type::Box: {
+            glm::vec3 q = glm::abs(p - center) - size;
+            return glm::length(glm::max(q, glm::vec3(0.f))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.f);
+        }
+    }
+    return 0.f;
+}
+
+boids::SdfScene boids::SdfScene::aquarium(glm::vec3 aquarium_size) {
+    SdfScene scene;
+    scene.bounds_size = aquarium_size;
+    scene.primitives.push_back(SdfPrimitive { SdfPrimitive::Type::AquariumInterior, glm::vec3(0.f), aquarium_size });
+    return scene;
+}
+
+uint64_t boids::SdfScene::hash(uint32_t resolution) const {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = fnv1a(hash, &SDF_FILE_VERSION, sizeof(SDF_FILE_VERSION));
+    hash = fnv1a(hash, &resolution, sizeof(resolution));
+    hash = fnv1a(hash, &bounds_size, sizeof(bounds_size));
+    for (const auto &primitive : primitives) {
+        hash = fnv1a(hash, &primitive.type, sizeof(primitive.type));
+        hash = fnv1a(hash, &primitive.center, sizeof(primitive.center));
+        hash = fnv1a(hash, &primitive.size, sizeof(primitive.size));
+    }
+    return hash;
+}
+
+boids::SignedDistanceField boids::SignedDistanceField::bake(const SdfScene &scene, uint32_t resolution) {
+    SignedDistanceField sdf;
+    resolution = std::max(resolution, uint32_t(SDF_MIN_RESOLUTION));
+
+    glm::vec3 extent = scene.bounds_size + 2.f * SDF_MARGIN;
+    sdf.m_voxel_size = std::max(extent.x, std::max(extent.y, extent.z)) / float(resolution - 1);
+    sdf.m_resolution = glm::ivec3(glm::ceil(extent / sdf.m_voxel_size)) + 1;
+    sdf.m_origin = -extent / 2.f;
+    sdf.m_data.resize(size_t(sdf.m_resolution.x) * sdf.m_resolution.y * sdf.m_resolution.z);
+
+    for (int z = 0; z < sdf.m_resolution.z; ++z) {
+        for (int y = 0; y < sdf.m_resolution.y; ++y) {
+            for (int x = 0; x < sdf.m_resolution.x; ++x) {
+                glm::vec3 p = sdf.m_origin + glm::vec3(x, y, z) * sdf.m_voxel_size;
+
+                // Free space is the intersection of free spaces of all primitives
+                float dist = std::numeric_limits<float>::max();
+                for (const auto &primitive : scene.primitives) {
+                    dist = std::min(dist, primitive.distance(p));
+                }
+
+                sdf.m_data[x + y * sdf.m_resolution.x + z * sdf.m_resolution.x * sdf.m_resolution.y] = dist;
+            }
+        }
+    }
+
+    return sdf;
+}
+
+boids::SignedDistanceField boids::SignedDistanceField::load_or_bake(const SdfScene &scene, const std::string &cache_dir, uint32_t resolution) {
+    std::stringstream name;
+    name << "sdf_" << std::hex << scene.hash(resolution) << ".bin";
+    std::string path = (std::filesystem::path(cache_dir) / name.str()).string();
+
+    SignedDistanceField sdf;
+    if (sdf.load(path)) {
+        std::cout << "[SDF]: Loaded cached environment " << path << std::endl;
+        return sdf;
+    }
+
+    sdf = bake(scene, resolution);
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+    if (!sdf.save(path)) {
+        std::cerr << "[SDF]: Warning: Cannot write environment cache " << path << std::endl;
+    }
+
+    return sdf;
+}
+
+bool boids::SignedDistanceField::save(const std::string &path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    SdfFileHeader header {
+        SDF_FILE_MAGIC,
+        SDF_FILE_VERSION,
+        { m_resolution.x, m_resolution.y, m_resolution.z },
+        { m_origin.x, m_origin.y, m_origin.z },
+        m_voxel_size
+    };
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(m_data.data()), std::streamsize(m_data.size() * sizeof(float)));
+
+    return file.good();
+}
+
+bool boids::SignedDistanceField::load(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    SdfFileHeader header{};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file.good() || header.magic != SDF_FILE_MAGIC || header.version != SDF_FILE_VERSION) {
+        return false;
+    }
+
+    for (int32_t resolution : header.resolution) {
+        if (resolution < SDF_MIN_RESOLUTION || resolution > SDF_MAX_FILE_RESOLUTION) {
+            return false;
+        }
+    }
+
+    // The voxel size divides sample positions, the origin offsets them
+    if (!std::isfinite(header.voxel_size) || header.voxel_size <= 0.f) {
+        return false;
+    }
+    for (float origin : header.origin) {
+        if (!std::isfinite(origin)) {
+            return false;
+        }
+    }
+
+    // The voxels have to be in the file before they are allocated
+    size_t voxel_count = size_t(header.resolution[0]) * size_t(header.resolution[1]) * size_t(header.resolution[2]);
+    std::streampos data_start = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff remaining = file.tellg() - data_start;
+    if (!file.good() || remaining < std::streamoff(voxel_count * sizeof(float))) {
+        return false;
+    }
+    file.seekg(data_start);
+
+    std::vector<float> data(voxel_count);
+    file.read(reinterpret_cast<char *>(data.data()), std::streamsize(data.size() * sizeof(float)));
+    if (!file.good()) {
+        return false;
+    }
+
+    m_data = std::move(data);
+    m_resolution = glm::ivec3(header.resolution[0], header.resolution[1], header.resolution[2]);
+    m_origin = glm::vec3(header.origin[0], header.origin[1], header.origin[2]);
+    m_voxel_size = header.voxel_size;
+
+    return true;
+}
@@ -0,0 +1,124 @@
+#ifndef BOIDS_SIMULATION_SDF_HPP
+#define BOIDS_SIMULATION_SDF_HPP
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "host_device.hpp"
+
+namespace boids {
+    // Analytic shape the environment is baked from. Positive distances are free space.
+    struct SdfPrimitive {
+        enum class Type : uint32_t {
+            AquariumInterior, // boids live inside, walls are the solid part
+            Sphere,           // solid sphere, radius stored in size.x
+            Box               // solid box, half extents stored in size
+        };
+
+        Type type;
+        glm::vec3 center;
+        glm::vec3 size;
+
+        float distance(glm::vec3 p) const;
+    };
+
+    struct SdfScene {
+        glm::vec3 bounds_size;
+        std::vector<SdfPrimitive> primitives;
+
+        // Scene containing only the aquarium walls
+        static SdfScene aquarium(glm::vec3 aquarium_size);
+
+        uint64_t hash(uint32_t resolution) const;
+    };
+
+    // Non-owning view of the voxel grid, cheap to pass by value to the kernels.
+    struct SdfView {
+        const float *data;
+        glm::ivec3 resolution;
+        glm::vec3 origin;
+        float voxel_size;
+
+        // Trilinear sample of the distance together with its gradient, both computed from the same 8 voxels
+        BOIDS_HOST_DEVICE float sample(glm::vec3 p, glm::vec3 &gradient) const {
+            glm::vec3 g = glm::clamp(
+                    (p - origin) / voxel_size,
+                    glm::vec3(0.f),
+                    glm::vec3(resolution - 1) - 0.001f
+            );
+            glm::ivec3 c = glm::ivec3(glm::floor(g));
+            glm::vec3 t = g - glm::vec3(c);
+
+            int sx = 1;
+            int sy = resolution.x;
+            int sz = resolution.x * resolution.y;
+            const float *v = data + c.x * sx + c.y * sy + c.z * sz;
+
+            float d000 = v[0],       d100 = v[sx],
+                  d010 = v[sy],      d110 = v[sx + sy],
+                  d001 = v[sz],      d101 = v[sx + sz],
+                  d011 = v[sy + sz], d111 = v[sx + sy + sz];
+
+            float d00 = glm::mix(d000, d100, t.x);
+            float d10 = glm::mix(d010, d110, t.x);
+            float d01 = glm::mix(d001, d101, t.x);
+            float d11 = glm::mix(d011, d111, t.x);
+            float d0 = glm::mix(d00, d10, t.y);
+            float d1 = glm::mix(d01, d11, t.y);
+
+            gradient.x = glm::mix(
+                    glm::mix(d100 - d000, d110 - d010, t.y),
+                    glm::mix(d101 - d001, d111 - d011, t.y),
+                    t.z
+            );
+            gradient.y = glm::mix(d10 - d00, d11 - d01, t.z);
+            gradient.z = d1 - d0;
+            gradient /= voxel_size;
+
+            return glm::mix(d0, d1, t.z);
+        }
+
+        // Acceleration pushing a boid away from the solid parts of the environment
+        BOIDS_HOST_DEVICE glm::vec3 avoidance(glm::vec3 p) const {
+            const float wall = 4.f;
+            const float wall_acc = 15.f;
+
+            glm::vec3 gradient;
+            float dist = sample(p, gradient);
+            if (dist > wall || glm::dot(gradient, gradient) < 1e-12f) {
+                return glm::vec3(0.f);
+            }
+
+            return (wall - dist) / wall * wall_acc * glm::normalize(gradient);
+        }
+    };
+
+    class SignedDistanceField {
+    public:
+        constexpr static const uint32_t DEFAULT_RESOLUTION = 64;
+
+        SignedDistanceField() = default;
+
+        // Samples the scene on a voxel grid, the longest axis gets `resolution` voxels (at least 2)
+        static SignedDistanceField bake(const SdfScene &scene, uint32_t resolution = DEFAULT_RESOLUTION);
+
+        // Loads the bake from `cache_dir` if it exists, otherwise bakes the scene and stores it there
+        static SignedDistanceField load_or_bake(const SdfScene &scene, const std::string &cache_dir, uint32_t resolution = DEFAULT_RESOLUTION);
+
+        bool save(const std::string &path) const;
+        bool load(const std::string &path);
+
+        SdfView view() const { return SdfView { m_data.data(), m_resolution, m_origin, m_voxel_size }; }
+
+        const std::vector<float> &data() const { return m_data; }
+        size_t voxel_count() const { return m_data.size(); }
+
+    private:
+        std::vector<float> m_data;
+        glm::ivec3 m_resolution{};
+        glm::vec3 m_origin{};
+        float m_voxel_size{};
+    };
+}
+
+#endif //BOIDS_SIMULATION_SDF_HPP
@@ -1,25 +1,70 @@
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <glm/glm.hpp>
 #include "shader_program.hpp"
 #include "gl_debug.h"
 
-common::ShaderProgram::ShaderProgram(const std::string &vert_path, const std::string &frag_path)
-: m_parsing_failed(false), m_id(0) {
-    std::string vert_source = this->parse_shader(vert_path.c_str());
-    std::string frag_source = this->parse_shader(frag_path.c_str());
+std::string common::ShaderProgram::s_binary_cache_directory;
 
-    if (m_parsing_failed) {
-        return;
-    }
+common::ShaderProgram::ShaderProgram(const std::string &vert_path, const std::string &frag_path)
+: m_parsing_failed(false), m_id(0),
+  m_types{ GL_VERTEX_SHADER, GL_FRAGMENT_SHADER },
+  m_paths{ vert_path, frag_path } {
+    m_id = build(true);
+}
 
-    m_id = create_shader_program(vert_source, frag_source);
+common::ShaderProgram::ShaderProgram(const std::string &comp_path)
+: m_parsing_failed(false), m_id(0),
+  m_types{ GL_COMPUTE_SHADER },
+  m_paths{ comp_path } {
+    m_id = build(true);
 }
 
 common::ShaderProgram::~ShaderProgram() {
     GLCall( glDeleteProgram(m_id) );
 }
 
+void common::ShaderProgram::set_binary_cache_directory(const std::string &directory) {
+    s_binary_cache_directory = directory;
+}
+
+bool common::ShaderProgram::reload_if_changed() {
+    bool changed = false;
+    for (size_t i = 0; i < m_paths.size(); ++i) {
+        std::error_code error;
+        auto write_time = std::filesystem::last_write_time(m_paths[i], error);
+        changed = changed || (!error && write_time != m_write_times[i]);
+    }
+    if (!changed) {
+        return false;
+    }
+
+    GLuint program = build(false);
+    if (program == 0) {
+        std::cerr << "[Shader Reload]: Keeping the previous program of " << m_paths.front() << std::endl;
+        return false;
+    }
+
+    GLCall( glDeleteProgram(m_id) );
+    m_id = program;
+    m_parsing_failed = false;
+
+    // Locations belong to the old program
+    m_uniform_location_cache.clear();
+
+    this->bind();
+    for (const auto &[name, value] : m_uniform_values) {
+        apply_uniform(get_uniform_location(name.c_str()), value);
+    }
+    for (const auto &[name, binding] : m_block_bindings) {
+        apply_uniform_block(name, binding);
+    }
+
+    std::cout << "[Shader Reload]: Reloaded " << m_paths.front() << std::endl;
+    return true;
+}
+
 void common::ShaderProgram::bind() const {
     GLCall( glUseProgram(m_id) );
 
@@ -42,54 +87,81 @@ GLint common::ShaderProgram::get_uniform_location(const char *name) {
     return location;
 }
 
-void common::ShaderProgram::set_uniform_1i(const char* name, int value) {
+void common::ShaderProgram::set_uniform(const char *name, const UniformValue &value) {
     this->bind();
-    GLCall( glUniform1i(get_uniform_location(name), value) );
+    apply_uniform(get_uniform_location(name), value);
+    m_uniform_values[name] = value;
+}
+
+void common::ShaderProgram::apply_uniform(GLint location, const UniformValue &value) {
+    const GLint *i = value.ints;
+    const float *f = value.floats;
+    switch (value.type) {
+        case UniformValue::Type::Int1: GLCall( glUniform1i(location, i[0]) ); break;
+        case UniformValue::Type::Int2: GLCall( glUniform2i(location, i[0], i[1]) ); break;
+        case UniformValue::Type::Float1: GLCall( glUniform1f(location, f[0]) ); break;
+        case UniformValue::Type::Float2: GLCall( glUniform2f(location, f[0], f[1]) ); break;
+        case UniformValue::Type::Float3: GLCall( glUniform3f(location, f[0], f[1], f[2]) ); break;
+        case UniformValue::Type::Float4: GLCall( glUniform4f(location, f[0], f[1], f[2], f[3]) ); break;
+        case UniformValue::Type::Mat3: GLCall( glUniformMatrix3fv(location, 1, GL_FALSE, f) ); break;
+        case UniformValue::Type::Mat4: GLCall( glUniformMatrix4fv(location, 1, GL_FALSE, f) ); break;
+    }
+}
+
+void common::ShaderProgram::bind_uniform_block(const char *name, GLuint binding) {
+    apply_uniform_block(name, binding);
+    m_block_bindings[name] = binding;
+}
+
+void common::ShaderProgram::apply_uniform_block(const std::string &name, GLuint binding) const {
+    GLCall( GLuint index = glGetUniformBlockIndex(m_id, name.c_str()) );
+    if (index != GL_INVALID_INDEX) {
+        GLCall( glUniformBlockBinding(m_id, index, binding) );
+    }
+}
+
+void common::ShaderProgram::set_uniform_1i(const char* name, int value) {
+    set_uniform(name, { UniformValue::Type::Int1, { value } });
 }
 
 void common::ShaderProgram::set_uniform_2i(const char* name, int v1, int v2) {
-    this->bind();
-    GLCall( glUniform2i(get_uniform_location(name), v1, v2) );
+    set_uniform(name, { UniformValue::Type::Int2, { v1, v2 } });
 }
 
 void common::ShaderProgram::set_uniform_1f(const char* name, float value) {
-    this->bind();
-    GLCall( glUniform1f(get_uniform_location(name), value) );
+    set_uniform(name, { UniformValue::Type::Float1, {}, { value } });
 }
 
 void common::ShaderProgram::set_uniform_2f(const char* name, float f0, float f1) {
-    this->bind();
-    GLCall( glUniform2f(get_uniform_location(name), f0, f1) );
+    set_uniform(name, { UniformValue::Type::Float2, {}, { f0, f1 } });
 }
 
 void common::ShaderProgram::set_uniform_3f(const char* name, float f0, float f1, float f2) {
-    this->bind();
-    GLCall( glUniform3f(get_uniform_location(name), f0, f1, f2) );
+    set_uniform(name, { UniformValue::Type::Float3, {}, { f0, f1, f2 } });
 }
 
 void common::ShaderProgram::set_uniform_3f(const char* name, glm::vec3 vec) {
-    this->bind();
-    GLCall( glUniform3f(get_uniform_location(name), vec.x, vec.y, vec.z) );
+    set_uniform(name, { UniformValue::Type::Float3, {}, { vec.x, vec.y, vec.z } });
 }
 
 void common::ShaderProgram::set_uniform_4f(const char* name, float f0, float f1, float f2, float f3) {
-    this->bind();
-    GLCall( glUniform4f(get_uniform_location(name), f0, f1, f2, f3) );
+    set_uniform(name, { UniformValue::Type::Float4, {}, { f0, f1, f2, f3 } });
 }
 
 void common::ShaderProgram::set_uniform_4f(const char* name, glm::vec4 vec) {
-    this->bind();
-    GLCall( glUniform4f(get_uniform_location(name), vec.x, vec.y, vec.z, vec.w) );
+    set_uniform(name, { UniformValue::Type::Float4, {}, { vec.x, vec.y, vec.z, vec.w } });
 }
 
 void common::ShaderProgram::set_uniform_mat3f(const char* name, const glm::mat3& matrix) {
-    this->bind();
-    GLCall(glUniformMatrix3fv(get_uniform_location(name), 1, GL_FALSE, &matrix[0][0]));
+    UniformValue value { UniformValue::Type::Mat3 };
+    std::memcpy(value.floats, &matrix[0][0], sizeof(matrix));
+    set_uniform(name, value);
 }
 
 void common::ShaderProgram::set_uniform_mat4f(const char* name, const glm::mat4& matrix) {
-    this->bind();
-    GLCall( glUniformMatrix4fv(get_uniform_location(name), 1, GL_FALSE, &matrix[0][0]) );
+    UniformValue value { UniformValue::Type::Mat4 };
+    std::memcpy(value.floats, &matrix[0][0], sizeof(matrix));
+    set_uniform(name, value);
 }
 
 std::string common::ShaderProgram::parse_shader(const char *filepath) {
@@ -109,7 +181,46 @@ std::string common::ShaderProgram::parse_shader(const char *filepath) {
     return std::move(ss.str());
 }
 
-GLuint common::ShaderProgram::compile_shader(GLenum type, const std::string &source) {
+GLuint common::ShaderProgram::build(bool fatal) {
+    // Write times are taken before reading, an edit made while parsing triggers one more reload
+    std::vector<std::filesystem::file_time_type> write_times;
+    for (const std::string &path : m_paths) {
+        std::error_code error;
+        write_times.push_back(std::filesystem::last_write_time(path, error));
+    }
+
+    bool parsing_failed = m_parsing_failed;
+    m_parsing_failed = false;
+
+    std::vector<std::string> sources;
+    for (const std::string &path : m_paths) {
+        sources.push_back(this->parse_shader(path.c_str()));
+    }
+
+    // Also on failure, so a broken file is retried only after its next edit
+    m_write_times = std::move(write_times);
+
+    if (m_parsing_failed) {
+        m_parsing_failed = fatal || parsing_failed;
+        return 0;
+    }
+
+    std::string key;
+    if (binary_cache_enabled()) {
+        key = binary_cache_key(sources);
+        if (GLuint program = load_binary(key)) {
+            return program;
+        }
+    }
+
+    GLuint program = create_shader_program(m_types, sources, fatal);
+    if (program != 0 && !key.empty()) {
+        save_binary(program, key);
+    }
+    return program;
+}
+
+GLuint common::ShaderProgram::compile_shader(GLenum type, const std::string &source, bool fatal) {
     GLCall( GLenum id = glCreateShader(type) );
 
     const char* src = source.c_str();
@@ -119,7 +230,7 @@ GLuint common::ShaderProgram::compile_shader(GLenum type, const std::string &sou
     // Error handling
     int result;
     GLCall( glGetShaderiv(id, GL_COMPILE_STATUS, &result) );
-    std::cout << "[Shader Compiler]: " << (type == GL_VERTEX_SHADER ? "vertex" : "fragment") << " shader compile status: " << result << std::endl;
+    std::cout << "[Shader Compiler]: " << shader_type_name(type) << " shader compile status: " << result << std::endl;
     if ( result == GL_FALSE )
     {
         int length;
@@ -128,24 +239,50 @@ GLuint common::ShaderProgram::compile_shader(GLenum type, const std::string &sou
         GLCall( glGetShaderInfoLog(id, length, &length, message) );
         std::cerr << "[Shader Compiler]: "
                   << "Failed to compile "
-                  << (type == GL_VERTEX_SHADER ? "vertex" : "fragment")
-                  << "shader"
+                  << shader_type_name(type)
+                  << " shader"
                   << std::endl;
         std::cerr << message << std::endl;
         GLCall( glDeleteShader(id) );
-        std::terminate();
+        if (fatal) {
+            std::terminate();
+        }
+        return 0;
     }
 
     return id;
 }
 
-GLuint common::ShaderProgram::create_shader_program(const std::string &vert_shader, const std::string &frag_shader) {
+GLuint common::ShaderProgram::create_shader_program(const std::vector<GLenum> &types, const std::vector<std::string> &sources, bool fatal) {
     unsigned int program = glCreateProgram();
-    unsigned int vs = compile_shader(GL_VERTEX_SHADER, vert_shader);
-    unsigned int fs = compile_shader(GL_FRAGMENT_SHADER, frag_shader);
 
-    GLCall( glAttachShader(program, vs) );
-    GLCall( glAttachShader(program, fs) );
+    std::vector<GLuint> shaders;
+    for (size_t i = 0; i < types.size(); ++i) {
+        GLuint shader = compile_shader(types[i], sources[i], fatal);
+        if (shader == 0) {
+            break;
+        }
+        GLCall( glAttachShader(program, shader) );
+        shaders.push_back(shader);
+    }
+
+    bool linked = shaders.size() == types.size() && link_program(program, fatal);
+
+    for (GLuint shader : shaders) {
+        GLCall( glDeleteShader(shader) );
+    }
+
+    if (!linked) {
+        GLCall( glDeleteProgram(program) );
+        return 0;
+    }
+    return program;
+}
+
+bool common::ShaderProgram::link_program(GLuint program, bool fatal) {
+    if (binary_cache_enabled()) {
+        GLCall( glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE) );
+    }
 
     GLCall( glLinkProgram(program) );
 
@@ -160,17 +297,129 @@ GLuint common::ShaderProgram::create_shader_program(const std::string &vert_shad
         GLCall( glGetProgramInfoLog(program, 1024, &log_length, message) );
         std::cerr << "[Shader Linker]: Failed to link program" << std::endl;
         std::cerr << message << std::endl;
-        std::terminate();
+        if (fatal) {
+            std::terminate();
+        }
+        return false;
     }
 
     GLCall( glValidateProgram(program) );
 
-    GLCall( glDeleteShader(vs) );
-    GLCall( glDeleteShader(fs) );
+    return true;
+}
+
+const char* common::ShaderProgram::shader_type_name(GLenum type) {
+    switch (type) {
+        case GL_VERTEX_SHADER: return "vertex";
+        case GL_FRAGMENT_SHADER: return "fragment";
+        case GL_COMPUTE_SHADER: return "compute";
+        default: return "unknown";
+    }
+}
+
+bool common::ShaderProgram::binary_cache_enabled() {
+    if (s_binary_cache_directory.empty() || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)) {
+        return false;
+    }
 
+    GLint formats = 0;
+    GLCall( glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats) );
+    return formats > 0;
+}
+
+std::string common::ShaderProgram::binary_cache_key(const std::vector<std::string> &sources) {
+    // FNV-1a over the sources and the driver, a driver update invalidates every binary
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const char *data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * 1099511628211ull;
+        }
+        // Separator, so moving text from one source to the next changes the key
+        hash = (hash ^ 0xFFu) * 1099511628211ull;
+    };
+
+    for (const std::string &source : sources) {
+        mix(source.data(), source.size());
+    }
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        auto value = reinterpret_cast<const char *>(glGetString(name));
+        mix(value ? value : "", value ? std::strlen(value) : 0);
+    }
+
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
+}
+
+GLuint common::ShaderProgram::load_binary(const std::string &key) {
+    std::filesystem::path path = std::filesystem::path(s_binary_cache_directory) / (key + ".bin");
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return 0;
+    }
+
+    GLenum format = 0;
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+
+    // Stale binaries are deleted, the program compiled from source replaces them
+    auto discard = [&path, &key]() {
+        std::cout << "[Shader Cache]: Discarding stale program " << key << std::endl;
+        std::error_code error;
+        std::filesystem::remove(path, error);
+        return GLuint(0);
+    };
+
+    if (binary.size() <= sizeof(format)) {
+        return discard();
+    }
+    std::memcpy(&format, binary.data(), sizeof(format));
+
+    // Not wrapped in GLCall: a format the driver no longer supports raises GL_INVALID_ENUM, which is
+    // expected here and must not abort
+    GLuint program = glCreateProgram();
+    GLClearError();
+    glProgramBinary(program, format, binary.data() + sizeof(format), static_cast<GLsizei>(binary.size() - sizeof(format)));
+    bool rejected = glGetError() != GL_NO_ERROR;
+    GLClearError();
+
+    // The driver may also reject binaries of another build by failing the link
+    GLint program_linked = GL_FALSE;
+    if (!rejected) {
+        GLCall( glGetProgramiv(program, GL_LINK_STATUS, &program_linked) );
+    }
+    if (program_linked != GL_TRUE) {
+        GLCall( glDeleteProgram(program) );
+        return discard();
+    }
+
+    std::cout << "[Shader Cache]: Loaded program " << key << std::endl;
     return program;
 }
 
+void common::ShaderProgram::save_binary(GLuint program, const std::string &key) {
+    GLint length = 0;
+    GLCall( glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length) );
+    if (length <= 0) {
+        return;
+    }
+
+    GLenum format = 0;
+    std::vector<char> binary(sizeof(format) + length);
+    GLCall( glGetProgramBinary(program, length, nullptr, &format, binary.data() + sizeof(format)) );
+    std::memcpy(binary.data(), &format, sizeof(format));
+
+    std::error_code error;
+    std::filesystem::create_directories(s_binary_cache_directory, error);
+
+    std::ofstream file(std::filesystem::path(s_binary_cache_directory) / (key + ".bin"), std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "[Shader Cache]: Cannot write program " << key << " to " << s_binary_cache_directory << std::endl;
+        return;
+    }
+    file.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+}
+
 bool common::ShaderProgram::is_valid() const {
     return !m_parsing_failed;
 }
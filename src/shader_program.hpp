@@ -2,15 +2,32 @@
 #define SHADER_PROGRAM_HPP
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <filesystem>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace common {
     class ShaderProgram {
     public:
         ShaderProgram(const std::string &vert_path, const std::string &frag_path);
+
+        // Compute program, needs GL 4.3
+        explicit ShaderProgram(const std::string &comp_path);
         ~ShaderProgram();
 
+        ShaderProgram(const ShaderProgram &) = delete;
+        ShaderProgram &operator=(const ShaderProgram &) = delete;
+
+        // Linked programs are cached in `directory`, keyed by the sources and the driver. Needs GL 4.1 or
+        // ARB_get_program_binary, an empty directory turns the cache off. Applies to programs built afterwards.
+        static void set_binary_cache_directory(const std::string &directory);
+
+        // Rebuilds the program if one of its source files changed since it was built, the old program stays
+        // in use if the new sources do not compile. Uniform values set so far are applied to the new program.
+        // Returns true if the program was replaced.
+        bool reload_if_changed();
+
         bool is_valid() const;
 
         void bind() const;
@@ -27,21 +44,54 @@ namespace common {
         void set_uniform_mat3f(const char* name, const glm::mat3& matrix);
         void set_uniform_mat4f(const char* name, const glm::mat4& matrix);
 
+        // Attaches the uniform block `name` to a UniformBuffer binding point, ignored if the program lacks the block
+        void bind_uniform_block(const char* name, GLuint binding);
+
         GLuint get_id() const { return m_id; }
 
     private:
+        // Last value of a uniform, replayed after a reload
+        struct UniformValue {
+            enum class Type { Int1, Int2, Float1, Float2, Float3, Float4, Mat3, Mat4 } type;
+            GLint ints[2];
+            float floats[16];
+        };
+
         GLint get_uniform_location(const char* name);
+        void set_uniform(const char* name, const UniformValue &value);
+        static void apply_uniform(GLint location, const UniformValue &value);
+        void apply_uniform_block(const std::string &name, GLuint binding) const;
+
         std::string parse_shader(const char* filepath);
 
-        static GLuint compile_shader(GLenum type, const std::string& source);
-        static GLuint create_shader_program(const std::string& vert_shader, const std::string& frag_shader);
+        // Parses the sources and builds the program from the binary cache or from source, 0 on failure.
+        // A failing initial build terminates, as it always did, a failing reload only reports the error.
+        GLuint build(bool fatal);
+
+        static GLuint compile_shader(GLenum type, const std::string& source, bool fatal);
+        static GLuint create_shader_program(const std::vector<GLenum>& types, const std::vector<std::string>& sources, bool fatal);
+        static bool link_program(GLuint program, bool fatal);
+        static const char* shader_type_name(GLenum type);
+
+        static bool binary_cache_enabled();
+        static std::string binary_cache_key(const std::vector<std::string>& sources);
+        static GLuint load_binary(const std::string& key);
+        static void save_binary(GLuint program, const std::string& key);
 
     private:
         GLuint m_id;
         bool m_parsing_failed;
         std::unordered_map<std::string, int> m_uniform_location_cache;
+        std::unordered_map<std::string, UniformValue> m_uniform_values;
+        std::unordered_map<std::string, GLuint> m_block_bindings;
+
+        std::vector<GLenum> m_types;
+        std::vector<std::string> m_paths;
+        std::vector<std::filesystem::file_time_type> m_write_times;
+
+        static std::string s_binary_cache_directory;
     };
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,19 @@
+#include "simulation_state.hpp"
+
+boids::SimulationState::SimulationState(const SimulationParameters &sim_params)
+: m_first(sim_params), m_second(m_first), m_front(&m_first), m_back(&m_second) {
+}
+
+boids::SimulationState::SimulationState(const Boids &boids)
+: m_first(boids), m_second(boids), m_front(&m_first), m_back(&m_second) {
+}
+
+void boids::SimulationState::reset(const SimulationParameters &sim_params) {
+    m_front->reset(sim_params);
+    *m_back = *m_front;
+}
+
+void boids::SimulationState::reset(const Boids &boids) {
+    *m_front = boids;
+    *m_back = boids;
+}
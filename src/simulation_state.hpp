@@ -0,0 +1,46 @@
+#ifndef BOIDS_SIMULATION_SIMULATION_STATE_HPP
+#define BOIDS_SIMULATION_SIMULATION_STATE_HPP
+#include <vector>
+#include "boids.hpp"
+
+namespace boids {
+    // Front and back buffers of the boids. Solvers read the previous step from the front buffer, write
+    // the new one to the back buffer and swap, so every per-boid phase is independent of the boid order.
+    class SimulationState {
+    public:
+        SimulationState() = delete;
+        explicit SimulationState(const SimulationParameters &sim_params);
+        explicit SimulationState(const Boids &boids);
+
+        // The buffers are referenced by pointers, so the state must stay in place
+        SimulationState(const SimulationState &) = delete;
+        SimulationState &operator=(const SimulationState &) = delete;
+
+        // Sets random positions in the front buffer and mirrors them to the back buffer
+        void reset(const SimulationParameters &sim_params);
+
+        // Starts from the given boids in both buffers
+        void reset(const Boids &boids);
+
+        // Last completed step
+        const Boids &front() const { return *m_front; }
+
+        // Writable last step, for hosts editing boids between steps
+        Boids &front() { return *m_front; }
+
+        // Step being computed
+        Boids &back() { return *m_back; }
+
+        // Publishes the back buffer as the new front buffer
+        void swap() { std::swap(m_front, m_back); }
+
+    private:
+        Boids m_first;
+        Boids m_second;
+
+        Boids *m_front;
+        Boids *m_back;
+    };
+}
+
+#endif //BOIDS_SIMULATION_SIMULATION_STATE_HPP
@@ -0,0 +1,184 @@
+#include "simulation_thread.hpp"
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include "boids_cpu.hpp"
+
+boids::SimulationThread::SimulationThread(const Boids &boids, const SignedDistanceField &environment)
+: m_state(boids),
+  m_environment(std::make_shared<const SignedDistanceField>(environment)) {
+    m_thread = std::thread(&SimulationThread::run, this);
+}
+
+boids::SimulationThread::~SimulationThread() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_step_requested.notify_one();
+    m_thread.join();
+}
+
+void boids::SimulationThread::reset(const Boids &boids) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending_reset = std::make_unique<Boids>(boids);
+}
+
+void boids::SimulationThread::set_environment(const SignedDistanceField &environment) {
+    auto copy = std::make_shared<const SignedDistanceField>(environment);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending_environment = std::move(copy);
+}
+
+void boids::SimulationThread::set_analytics(const cpu::AnalyticsSettings &settings) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending_analytics = settings;
+}
+
+void boids::SimulationThread::set_fields(const cpu::FieldSettings &settings) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending_fields = settings;
+}
+
+void boids::SimulationThread::request_snapshot() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_snapshot_requested = true;
+}
+
+void boids::SimulationThread::request_step(const SimulationParameters &params, const Obstacles &obstacles, bool use_grid, float dt) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // A step still waiting is replaced, the simulation never runs more than one frame ahead
+        m_request = StepRequest { params, obstacles, use_grid, dt, ++m_requested_sequence };
+    }
+    m_step_requested.notify_one();
+}
+
+bool boids::SimulationThread::wait_frame() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_step_completed.wait(lock, [this] { return m_completed_sequence == m_requested_sequence; });
+    }
+    return m_frames.acquire();
+}
+
+void boids::SimulationThread::run() {
+    while (true) {
+        StepRequest request;
+        std::unique_ptr<Boids> reset;
+        std::optional<cpu::AnalyticsSettings> analytics;
+        std::optional<cpu::FieldSettings> fields;
+        bool snapshot;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_step_requested.wait(lock, [this] { return m_stop || m_request.has_value(); });
+            if (m_stop) {
+                return;
+            }
+
+            request = std::move(*m_request);
+            m_request.reset();
+            reset = std::move(m_pending_reset);
+            if (m_pending_environment) {
+                m_environment = std::move(m_pending_environment);
+            }
+            analytics = std::move(m_pending_analytics);
+            m_pending_analytics.reset();
+            fields = std::move(m_pending_fields);
+            m_pending_fields.reset();
+            snapshot = std::exchange(m_snapshot_requested, false);
+        }
+
+        if (reset) {
+            m_state.reset(*reset);
+            m_step = 0;
+        }
+        if (analytics) {
+            const cpu::AnalyticsSettings &previous = m_analytics.settings();
+            if (analytics->output_path != previous.output_path || analytics->output_format != previous.output_format) {
+                m_metrics_writer.reset();
+                if (!analytics->output_path.empty()) {
+                    m_metrics_writer = std::make_unique<cpu::MetricsWriter>(analytics->output_path, analytics->output_format);
+                }
+            }
+            m_analytics.set_settings(*analytics);
+        }
+        if (fields) {
+            if (fields->output_path != m_field_settings.output_path) {
+                m_field_writer.reset();
+                if (!fields->output_path.empty()) {
+                    m_field_writer = std::make_unique<cpu::FieldStreamWriter>(fields->output_path);
+                }
+            }
+            m_field_settings = *fields;
+        }
+
+        auto step_start = std::chrono::steady_clock::now();
+        if (request.use_grid) {
+            cpu::update_simulation_with_grid(request.params, request.obstacles, m_environment->view(), m_grid, m_state, request.dt);
+        } else {
+            cpu::update_simulation_naive(request.params, request.obstacles, m_environment->view(), m_state, request.dt);
+        }
+        std::chrono::duration<float, std::milli> step_time = std::chrono::steady_clock::now() - step_start;
+        ++m_step;
+
+        const Boids &boids = m_state.front();
+
+        // Rebuilds the grid on the new positions, the grid solver builds it again before its next step anyway
+        if (m_analytics.should_sample(m_step)) {
+            m_analytics.compute(request.params, m_grid, boids.position, boids.velocity, m_step);
+            if (m_metrics_writer) {
+                m_metrics_writer->write(m_analytics.metrics());
+            }
+        }
+
+        bool field_sampled = m_field_settings.enabled && m_step % uint64_t(std::max(m_field_settings.sample_every, 1)) == 0;
+        if (field_sampled) {
+            m_field_rasterizer.rasterize(request.params, m_field_settings, boids.position, boids.velocity, m_step);
+            if (m_field_writer) {
+                m_field_writer->write(m_field_rasterizer.field());
+            }
+        }
+
+        size_t count = request.params.boids_count;
+        SimulationFrame &frame = m_frames.write_buffer();
+        frame.params = request.params;
+        // The render thread only needs the instances, the raw state is copied when asked for
+        if (snapshot) {
+            frame.position.assign(boids.position.begin(), boids.position.begin() + count);
+            frame.velocity.assign(boids.velocity.begin(), boids.velocity.begin() + count);
+        } else {
+            frame.position.clear();
+            frame.velocity.clear();
+        }
+
+        // Packed here, so the render thread only copies the instances into the mapped buffer
+        if (request.params.shader_orientation) {
+            frame.instances.clear();
+            frame.velocity_instances.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                frame.velocity_instances[i] = { glm::vec3(boids.position[i]), boids.velocity[i] };
+            }
+        } else {
+            frame.velocity_instances.clear();
+            frame.instances.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                frame.instances[i] = PackedBoidInstance::pack(boids.position[i], boids.orientation.forward[i], boids.orientation.up[i], boids.orientation.right[i]);
+            }
+        }
+        frame.step_time_ms = step_time.count();
+        frame.metrics = m_analytics.metrics();
+        // Every buffer of the triple buffer has to catch up with the latest field, not only the sampled one
+        if (m_field_settings.enabled) {
+            frame.field = m_field_rasterizer.field();
+        }
+        m_frames.publish();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_completed_sequence = request.sequence;
+        }
+        m_step_completed.notify_all();
+    }
+}
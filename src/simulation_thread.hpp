@@ -0,0 +1,117 @@
+#ifndef BOIDS_SIMULATION_SIMULATION_THREAD_HPP
+#define BOIDS_SIMULATION_SIMULATION_THREAD_HPP
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "boids.hpp"
+#include "density_field.hpp"
+#include "flock_analytics.hpp"
+#include "sdf.hpp"
+#include "simulation_state.hpp"
+#include "spatial_grid.hpp"
+#include "triple_buffer.hpp"
+
+namespace boids {
+    // Completed step published to the render thread
+    struct SimulationFrame {
+        SimulationParameters params;
+
+        // Raw state of the simulated boids, only in the step following request_snapshot, empty otherwise
+        std::vector<glm::vec4> position;
+        std::vector<glm::vec3> velocity;
+
+        // Only one of them is filled, depending on params.shader_orientation
+        std::vector<PackedBoidInstance> instances;
+        std::vector<VelocityBoidInstance> velocity_instances;
+        float step_time_ms{};
+
+        // Latest sample, metrics.step is 0 before the first one
+        cpu::FlockMetrics metrics;
+
+        // Latest rasterized density and velocity field, field.step is 0 before the first one
+        cpu::DensityField field;
+    };
+
+    // Runs the CPU solvers on a dedicated thread. Every frame the render thread requests the next step
+    // and draws the latest completed one meanwhile, so the solver overlaps with rendering and ImGui.
+    class SimulationThread {
+    public:
+        SimulationThread() = delete;
+        SimulationThread(const Boids &boids, const SignedDistanceField &environment);
+        ~SimulationThread();
+
+        SimulationThread(const SimulationThread &) = delete;
+        SimulationThread &operator=(const SimulationThread &) = delete;
+
+        // Restarts the simulation from `boids` before the next step
+        void reset(const Boids &boids);
+
+        // Environment used for wall avoidance from the next step on
+        void set_environment(const SignedDistanceField &environment);
+
+        // Analytics computed after the steps from the next one on, a changed output path starts a new file
+        void set_analytics(const cpu::AnalyticsSettings &settings);
+
+        // Same for the density and velocity fields
+        void set_fields(const cpu::FieldSettings &settings);
+
+        // Asks for one step with the current parameters and obstacles, returns immediately
+        void request_step(const SimulationParameters &params, const Obstacles &obstacles, bool use_grid, float dt);
+
+        // The next step also copies positions and velocities into its frame, for measurements on the raw state
+        void request_snapshot();
+
+        // Takes the latest completed step, returns false if none was completed since the last call
+        bool acquire_frame() { return m_frames.acquire(); }
+        const SimulationFrame &frame() const { return m_frames.read_buffer(); }
+
+        // Blocks until the last requested step is completed and takes it, for fixed step runs
+        bool wait_frame();
+
+    private:
+        struct StepRequest {
+            SimulationParameters params;
+            Obstacles obstacles;
+            bool use_grid;
+            float dt;
+            uint64_t sequence;
+        };
+
+        void run();
+
+    private:
+        // Owned by the simulation thread
+        SimulationState m_state;
+        cpu::SpatialGrid m_grid;
+        std::shared_ptr<const SignedDistanceField> m_environment;
+        cpu::FlockAnalytics m_analytics;
+        std::unique_ptr<cpu::MetricsWriter> m_metrics_writer;
+        cpu::FieldSettings m_field_settings;
+        cpu::FieldRasterizer m_field_rasterizer;
+        std::unique_ptr<cpu::FieldStreamWriter> m_field_writer;
+        uint64_t m_step = 0;
+
+        // Guarded by m_mutex
+        std::mutex m_mutex;
+        std::condition_variable m_step_requested;
+        std::condition_variable m_step_completed;
+        uint64_t m_requested_sequence = 0;
+        uint64_t m_completed_sequence = 0;
+        std::optional<StepRequest> m_request;
+        std::unique_ptr<Boids> m_pending_reset;
+        std::shared_ptr<const SignedDistanceField> m_pending_environment;
+        std::optional<cpu::AnalyticsSettings> m_pending_analytics;
+        std::optional<cpu::FieldSettings> m_pending_fields;
+        bool m_snapshot_requested = false;
+        bool m_stop = false;
+
+        common::TripleBuffer<SimulationFrame> m_frames;
+
+        std::thread m_thread;
+    };
+}
+
+#endif //BOIDS_SIMULATION_SIMULATION_THREAD_HPP
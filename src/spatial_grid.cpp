@@ -0,0 +1,286 @@
+#include "spatial_grid.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    constexpr uint64_t EMPTY_KEY = ~0ull;
+
+    // Finalizer of MurmurHash3, spreads nearby coordinates over the whole table
+    uint64_t hash_key(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+}
+
+void boids::cpu::SpatialGrid::build(const SimulationParameters &params, const std::vector<glm::vec4> &position, const std::vector<glm::vec3> &velocity) {
+    m_periodic = params.periodic();
+    m_open = params.boundary_mode == BoundaryMode::Open;
+    m_period = params.aquarium_size;
+
+    // Smaller cells let more of them lie fully inside the view sphere, but keep the table bounded.
+    // The open world stores occupied cells only, so it needs no bound.
+    float volume = params.aquarium_size.x * params.aquarium_size.y * params.aquarium_size.z;
+    float cell_size = params.distance / float(std::max(params.grid_subdivision, 1));
+
+    // The capped metric mode searches shells of cells nearest first, cells holding about max_neighbors boids
+    // at the mean density let it stop after a few shells however large the view radius. The open world has
+    // no bounded window to clip the shells to, its cells stay sized by the view radius.
+    int neighbor_cap = params.neighbor_cap();
+    if (!m_open && neighbor_cap > 0 && params.interaction_mode == InteractionMode::Metric && params.boids_count > 0) {
+        cell_size = std::min(cell_size, std::cbrt(volume * float(neighbor_cap) / float(params.boids_count)));
+    }
+    if (!m_open) {
+        cell_size = std::max(cell_size, std::cbrt(volume / float(MAX_CELL_COUNT)) * 1.01f);
+    }
+    m_origin = -params.aquarium_size / 2.f;
+
+    if (m_periodic) {
+        // Whole number of cells per axis, so the last cell borders the first one
+        m_grid_size = glm::max(glm::ivec3(glm::floor(params.aquarium_size / cell_size)), glm::ivec3(1));
+        m_cell_size = params.aquarium_size / glm::vec3(m_grid_size);
+    } else {
+        m_grid_size = glm::max(glm::ivec3(glm::ceil(params.aquarium_size / cell_size)), glm::ivec3(1));
+        m_cell_size = glm::vec3(cell_size);
+    }
+    m_search_range = glm::ivec3(glm::ceil(params.distance / m_cell_size));
+    m_coords_min = glm::ivec3(0);
+    m_coords_max = m_grid_size - 1;
+
+    uint32_t boids_count = uint32_t(params.boids_count);
+    m_cell_id.resize(boids_count);
+    m_sorted_ids.resize(boids_count);
+
+    size_t cell_count;
+    if (m_open) {
+        // Twice as many slots as boids keeps the probe sequences short
+        size_t capacity = 16;
+        while (capacity < 2 * size_t(boids_count)) {
+            capacity <<= 1;
+        }
+        m_table_keys.assign(capacity, EMPTY_KEY);
+        m_table_cells.resize(capacity);
+        m_aggregate.clear();
+        m_cell_coords.clear();
+
+        m_coords_min = glm::ivec3(MAX_OPEN_COORD);
+        m_coords_max = glm::ivec3(-MAX_OPEN_COORD);
+        for (BoidId b_id = 0; b_id < boids_count; ++b_id) {
+            glm::ivec3 coords = get_cell_coords(position[b_id]);
+            m_coords_min = glm::min(m_coords_min, coords);
+            m_coords_max = glm::max(m_coords_max, coords);
+
+            uint64_t key = pack_coords(coords);
+            size_t slot = find_slot(key);
+            if (m_table_keys[slot] == EMPTY_KEY) {
+                m_table_keys[slot] = key;
+                m_table_cells[slot] = CellId(m_aggregate.size());
+                m_aggregate.push_back(CellAggregate { 0, glm::vec3(0.f), glm::vec3(0.f) });
+                m_cell_coords.push_back(coords);
+            }
+            m_cell_id[b_id] = m_table_cells[slot];
+        }
+        m_grid_size = glm::max(m_coords_max - m_coords_min + 1, glm::ivec3(1));
+
+        // Lookups of cells without boids resolve to an extra empty cell
+        cell_count = m_aggregate.size();
+        m_empty_cell = CellId(cell_count);
+        m_aggregate.push_back(CellAggregate { 0, glm::vec3(0.f), glm::vec3(0.f) });
+        ++cell_count;
+    } else {
+        cell_count = size_t(m_grid_size.x) * m_grid_size.y * m_grid_size.z;
+        m_aggregate.assign(cell_count, CellAggregate { 0, glm::vec3(0.f), glm::vec3(0.f) });
+        for (BoidId b_id = 0; b_id < boids_count; ++b_id) {
+            m_cell_id[b_id] = flatten_coords(get_cell_coords(position[b_id]));
+        }
+    }
+    m_cell_start.assign(cell_count + 1, 0);
+
+    // Count boids per cell and build the aggregates in the same pass
+    for (BoidId b_id = 0; b_id < boids_count; ++b_id) {
+        CellAggregate &aggregate = m_aggregate[m_cell_id[b_id]];
+        ++aggregate.count;
+        aggregate.position_sum += glm::vec3(position[b_id]);
+        aggregate.velocity_sum += velocity[b_id];
+    }
+
+    // Exclusive prefix sum gives the first slot of every cell
+    uint32_t offset = 0;
+    for (size_t cell = 0; cell < cell_count; ++cell) {
+        m_cell_start[cell] = offset;
+        offset += m_aggregate[cell].count;
+    }
+    m_cell_start[cell_count] = offset;
+
+    // Scatter, cell_start temporarily serves as the write cursor
+    for (BoidId b_id = 0; b_id < boids_count; ++b_id) {
+        m_sorted_ids[m_cell_start[m_cell_id[b_id]]++] = b_id;
+    }
+    for (size_t cell = 0; cell < cell_count; ++cell) {
+        m_cell_start[cell] -= m_aggregate[cell].count;
+    }
+}
+
+glm::ivec3 boids::cpu::SpatialGrid::get_cell_coords(glm::vec3 position) const {
+    glm::vec3 cell = glm::floor((position - m_origin) / m_cell_size);
+    if (m_open) {
+        // Clamped before the conversion, far away boids share the outermost cells
+        return glm::ivec3(glm::clamp(cell, glm::vec3(-MAX_OPEN_COORD), glm::vec3(MAX_OPEN_COORD)));
+    }
+
+    glm::ivec3 coords = glm::ivec3(cell);
+    if (m_periodic) {
+        return wrap_coords(coords);
+    }
+
+    // Boids pushed outside the aquarium are kept in the border cells
+    return glm::clamp(coords, glm::ivec3(0), m_grid_size - 1);
+}
+
+boids::cpu::CellId boids::cpu::SpatialGrid::flatten_coords(glm::ivec3 coords) const {
+    if (m_open) {
+        if (glm::any(glm::greaterThan(glm::abs(coords), glm::ivec3(MAX_OPEN_COORD)))) {
+            return m_empty_cell;
+        }
+        size_t slot = find_slot(pack_coords(coords));
+        return m_table_keys[slot] == EMPTY_KEY ? m_empty_cell : m_table_cells[slot];
+    }
+
+    return coords.x + coords.y * m_grid_size.x + coords.z * m_grid_size.x * m_grid_size.y;
+}
+
+glm::ivec3 boids::cpu::SpatialGrid::wrap_coords(glm::ivec3 coords) const {
+    if (!m_periodic) {
+        return coords;
+    }
+    return ((coords % m_grid_size) + m_grid_size) % m_grid_size;
+}
+
+void boids::cpu::SpatialGrid::search_window(glm::ivec3 center, glm::ivec3 range, glm::ivec3 &start, glm::ivec3 &end) const {
+    // Walls bound the window by the grid, the open world by the occupied cells
+    // and the periodic boundary by the images of the grid closest to the center
+    glm::ivec3 lower = m_periodic ? center - (m_grid_size - 1) / 2 : m_coords_min;
+    glm::ivec3 upper = m_periodic ? lower + m_grid_size - 1 : m_coords_max;
+    start = glm::max(center - range, lower);
+    end = glm::min(center + range, upper);
+}
+
+bool boids::cpu::SpatialGrid::window_wraps(glm::ivec3 range) const {
+    return m_periodic && glm::any(glm::greaterThan(2 * range + 1, m_grid_size));
+}
+
+uint64_t boids::cpu::SpatialGrid::pack_coords(glm::ivec3 coords) {
+    glm::ivec3 biased = coords + MAX_OPEN_COORD + 1;
+    return uint64_t(biased.x) | (uint64_t(biased.y) << 21) | (uint64_t(biased.z) << 42);
+}
+
+size_t boids::cpu::SpatialGrid::find_slot(uint64_t key) const {
+    size_t mask = m_table_keys.size() - 1;
+    size_t slot = hash_key(key) & mask;
+    while (m_table_keys[slot] != key && m_table_keys[slot] != EMPTY_KEY) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+glm::vec3 boids::cpu::SpatialGrid::offset(glm::vec3 from, glm::vec3 to) const {
+    glm::vec3 diff = to - from;
+    if (m_periodic) {
+        diff -= m_period * glm::round(diff / m_period);
+    }
+    return diff;
+}
+
+float boids::cpu::SpatialGrid::cell_distance2(glm::vec3 position, glm::ivec3 coords) const {
+    glm::vec3 half_size = 0.5f * m_cell_size;
+    glm::vec3 to_center = offset(position, cell_min(coords) + half_size);
+    glm::vec3 outside = glm::max(glm::abs(to_center) - half_size, glm::vec3(0.f));
+    return glm::dot(outside, outside);
+}
+
+int boids::cpu::SpatialGrid::find_k_nearest(
+        const std::vector<glm::vec4> &position,
+        BoidId self,
+        int k,
+        BoidNeighbor *neighbors
+) const {
+    // `neighbors` is kept as a max-heap on distance, so the current k-th distance is at the front
+    auto farther = [](const BoidNeighbor &a, const BoidNeighbor &b) { return a.distance2 < b.distance2; };
+    int count = 0;
+
+    glm::vec3 pos = glm::vec3(position[self]);
+    glm::ivec3 center = get_cell_coords(pos);
+    int max_shell = std::max(m_grid_size.x, std::max(m_grid_size.y, m_grid_size.z));
+
+    float min_cell_size = std::min(m_cell_size.x, std::min(m_cell_size.y, m_cell_size.z));
+
+    auto visit_cell = [&](glm::ivec3 coords) {
+        // Cells farther than the current k-th neighbour cannot improve the result
+        if (count == k && cell_distance2(pos, coords) >= neighbors[0].distance2) {
+            return;
+        }
+
+        CellId cell = flatten_coords(wrap_coords(coords));
+        for (uint32_t i = cell_start(cell); i < cell_end(cell); ++i) {
+            BoidId other_id = m_sorted_ids[i];
+            if (other_id == self) {
+                continue;
+            }
+
+            glm::vec3 diff = offset(pos, glm::vec3(position[other_id]));
+            float distance2 = glm::dot(diff, diff);
+            if (count < k) {
+                neighbors[count++] = BoidNeighbor { distance2, other_id };
+                std::push_heap(neighbors, neighbors + count, farther);
+            } else if (distance2 < neighbors[0].distance2) {
+                std::pop_heap(neighbors, neighbors + count, farther);
+                neighbors[count - 1] = BoidNeighbor { distance2, other_id };
+                std::push_heap(neighbors, neighbors + count, farther);
+            }
+        }
+    };
+
+    for (int shell = 0; shell < max_shell; ++shell) {
+        // Every cell of this shell is at least (shell - 1) cells away from the boid
+        if (count == k && shell > 0) {
+            float shell_distance = float(shell - 1) * min_cell_size;
+            if (shell_distance * shell_distance >= neighbors[0].distance2) {
+                break;
+            }
+        }
+
+        // Sparse open world: once a shell has more cells than there are occupied ones,
+        // the occupied cells outside the visited shells are checked directly
+        double shell_cells = 2.0 * shell + 1.0;
+        if (m_open && shell_cells * shell_cells * shell_cells > double(m_empty_cell)) {
+            for (CellId cell = 0; cell < m_empty_cell; ++cell) {
+                glm::ivec3 shell_offset = glm::abs(m_cell_coords[cell] - center);
+                if (std::max(shell_offset.x, std::max(shell_offset.y, shell_offset.z)) >= shell) {
+                    visit_cell(m_cell_coords[cell]);
+                }
+            }
+            break;
+        }
+
+        glm::ivec3 start, end;
+        search_window(center, glm::ivec3(shell), start, end);
+        for (int z = start.z; z <= end.z; ++z) {
+            for (int y = start.y; y <= end.y; ++y) {
+                // Visit only the surface of the shell, the inside was visited before
+                bool on_surface = std::abs(z - center.z) == shell || std::abs(y - center.y) == shell;
+                for (int x = start.x; x <= end.x; ++x) {
+                    if (!on_surface && std::abs(x - center.x) != shell) {
+                        x = std::max(x, center.x + shell - 1);
+                        continue;
+                    }
+                    visit_cell(glm::ivec3(x, y, z));
+                }
+            }
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,111 @@
+#ifndef BOIDS_SIMULATION_SPATIAL_GRID_HPP
+#define BOIDS_SIMULATION_SPATIAL_GRID_HPP
+#include <glm/glm.hpp>
+#include <vector>
+#include "boids.hpp"
+#include "neighbor_heap.hpp"
+
+namespace boids::cpu {
+    using CellId = uint32_t;
+
+    // Sums of all boids inside a cell, enough to get their mean position and velocity
+    struct CellAggregate {
+        uint32_t count;
+        glm::vec3 position_sum;
+        glm::vec3 velocity_sum;
+    };
+
+    // Uniform grid over the aquarium rebuilt every step with a counting sort. With the periodic boundary
+    // cell coordinates wrap around, coordinates outside the grid then address periodic images of its cells.
+    // In the open world only occupied cells exist, they are found through a hash table of their coordinates.
+    class SpatialGrid {
+    public:
+        constexpr static const size_t MAX_CELL_COUNT = 1 << 21;
+
+        // Open world cell coordinates are packed to 21 bits per axis
+        constexpr static const int MAX_OPEN_COORD = (1 << 20) - 1;
+
+        SpatialGrid() = default;
+
+        void build(const SimulationParameters &params, const std::vector<glm::vec4> &position, const std::vector<glm::vec3> &velocity);
+
+        glm::ivec3 get_cell_coords(glm::vec3 position) const;
+        // In the open world, cells without boids map to an empty cell
+        CellId flatten_coords(glm::ivec3 coords) const;
+
+        // Maps coordinates of a periodic image back into the grid, identity with walls
+        glm::ivec3 wrap_coords(glm::ivec3 coords) const;
+
+        // Cells to visit around `center` with `range` cells in each direction, each cell of the grid
+        // is contained at most once. The result must be passed through wrap_coords.
+        void search_window(glm::ivec3 center, glm::ivec3 range, glm::ivec3 &start, glm::ivec3 &end) const;
+
+        // True if the search window with `range` wraps onto itself, periodic images of a cell
+        // then cannot be told apart per cell and distances have to be taken per boid
+        bool window_wraps(glm::ivec3 range) const;
+
+        // Offset between two positions, the shortest periodic image of it with the periodic boundary
+        glm::vec3 offset(glm::vec3 from, glm::vec3 to) const;
+
+        // Lower bound of the squared distance from `position` to any boid of the cell
+        float cell_distance2(glm::vec3 position, glm::ivec3 coords) const;
+
+        // Number of cells to visit in each direction to cover the view radius
+        glm::ivec3 search_range() const { return m_search_range; }
+
+        // Extent of the occupied cells in the open world
+        glm::ivec3 grid_size() const { return m_grid_size; }
+        // Cells are cubes with walls, with the periodic boundary they are stretched to tile the aquarium exactly
+        glm::vec3 cell_size() const { return m_cell_size; }
+        glm::vec3 cell_min(glm::ivec3 coords) const { return m_origin + glm::vec3(coords) * m_cell_size; }
+
+        // Shift to add to positions of boids in the cell to get their image at `coords`
+        glm::vec3 image_offset(glm::ivec3 coords) const { return cell_min(coords) - cell_min(wrap_coords(coords)); }
+
+        // Boids of the cell are sorted_ids()[cell_start(cell) .. cell_end(cell))
+        uint32_t cell_start(CellId cell) const { return m_cell_start[cell]; }
+        uint32_t cell_end(CellId cell) const { return m_cell_start[cell + 1]; }
+        const std::vector<BoidId> &sorted_ids() const { return m_sorted_ids; }
+
+        const CellAggregate &aggregate(CellId cell) const { return m_aggregate[cell]; }
+
+        // Finds up to k nearest boids of `self` searching shells of cells of growing radius,
+        // writes them to `neighbors` (unordered) and returns their count
+        int find_k_nearest(
+                const std::vector<glm::vec4> &position,
+                BoidId self,
+                int k,
+                BoidNeighbor *neighbors
+        ) const;
+
+    private:
+        static uint64_t pack_coords(glm::ivec3 coords);
+
+        // Slot holding `key`, or the empty slot where it would be inserted
+        size_t find_slot(uint64_t key) const;
+
+    private:
+        bool m_periodic{};
+        bool m_open{};
+        glm::vec3 m_period{};
+        glm::vec3 m_cell_size{};
+        glm::ivec3 m_search_range{};
+        glm::vec3 m_origin{};
+        glm::ivec3 m_grid_size{};
+        glm::ivec3 m_coords_min{};
+        glm::ivec3 m_coords_max{};
+
+        // Open world: open addressing table (linear probing) from packed coordinates to cell ids
+        std::vector<uint64_t> m_table_keys;
+        std::vector<CellId> m_table_cells;
+        std::vector<glm::ivec3> m_cell_coords;
+        CellId m_empty_cell{};
+
+        std::vector<CellId> m_cell_id;
+        std::vector<uint32_t> m_cell_start;
+        std::vector<BoidId> m_sorted_ids;
+        std::vector<CellAggregate> m_aggregate;
+    };
+}
+
+#endif //BOIDS_SIMULATION_SPATIAL_GRID_HPP
@@ -0,0 +1,72 @@
+#include "streaming_buffer.hpp"
+#include "gl_debug.h"
+
+common::StreamingBuffer::~StreamingBuffer() {
+    for (GLsync fence : m_fences) {
+        if (fence) {
+            GLCall( glDeleteSync(fence) );
+        }
+    }
+    if (m_id) {
+        GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_id) );
+        GLCall( glUnmapBuffer(GL_ARRAY_BUFFER) );
+        GLCall( glDeleteBuffers(1, &m_id) );
+    }
+}
+
+bool common::StreamingBuffer::supported() {
+    return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+}
+
+bool common::StreamingBuffer::init(size_t segment_size, int segment_count) {
+    if (!supported()) {
+        return false;
+    }
+
+    m_segment_size = segment_size;
+    m_fences.assign(segment_count, nullptr);
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLCall( glGenBuffers(1, &m_id) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, m_id) );
+    GLCall( glBufferStorage(GL_ARRAY_BUFFER, GLsizeiptr(segment_size * segment_count), nullptr, flags) );
+    GLCall( m_mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, GLsizeiptr(segment_size * segment_count), flags) );
+    GLCall( glBindBuffer(GL_ARRAY_BUFFER, 0) );
+
+    if (!m_mapped) {
+        std::cerr << "[StreamingBuffer]: Cannot map the buffer persistently" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void *common::StreamingBuffer::begin_segment() {
+    m_current = (m_current + 1) % int(m_fences.size());
+
+    // Normally already signaled, the segment was drawn two frames ago
+    GLsync &fence = m_fences[m_current];
+    if (fence) {
+        GLenum result;
+        do {
+            GLCall( result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) );
+        } while (result == GL_TIMEOUT_EXPIRED);
+        GLCall( glDeleteSync(fence) );
+        fence = nullptr;
+    }
+
+    return static_cast<char *>(m_mapped) + segment_offset();
+}
+
+void common::StreamingBuffer::end_segment() {
+    if (m_current < 0) {
+        return;
+    }
+
+    // The segment may be drawn again in later frames, the newest fence covers all of them
+    GLsync &fence = m_fences[m_current];
+    if (fence) {
+        GLCall( glDeleteSync(fence) );
+    }
+    GLCall( fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) );
+}
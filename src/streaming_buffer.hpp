@@ -0,0 +1,47 @@
+#ifndef BOIDS_SIMULATION_STREAMING_BUFFER_HPP
+#define BOIDS_SIMULATION_STREAMING_BUFFER_HPP
+#include <GL/glew.h>
+#include <cstddef>
+#include <vector>
+
+namespace common {
+    // Ring of equally sized segments in one persistently and coherently mapped buffer. Every frame the next
+    // segment is written through the mapping, a fence placed after the draws guards it until the GPU is done.
+    class StreamingBuffer {
+    public:
+        constexpr static const int DEFAULT_SEGMENT_COUNT = 3;
+
+        StreamingBuffer() = default;
+        ~StreamingBuffer();
+
+        StreamingBuffer(const StreamingBuffer &) = delete;
+        StreamingBuffer &operator=(const StreamingBuffer &) = delete;
+
+        // Needs GL 4.4 or ARB_buffer_storage
+        static bool supported();
+
+        // Allocates and maps the storage, returns false if streaming is not supported
+        bool init(size_t segment_size, int segment_count = DEFAULT_SEGMENT_COUNT);
+
+        // Moves to the next segment, waits until the GPU no longer reads it and returns its mapped memory
+        void *begin_segment();
+
+        // Fences the current segment, call after every draw reading it
+        void end_segment();
+
+        GLuint id() const { return m_id; }
+        bool initialized() const { return m_mapped != nullptr; }
+
+        // Byte offset of the current segment in the buffer
+        size_t segment_offset() const { return size_t(m_current) * m_segment_size; }
+
+    private:
+        GLuint m_id{};
+        void *m_mapped{};
+        size_t m_segment_size{};
+        int m_current = -1;
+        std::vector<GLsync> m_fences;
+    };
+}
+
+#endif //BOIDS_SIMULATION_STREAMING_BUFFER_HPP
@@ -0,0 +1,49 @@
+#ifndef BOIDS_SIMULATION_TRIPLE_BUFFER_HPP
+#define BOIDS_SIMULATION_TRIPLE_BUFFER_HPP
+#include <atomic>
+#include <cstdint>
+
+namespace common {
+    // Lock-free single producer, single consumer triple buffer. The producer always has a slot to write,
+    // the consumer always gets the latest published slot, and neither of them ever waits for the other.
+    template <typename T>
+    class TripleBuffer {
+    public:
+        TripleBuffer() = default;
+
+        TripleBuffer(const TripleBuffer &) = delete;
+        TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+        // Producer: slot to fill before publish()
+        T &write_buffer() { return m_slots[m_write]; }
+
+        // Producer: hands the written slot over and takes the spare one back
+        void publish() {
+            m_write = m_middle.exchange(m_write | DIRTY_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        // Consumer: takes the latest published slot, returns false if nothing new was published
+        bool acquire() {
+            if ((m_middle.load(std::memory_order_relaxed) & DIRTY_BIT) == 0) {
+                return false;
+            }
+            m_read = m_middle.exchange(m_read, std::memory_order_acq_rel) & INDEX_MASK;
+            return true;
+        }
+
+        // Consumer: slot taken by the last successful acquire()
+        const T &read_buffer() const { return m_slots[m_read]; }
+
+    private:
+        constexpr static const uint8_t INDEX_MASK = 0x3;
+        constexpr static const uint8_t DIRTY_BIT = 0x4;
+
+        T m_slots[3];
+
+        uint8_t m_write = 0;
+        std::atomic<uint8_t> m_middle { 1 };
+        uint8_t m_read = 2;
+    };
+}
+
+#endif //BOIDS_SIMULATION_TRIPLE_BUFFER_HPP
@@ -0,0 +1,26 @@
+#include "uniform_buffer.hpp"
+#include "gl_debug.h"
+
+common::UniformBuffer::UniformBuffer(GLuint binding, size_t size)
+: m_binding(binding), m_size(size) {
+    GLCall( glGenBuffers(1, &m_id) );
+    GLCall( glBindBuffer(GL_UNIFORM_BUFFER, m_id) );
+    GLCall( glBufferData(GL_UNIFORM_BUFFER, GLsizeiptr(size), nullptr, GL_DYNAMIC_DRAW) );
+    GLCall( glBindBuffer(GL_UNIFORM_BUFFER, 0) );
+    GLCall( glBindBufferBase(GL_UNIFORM_BUFFER, binding, m_id) );
+}
+
+common::UniformBuffer::~UniformBuffer() {
+    GLCall( glDeleteBuffers(1, &m_id) );
+}
+
+void common::UniformBuffer::update(const void *data, size_t size, size_t offset) {
+    if (offset + size > m_size) {
+        std::cerr << "[UniformBuffer]: Update of " << size << " bytes at " << offset
+                  << " exceeds the buffer size " << m_size << std::endl;
+        return;
+    }
+    GLCall( glBindBuffer(GL_UNIFORM_BUFFER, m_id) );
+    GLCall( glBufferSubData(GL_UNIFORM_BUFFER, GLintptr(offset), GLsizeiptr(size), data) );
+    GLCall( glBindBuffer(GL_UNIFORM_BUFFER, 0) );
+}
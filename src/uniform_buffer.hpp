@@ -0,0 +1,31 @@
+#ifndef BOIDS_SIMULATION_UNIFORM_BUFFER_HPP
+#define BOIDS_SIMULATION_UNIFORM_BUFFER_HPP
+#include <GL/glew.h>
+#include <cstddef>
+
+namespace common {
+    // Uniform buffer attached to a fixed binding point, programs refer to it with ShaderProgram::bind_uniform_block.
+    // The layout of the data is std140, the C++ structs mirroring the blocks pad it explicitly.
+    class UniformBuffer {
+    public:
+        UniformBuffer(GLuint binding, size_t size);
+        ~UniformBuffer();
+
+        UniformBuffer(const UniformBuffer &) = delete;
+        UniformBuffer &operator=(const UniformBuffer &) = delete;
+
+        void update(const void *data, size_t size, size_t offset = 0);
+
+        template<typename T>
+        void update(const T &block) { update(&block, sizeof(T)); }
+
+        GLuint binding() const { return m_binding; }
+
+    private:
+        GLuint m_id{};
+        GLuint m_binding;
+        size_t m_size;
+    };
+}
+
+#endif //BOIDS_SIMULATION_UNIFORM_BUFFER_HPP
@@ -0,0 +1,53 @@
+#ifndef BOIDS_SIMULATION_VIEW_CONE_HPP
+#define BOIDS_SIMULATION_VIEW_CONE_HPP
+#include <glm/glm.hpp>
+#include "host_device.hpp"
+
+namespace boids {
+    enum class ConeOverlap : int {
+        Outside,
+        Partial,
+        Inside
+    };
+
+    // True if a neighbour at `offset` (neighbour - boid, |offset|^2 = distance2) is in the view cone around
+    // the unit `forward` vector. Avoids the square root by comparing squares with the sign taken into account.
+    BOIDS_HOST_DEVICE inline bool in_view_cone(glm::vec3 forward, glm::vec3 offset, float distance2, float cos_half_angle) {
+        float t = glm::dot(forward, offset);
+        float bound2 = cos_half_angle * cos_half_angle * distance2;
+        if (cos_half_angle >= 0.f) {
+            return t >= 0.f && t * t >= bound2;
+        }
+        return t >= 0.f || t * t <= bound2;
+    }
+
+    // Classifies a sphere (cell bounds) at `to_center` from the boid against its view cone
+    BOIDS_HOST_DEVICE inline ConeOverlap sphere_in_view_cone(glm::vec3 forward, glm::vec3 to_center, float radius, float cos_half_angle) {
+        float center_distance = glm::length(to_center);
+        if (center_distance <= radius) {
+            return ConeOverlap::Partial;
+        }
+
+        // Angle to the sphere centre (alpha) and angular radius of the sphere (beta)
+        float cos_alpha = glm::clamp(glm::dot(forward, to_center) / center_distance, -1.f, 1.f);
+        float sin_alpha = glm::sqrt(1.f - cos_alpha * cos_alpha);
+        float sin_beta = radius / center_distance;
+        float cos_beta = glm::sqrt(1.f - sin_beta * sin_beta);
+
+        // cos(alpha - beta) < cos(half angle) <=> the nearest point of the sphere is outside the cone
+        float cos_near = cos_alpha * cos_beta + sin_alpha * sin_beta;
+        if (cos_alpha < cos_beta && cos_near < cos_half_angle) {
+            return ConeOverlap::Outside;
+        }
+
+        // cos(alpha + beta) >= cos(half angle) <=> the farthest point of the sphere is inside the cone
+        float cos_far = cos_alpha * cos_beta - sin_alpha * sin_beta;
+        if (cos_far >= cos_half_angle && cos_alpha > -cos_beta) {
+            return ConeOverlap::Inside;
+        }
+
+        return ConeOverlap::Partial;
+    }
+}
+
+#endif //BOIDS_SIMULATION_VIEW_CONE_HPP
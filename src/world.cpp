@@ -0,0 +1,35 @@
+#include "world.hpp"
+#include <algorithm>
+#include "boids_cpu.hpp"
+
+boids::cpu::World::World(const SimulationParameters &params, bool use_grid)
+: m_params(params), m_use_grid(use_grid), m_state(std::make_unique<SimulationState>(params)),
+  m_environment(SignedDistanceField::bake(SdfScene::aquarium(params.aquarium_size))) {
+    m_params.boids_count = std::clamp(m_params.boids_count, 0, int(SimulationParameters::MAX_BOID_COUNT));
+}
+
+void boids::cpu::World::set_params(const SimulationParameters &params) {
+    bool rebake = params.aquarium_size != m_params.aquarium_size;
+    m_params = params;
+    m_params.boids_count = std::clamp(m_params.boids_count, 0, int(SimulationParameters::MAX_BOID_COUNT));
+    if (rebake) {
+        m_environment = SignedDistanceField::bake(SdfScene::aquarium(m_params.aquarium_size));
+    }
+}
+
+void boids::cpu::World::reset() {
+    m_state->reset(m_params);
+    m_step_count = 0;
+}
+
+void boids::cpu::World::step(float dt, int steps, Execution execution) {
+    SdfView environment = m_environment.view();
+    for (int i = 0; i < steps; ++i) {
+        if (m_use_grid) {
+            update_simulation_with_grid(m_params, m_obstacles, environment, m_grid, *m_state, dt, execution);
+        } else {
+            update_simulation_naive(m_params, m_obstacles, environment, *m_state, dt, execution);
+        }
+        ++m_step_count;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef BOIDS_SIMULATION_WORLD_HPP
+#define BOIDS_SIMULATION_WORLD_HPP
+#include <memory>
+#include "boids.hpp"
+#include "execution.hpp"
+#include "sdf.hpp"
+#include "simulation_state.hpp"
+#include "spatial_grid.hpp"
+
+namespace boids::cpu {
+    // One headless CPU simulation with everything a step needs, for hosts driving it directly
+    // (sweeps, scripting bindings) instead of through SimulationThread
+    class World {
+    public:
+        explicit World(const SimulationParameters &params, bool use_grid = true);
+
+        World(const World &) = delete;
+        World &operator=(const World &) = delete;
+
+        const SimulationParameters &params() const { return m_params; }
+
+        // Rebakes the walls if the aquarium size changed, boids keep their state
+        void set_params(const SimulationParameters &params);
+
+        bool use_grid() const { return m_use_grid; }
+        void set_use_grid(bool use_grid) { m_use_grid = use_grid; }
+
+        Obstacles &obstacles() { return m_obstacles; }
+        const Obstacles &obstacles() const { return m_obstacles; }
+
+        // Random positions and velocities, from the generator of the calling thread
+        void reset();
+
+        void step(float dt, int steps = 1, Execution execution = Execution::Parallel);
+        uint64_t step_count() const { return m_step_count; }
+
+        // Last completed step. Steps swap the front and back buffers, so references and
+        // pointers into it are only valid until the next step.
+        const Boids &boids() const { return m_state->front(); }
+        Boids &boids() { return m_state->front(); }
+
+        const SpatialGrid &grid() const { return m_grid; }
+
+    private:
+        SimulationParameters m_params;
+        bool m_use_grid;
+        Obstacles m_obstacles;
+        std::unique_ptr<SimulationState> m_state;
+        SpatialGrid m_grid;
+        SignedDistanceField m_environment;
+        uint64_t m_step_count = 0;
+    };
+}
+
+#endif //BOIDS_SIMULATION_WORLD_HPP
@@ -0,0 +1,127 @@
+#include "async_readback.hpp"
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#define CHECK(condition) do { if (!(condition)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); return 1; } } while (0)
+
+namespace {
+    // Host stand-in for the device: queued copies and fences run only when the test advances the queue
+    class MockCopyEngine : public boids::CopyEngine {
+    public:
+        void *allocate_host(size_t size) override { ++allocations; return ::operator new(size); }
+        void free_host(void *ptr) override { ++frees; ::operator delete(ptr); }
+
+        void wait_for_device() override { ++device_orderings; }
+        void copy_to_host(void *dst, const void *src, size_t size) override {
+            m_queue.emplace_back([=]() { std::memcpy(dst, src, size); });
+        }
+
+        void record_fence(int slot) override {
+            m_reached[slot] = false;
+            m_queue.emplace_back([this, slot]() { m_reached[slot] = true; });
+        }
+        bool fence_reached(int slot) override { return m_reached[slot]; }
+        void wait_fence(int slot) override {
+            ++host_waits;
+            while (!m_reached[slot]) {
+                run_one();
+            }
+        }
+        void device_wait_fence(int slot) override { device_waits.push_back(slot); }
+
+        void run_all() {
+            while (!m_queue.empty()) {
+                run_one();
+            }
+        }
+
+        int allocations = 0;
+        int frees = 0;
+        int device_orderings = 0;
+        int host_waits = 0;
+        std::vector<int> device_waits;
+
+    private:
+        void run_one() {
+            std::function<void()> operation = std::move(m_queue.front());
+            m_queue.pop_front();
+            operation();
+        }
+
+        std::deque<std::function<void()>> m_queue;
+        bool m_reached[boids::AsyncReadback::SLOT_COUNT] = { true, true };
+    };
+
+    constexpr size_t CAPACITY = 100;
+
+    // Every request gets buffers of its own, the copies read them only when the queue runs
+    class DeviceBuffers {
+    public:
+        boids::AsyncReadback::DeviceSources next(float value) {
+            m_buffers.emplace_back(4 * CAPACITY, glm::vec4(value));
+            const glm::vec4 *data = m_buffers.back().data();
+            return { data, data + CAPACITY, data + 2 * CAPACITY, data + 3 * CAPACITY };
+        }
+
+    private:
+        std::deque<std::vector<glm::vec4>> m_buffers;
+    };
+}
+
+int main() {
+    MockCopyEngine engine;
+    {
+        boids::AsyncReadback readback(engine, CAPACITY);
+        DeviceBuffers device;
+        boids::ReadbackFrame frame{};
+
+        // Nothing is one request behind yet, and the first copies have not run
+        boids::ReadbackTicket first = readback.request(10, device.next(1.f));
+        CHECK(engine.device_orderings == 1);
+        CHECK(!readback.acquire_previous(frame));
+        CHECK(!readback.is_ready(first));
+        CHECK(!readback.poll_latest(frame));
+
+        // Kernels overwriting the sources wait on the device for the copies in flight, not on the host
+        readback.protect_sources();
+        CHECK(engine.device_waits == std::vector<int>{ first.slot });
+        CHECK(engine.host_waits == 0);
+
+        // The second request leaves the first to the host, which waits for its copies only
+        boids::ReadbackTicket second = readback.request(20, device.next(2.f));
+        CHECK(readback.acquire_previous(frame));
+        CHECK(frame.sequence == first.sequence && frame.count == 10);
+        CHECK(frame.position[9].x == 1.f && frame.right[0].x == 1.f);
+        CHECK(engine.host_waits == 1);
+        CHECK(!readback.acquire_previous(frame));
+
+        engine.run_all();
+        CHECK(readback.is_ready(second));
+        CHECK(readback.poll_latest(frame) && frame.sequence == second.sequence && frame.up[19].x == 2.f);
+
+        // A third request reuses the slot of the first
+        boids::ReadbackTicket third = readback.request(5, device.next(3.f));
+        CHECK(!readback.is_valid(first) && readback.is_valid(second) && readback.is_valid(third));
+        CHECK(!readback.wait(first, frame));
+
+        // Counts are clamped to the capacity
+        readback.request(500, device.next(4.f));
+        engine.run_all();
+        CHECK(readback.poll_latest(frame) && frame.count == int(CAPACITY) && frame.position[CAPACITY - 1].x == 4.f);
+
+        // Frames requested before a reset are never returned
+        readback.request(7, device.next(5.f));
+        readback.reset();
+        CHECK(!readback.poll_latest(frame) && !readback.acquire_previous(frame));
+        readback.request(7, device.next(6.f));
+        readback.request(7, device.next(7.f));
+        CHECK(readback.acquire_previous(frame) && frame.position[0].x == 6.f);
+    }
+    CHECK(engine.allocations == boids::AsyncReadback::SLOT_COUNT && engine.frees == boids::AsyncReadback::SLOT_COUNT);
+
+    std::printf("async_readback_test passed\n");
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "parameter_store.hpp"
+#include <cstdio>
+#include <vector>
+
+#define CHECK(condition) do { if (!(condition)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); return 1; } } while (0)
+
+namespace {
+    // Host stand-in for the device, counts the uploads and keeps the last obstacles it received
+    class MockParameterSink : public boids::ParameterSink {
+    public:
+        void upload_params(const boids::SimulationParameters &params) override {
+            ++params_uploads;
+            last_params = params;
+        }
+
+        void upload_obstacles(size_t count, const glm::vec3 *position, const float *radius) override {
+            ++obstacles_uploads;
+            last_position.assign(position, position + count);
+            last_radius.assign(radius, radius + count);
+        }
+
+        int params_uploads = 0;
+        int obstacles_uploads = 0;
+        boids::SimulationParameters last_params;
+        std::vector<glm::vec3> last_position;
+        std::vector<float> last_radius;
+    };
+}
+
+int main() {
+    boids::ParameterStore store;
+    MockParameterSink sink;
+    boids::ParameterUploader uploader(sink);
+    boids::SimulationParameters params;
+    boids::Obstacles obstacles;
+
+    // The first update stores everything, even the empty obstacle list
+    boids::ParameterStore::Changes changes = store.update(params, obstacles);
+    CHECK(changes.params && changes.obstacles);
+    CHECK(uploader.sync(store));
+    CHECK(sink.params_uploads == 1 && sink.obstacles_uploads == 1 && sink.last_position.empty());
+
+    // Steps with unchanged inputs copy nothing
+    for (int step = 0; step < 10; ++step) {
+        changes = store.update(params, obstacles);
+        CHECK(!changes.params && !changes.obstacles);
+        CHECK(!uploader.sync(store));
+    }
+    CHECK(sink.params_uploads == 1 && sink.obstacles_uploads == 1);
+
+    // Signed zeros compare equal, so flipping the sign of a zero weight is no change
+    params.noise = 0.f;
+    store.update(params, obstacles);
+    params.noise = -0.f;
+    CHECK(!store.update(params, obstacles).params);
+
+    // Every field takes part in the comparison
+    boids::SimulationParameters changed = params;
+    changed.shader_orientation = !changed.shader_orientation;
+    CHECK(changed != params);
+    changed = params;
+    changed.aquarium_size.z += 1.f;
+    CHECK(changed != params);
+
+    // A parameter change uploads the parameters only
+    params.cohesion += 1.f;
+    CHECK(store.update(params, obstacles).params);
+    CHECK(uploader.sync(store));
+    CHECK(sink.params_uploads == 2 && sink.obstacles_uploads == 1 && sink.last_params.cohesion == params.cohesion);
+
+    // Obstacles are found changed when added or edited in place
+    obstacles.push(glm::vec3(1.f, 2.f, 3.f), 4.f);
+    store.update(params, obstacles);
+    uploader.sync(store);
+    CHECK(sink.params_uploads == 2 && sink.obstacles_uploads == 2 && sink.last_position.size() == 1);
+
+    obstacles.pos(0).x = 5.f;
+    store.update(params, obstacles);
+    uploader.sync(store);
+    CHECK(sink.obstacles_uploads == 3 && sink.last_position[0].x == 5.f);
+
+    obstacles.radius(0) = 1.f;
+    store.update(params, obstacles);
+    uploader.sync(store);
+    CHECK(sink.obstacles_uploads == 4 && sink.last_radius[0] == 1.f);
+
+    // Invalidating the uploader uploads everything again without touching the store
+    uploader.invalidate();
+    CHECK(uploader.sync(store));
+    CHECK(sink.params_uploads == 3 && sink.obstacles_uploads == 5);
+
+    obstacles.remove(0);
+    store.update(params, obstacles);
+    CHECK(uploader.obstacles_dirty(store) && !uploader.params_dirty(store));
+    uploader.sync(store);
+    CHECK(sink.last_position.empty() && sink.last_radius.empty());
+
+    std::printf("parameter_store_test passed\n");
+    return 0;
+}